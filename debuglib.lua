@@ -12,15 +12,19 @@
 require("java_bridge/java_bridge")
 local Event = require("debuglib/event")
 local Frame = require("debuglib/frame")
-
--- options
-options = {}
+local Condition = require("debuglib/condition")
+local Snapshot = require("debuglib/snapshot")
+local Heap = require("debuglib/heap")
+-- defines `options' and `shared'
+require("debuglib/shared")
 
 -- current stack depth
 depth = 1
 
 -- breakpoint list
 breakpoints = {}
+-- breakpoints indexed by the id returned from lj_set_breakpoint()
+breakpoints_by_id = {}
 
 -- thread condition variable -- initialized in C code
 thread_resume_monitor = nil
@@ -92,6 +96,7 @@ function start_cmd()
       local chunk = load(cmd)
 	  if debug_thread == nil then
 		 local success, m2 = xpcall(chunk, x)
+		 lj_reset_arena()
 		 if success then
 			dbgio:print(m2)
 		 end
@@ -132,18 +137,34 @@ function stack()
    return current_thread().frames
 end
 
+-- ============================================================
+-- Print the stacks of all threads, identical stacks are grouped
+-- together if `group' is true
+-- ============================================================
+function threaddump(group, max_frames)
+   local dump = lj_thread_dump(max_frames, group)
+   dbgio:print(dump)
+   return dump
+end
+
 -- ============================================================
 -- Print local variables in current stack frame
 -- ============================================================
 function locals()
    local frame = current_thread().frames[depth]
-   local var_table = frame.method_id.local_variable_table
-   if var_table == nil then
+   if frame.method_id.local_variable_table == nil then
       dbgio:print("No local variable table")
       return
    end
-   for k, v in pairs(var_table) do
-      dbgio:print(string.format("%10s = %s", k, frame[k]))
+   -- all values are read at once
+   local values = frame:locals()
+   local names = {}
+   for k in pairs(values) do
+      table.insert(names, k)
+   end
+   table.sort(names)
+   for idx, k in ipairs(names) do
+      dbgio:print(string.format("%10s = %s", k, values[k]))
    end
 end
 
@@ -222,11 +243,52 @@ end
 
 -- ============================================================
 -- Add a new breakpoint
--- takes a method declaration, line number (can be 0)
+-- takes a method declaration, line number (can be 0) and an
+-- optional condition, see debuglib/condition.lua
+-- ============================================================
+function bp(method, line_num, condition)
+   return set_breakpoint(method, line_num, condition, nil)
+end
+
+-- ============================================================
+-- Add a new tracepoint
+-- A tracepoint doesn't stop the thread, it records the values in
+-- `capture' (eg. "count, this.name") to be printed by tracelog()
+-- ============================================================
+function tp(method, line_num, capture, condition)
+   return set_breakpoint(method, line_num, condition, capture or "")
+end
+
+-- ============================================================
+-- Install the breakpoint `b' with its condition and captures
+local function install_breakpoint(b, condition)
+   local clauses = condition and Condition.compile(condition, b.method_id, b.location)
+   local captures
+   if b.capture then
+      captures, b.capture_names = Condition.compile_operands(b.capture, b.method_id, b.location)
+   end
+   return lj_set_breakpoint(b.method_id.method_id_raw, b.location, clauses, captures, b.action)
+end
+
 -- ============================================================
-function bp(method, line_num)
+-- Replace the native breakpoint after changing `b', keeping it enabled
+-- or disabled. The hit count starts over.
+local function reinstall_breakpoint(b)
+   local enabled = b.enabled
+   lj_clear_breakpoint(b.method_id.method_id_raw, b.location)
+   breakpoints_by_id[b.id] = nil
+   b.id = install_breakpoint(b, b.condition)
+   breakpoints_by_id[b.id] = b
+   lj_set_breakpoint_enabled(b.id, enabled)
+end
+
+-- ============================================================
+-- Common code for bp() and tp(), `capture' is nil for breakpoints
+function set_breakpoint(method, line_num, condition, capture)
    local b = {}
    b.line_num = line_num or 0
+   b.condition = condition
+   b.capture = capture
 
    if type(method) == "string" then
       b.method_id = jmethod_id.find(method)
@@ -237,7 +299,7 @@ function bp(method, line_num)
       b.method_id = method
    elseif type(method) == "table" and method.classname == "jcallable_method" then
       for i = 1, #method.possible_methods do
-         bp(method.possible_methods[i])
+         set_breakpoint(method.possible_methods[i], nil, condition, capture)
       end
       return
    else
@@ -251,11 +313,9 @@ function bp(method, line_num)
    end
 
    -- make sure bp doesn't already exist
-   for idx, bp in ipairs(breakpoints) do
-      if bp.method_id == b.method_id and bp.location == b.location then
-         dbgio:print("Breakpoint already exists")
-         return
-      end
+   if lj_find_breakpoint(b.method_id.method_id_raw, b.location) then
+      dbgio:print("Breakpoint already exists")
+      return
    end
 
    -- add tostring()
@@ -268,11 +328,38 @@ function bp(method, line_num)
       if (bp.line_num) then
          disp = disp .. " (line " .. bp.line_num .. ")"
       end
+      if bp.capture then
+         disp = disp .. " trace[" .. bp.capture .. "]"
+      end
+      if bp.condition then
+         disp = disp .. " if " .. bp.condition
+      end
+      if bp.action then
+         disp = disp .. " (action)"
+      end
+      local hit_count = bp.hit_count
+      if not hit_count then
+         disp = disp .. " (cleared)"
+      else
+         disp = disp .. " hits=" .. hit_count
+      end
+      if bp.enabled == false then
+         disp = disp .. " (disabled)"
+      end
       return disp
    end
+   -- hit count and enabled state are kept in the native breakpoint
+   -- table, they are nil once the breakpoint is cleared
+   b.__index = function(bp, key)
+      if key == "hit_count" or key == "enabled" then
+         local info = lj_get_breakpoint_info(rawget(bp, "id"))
+         return info and info[key]
+      end
+   end
 
-   lj_set_breakpoint(b.method_id.method_id_raw, b.location)
+   b.id = install_breakpoint(b, condition)
    table.insert(breakpoints, b)
+   breakpoints_by_id[b.id] = b
    dbgio:print("ok")
 
    return b
@@ -328,9 +415,112 @@ function bc(num)
    local desc = string.format("%s", b)
    lj_clear_breakpoint(b.method_id.method_id_raw, b.location)
    table.remove(breakpoints, num)
+   breakpoints_by_id[b.id] = nil
    dbgio:print("cleared ", desc)
 end
 
+-- ============================================================
+-- Change the condition of a breakpoint, nil to remove it
+-- The breakpoint is re-installed so the hit count starts over
+-- ============================================================
+function bcond(num, condition)
+   local b = breakpoints[num]
+   if not b then
+      dbgio:print("unknown breakpoint")
+      return
+   end
+   -- compile first so an invalid condition leaves the breakpoint as is
+   if condition then
+      Condition.compile(condition, b.method_id, b.location)
+   end
+   b.condition = condition
+   reinstall_breakpoint(b)
+   return b
+end
+
+-- ============================================================
+-- Set the action of a breakpoint, nil to remove it
+-- The action is Lua code run on the thread hitting the breakpoint,
+-- without taking debug_lock, in a separate Lua state that only has
+-- java_bridge, `options' and `shared' loaded. It receives the raw
+-- thread, method id and location as `...' and the debugger is only
+-- entered if it returns true.
+-- ============================================================
+function baction(num, action)
+   local b = breakpoints[num]
+   if not b then
+      dbgio:print("unknown breakpoint")
+      return
+   end
+   if action then
+      local chunk, err = load(action)
+      if not chunk then
+         error("Invalid action: " .. err)
+      end
+   end
+   b.action = action
+   reinstall_breakpoint(b)
+   return b
+end
+
+-- ============================================================
+-- Print and return the values recorded by tracepoints since the last
+-- call
+-- ============================================================
+function tracelog()
+   local records, dropped = lj_drain_trace_log()
+   for idx, rec in ipairs(records) do
+      local b = breakpoints_by_id[rec.id]
+      local where
+      if b then
+         where = string.format("%s.%s", b.method_id.class.name, b.method_id.name)
+      else
+         where = "tracepoint " .. rec.id
+      end
+      local values = {}
+      for i = 1, rec.values.n do
+         local name = b and b.capture_names[i] or ("$" .. i)
+         table.insert(values, name .. "=" .. tostring(rec.values[i]))
+      end
+      dbgio:print(string.format("[%s] %s@%d %s", rec.thread, where,
+                                rec.location, table.concat(values, ", ")))
+   end
+   if dropped > 0 then
+      dbgio:print(dropped .. " trace records dropped")
+   end
+   return records
+end
+
+-- ============================================================
+-- Disable breakpoint(s), they remain installed but are not hit
+-- ============================================================
+function bd(num)
+   set_breakpoints_enabled(num, false)
+end
+
+-- ============================================================
+-- Enable breakpoint(s)
+-- ============================================================
+function be(num)
+   set_breakpoints_enabled(num, true)
+end
+
+function set_breakpoints_enabled(num, enabled)
+   if not num then
+      for idx, b in ipairs(breakpoints) do
+         lj_set_breakpoint_enabled(b.id, enabled)
+      end
+      return
+   end
+
+   local b = breakpoints[num]
+   if not b then
+      dbgio:print("unknown breakpoint")
+      return
+   end
+   lj_set_breakpoint_enabled(b.id, enabled)
+end
+
 --       ___      ____  __ _______ _____    _____      _ _ _                _        
 --      | \ \    / /  \/  |__   __|_   _|  / ____|    | | | |              | |       
 --      | |\ \  / /| \  / |  | |    | |   | |     __ _| | | |__   __ _  ___| | _____ 
@@ -341,21 +531,18 @@ end
 -- ============================================================
 -- Handle the callback when a breakpoint is hit
 -- ============================================================
-function cb_breakpoint(thread_raw, method_id_raw, location)
+function cb_breakpoint(thread_raw, method_id_raw, location, bp_id)
    debug_lock:lock()
-   debug_thread = current_thread()
-
-   -- TODO should be done in C code?
-   local method_id = jmethod_id.from_raw_method_id(method_id_raw)
-
-   local bp
-   for idx, v in pairs(breakpoints) do
-      -- TODO and test location
-      if v.method_id == method_id then
-         bp = v
-      end
+   -- the breakpoint was matched by (method, location) in C code, it may
+   -- have been cleared or reinstalled with a new id by bc(), bcond() or
+   -- baction() while this thread waited for debug_lock
+   local bp = breakpoints_by_id[bp_id]
+   if not bp then
+      debug_lock:unlock()
+      return
    end
-   assert(bp)
+   debug_thread = current_thread()
+   debug_thread:enter_event()
 
    depth = 1
    dbgio:print()
@@ -378,6 +565,7 @@ function cb_breakpoint(thread_raw, method_id_raw, location)
 	  debug_thread:handle_events()
    end
 
+   debug_thread:leave_event()
    debug_thread = nil
    debug_lock:unlock()
 end
@@ -388,11 +576,13 @@ end
 function cb_method_exit(thread_raw, method_id_raw, was_popped_by_exception, return_value)
    debug_lock:lock()
    debug_thread = current_thread()
+   debug_thread:enter_event()
 
    dbgio:print(current_thread().frames[depth])
    debug_event:broadcast_without_lock()
    debug_thread:handle_events()
 
+   debug_thread:leave_event()
    debug_thread = nil
    debug_lock:unlock()
 end
@@ -400,6 +590,7 @@ end
 function cb_single_step(thread_raw, method_id_raw, location)
    debug_lock:lock()
    debug_thread = current_thread()
+   debug_thread:enter_event()
 
    local method_id = jmethod_id.from_raw_method_id(method_id_raw)
 
@@ -427,6 +618,7 @@ function cb_single_step(thread_raw, method_id_raw, location)
 	  debug_thread:handle_events()
    end
 
+   debug_thread:leave_event()
    debug_thread = nil
    debug_lock:unlock()
 end
@@ -566,6 +758,104 @@ function method_location_for_line_num(jmethod_id, line_num)
    return lnt[#lnt].location
 end
 
+-- ============================================================
+-- Print the `top' (default 20) classes by shallow size of their
+-- instances, all classes if `top' is 0
+-- ============================================================
+function histogram(top)
+   local histo = lj_heap_histogram(top)
+   dbgio:print(Heap.format_histogram(histo))
+   return histo
+end
+
+-- ============================================================
+-- Save a histogram of the heap as snapshot `name'. Without a name the
+-- saved snapshots are listed
+-- ============================================================
+function heapsnap(name)
+   if not name then
+      for _, snap in ipairs(lj_heap_snapshots()) do
+         dbgio:print(string.format("%-20s %14.0f %16.0f  (%d classes)", snap.name,
+                                   snap.total_count, snap.total_bytes, snap.class_count))
+      end
+      return
+   end
+   local class_count, total_count, total_bytes = lj_heap_snapshot(name)
+   dbgio:print(string.format("Snapshot '%s': %.0f instances, %.0f bytes, %d classes",
+                             name, total_count, total_bytes, class_count))
+end
+
+-- ============================================================
+-- Print the classes that grew most between snapshots `a' and `b', or
+-- between `a' and the current heap if `b' is nil
+-- ============================================================
+function heapdiff(a, b, top)
+   local diff = lj_heap_diff(a, b, top)
+   dbgio:print(Heap.format_diff(diff))
+   return diff
+end
+
+-- ============================================================
+-- Print the shortest chain of references from a GC root to `obj'.
+-- The search stops after `max_objects' objects or `timeout' seconds
+-- ============================================================
+function why_alive(obj, max_objects, timeout)
+   if not jobject.is_jobject(obj) then
+      error("Not an object")
+   end
+   local path, reason = lj_why_alive(obj.object_raw, max_objects, timeout)
+   if not path then
+      dbgio:print(reason)
+      return nil
+   end
+   dbgio:print(Heap.format_path(path))
+   for _, step in ipairs(path) do
+      if step.object then
+         step.object = jobject.create(step.object)
+      end
+   end
+   return path
+end
+
+-- ============================================================
+-- Print the retained size of `obj' (an object or a table of objects),
+-- or of the top classes if `obj' is a number or nil
+-- ============================================================
+function retained(obj, max_objects, timeout)
+   if obj == nil or type(obj) == "number" then
+      local sizes = lj_retained_sizes(obj, max_objects, timeout)
+      dbgio:print(Heap.format_retained(sizes))
+      return sizes
+   end
+   local objects = obj
+   if jobject.is_jobject(obj) then
+      objects = {obj.object_raw}
+   else
+      objects = {}
+      for idx, o in ipairs(obj) do
+         objects[idx] = o.object_raw
+      end
+   end
+   local size, shallow, truncated = lj_retained_size(objects, max_objects, timeout)
+   dbgio:print(string.format("retained %.0f bytes, shallow %.0f bytes%s", size, shallow,
+                             truncated and " (graph incomplete: " .. truncated .. ")" or ""))
+   return size
+end
+
+-- ============================================================
+-- Print the fields of an object, following references `depth' levels
+-- deep. `limits' is an optional table of max_fields, max_string and
+-- max_elements
+-- ============================================================
+function inspect(obj, depth, limits)
+   if not jobject.is_jobject(obj) then
+      error("Not an object")
+   end
+   local snap = lj_snapshot_object(obj.object_raw, depth or 1, limits)
+   dbgio:print(Snapshot.format(snap))
+   return snap
+end
+
 -- ============================================================
 -- http://snippets.luacode.org/?p=snippets/Simple_Table_Dump_7
 -- fixed to print recursive tables
@@ -597,6 +887,9 @@ function dump_internal(o)
 
    if classname == "jclass" then
       return o.dump(prefix)
+   elseif classname == "jobject" or classname == "jthread" or classname == "jarray" then
+      dump_depth = dump_depth - 1
+      return Snapshot.format(lj_snapshot_object(o.object_raw, 0), prefix)
    elseif classname == "jfield_id" or classname == "jmethod_id" then
       return string.format("%s%s", prefix, o)
    elseif type(o) == 'table' then
@@ -0,0 +1,163 @@
+-- Breakpoint conditions
+--
+-- A condition is compiled here into a table of clauses which is given
+-- to lj_set_breakpoint() and evaluated in C code when the breakpoint
+-- is hit. A false condition resumes the thread without entering Lua.
+--
+-- Syntax is one or more comparisons joined with `and':
+--    customerId == "C-1234"
+--    count >= 10 and this.state ~= null
+--    thread.name == "main"
+-- Operands are local variables, fields of `this' and `thread.name'.
+-- Constants are numbers, strings, true, false and null.
+--
+-- The same operands are used for the values captured by tracepoints.
+local Condition = { classname = "Condition" }
+
+local operators = {
+   ["=="] = true, ["~="] = true, ["!="] = true,
+   ["<"] = true, ["<="] = true, [">"] = true, [">="] = true
+}
+
+local token_patterns = {
+   '^"[^"]*"',
+   "^'[^']*'",
+   "^%-?%d+%.?%d*",
+   "^[%a_$][%w_$%.]*",
+   "^[=~!<>]=?"
+}
+
+-- ============================================================
+local function tokenize(expr)
+   local tokens = {}
+   local pos = 1
+   while pos <= #expr do
+      local s, e = expr:find("^%s+", pos)
+      if not s then
+         for idx, pattern in ipairs(token_patterns) do
+            s, e = expr:find(pattern, pos)
+            if s then
+               table.insert(tokens, expr:sub(s, e))
+               break
+            end
+         end
+         if not s then
+            error("Invalid character in condition at: " .. expr:sub(pos))
+         end
+      end
+      pos = e + 1
+   end
+   return tokens
+end
+
+-- ============================================================
+local function is_primitive(sig)
+   return #sig == 1
+end
+
+-- ============================================================
+-- Resolve the name of an operand to where it is read from
+local function compile_operand(name, method_id, location)
+   if name == "thread.name" then
+      return {source="thread_name", sig="Ljava/lang/String;"}
+   end
+
+   local field_name = name:match("^this%.([%a_$][%w_$]*)$")
+   if field_name then
+      if method_id.modifiers.static then
+         error("No `this' in static method " .. method_id.name)
+      end
+      local field = method_id.class:find_field(field_name)
+      if not field or field.modifiers.static then
+         error("No instance field `" .. field_name .. "' in " .. method_id.class.name)
+      end
+      return {source="field", field_id=field.field_id_raw, sig=field.sig}
+   end
+
+   if not method_id.local_variable_table then
+      error("No local variable information for " .. method_id.name .. ", compile with -g")
+   end
+   local var = method_id.local_variable_table[name]
+   if not var then
+      error("Unknown local variable `" .. name .. "'")
+   end
+   if location < var.start_location or location > var.start_location + var.length then
+      error("Local variable `" .. name .. "' is not in scope at location " .. location)
+   end
+   return {source="local", slot=var.slot, sig=var.sig}
+end
+
+-- ============================================================
+-- Returns the constant value and whether it is valid to compare with `sig'
+local function compile_constant(token, sig)
+   local quote = token:sub(1, 1)
+   if quote == '"' or quote == "'" then
+      return token:sub(2, -2), sig == "Ljava/lang/String;"
+   elseif token == "true" or token == "false" then
+      return token == "true", sig == "Z"
+   elseif token == "null" or token == "nil" then
+      return nil, not is_primitive(sig)
+   elseif tonumber(token) then
+      return tonumber(token), is_primitive(sig) and sig ~= "Z"
+   end
+   error("Invalid constant `" .. token .. "'")
+end
+
+-- ============================================================
+--- Compile a condition for a breakpoint at `location' in `method_id'
+-- @return An array of clauses suitable for lj_set_breakpoint()
+function Condition.compile(expr, method_id, location)
+   local tokens = tokenize(expr)
+   local clauses = {}
+   local i = 1
+   while true do
+      local name, op, constant = tokens[i], tokens[i + 1], tokens[i + 2]
+      if not constant then
+         error("Incomplete condition, expected <operand> <op> <constant>")
+      end
+      if not operators[op] then
+         error("Invalid operator `" .. op .. "'")
+      end
+
+      local clause = compile_operand(name, method_id, location)
+      local value, valid = compile_constant(constant, clause.sig)
+      if not valid then
+         error(string.format("Cannot compare `%s' (%s) with %s", name, clause.sig, constant))
+      end
+      if value == nil and op ~= "==" and op ~= "~=" and op ~= "!=" then
+         error("null can only be compared with == or ~=")
+      end
+      if not is_primitive(clause.sig) and clause.sig ~= "Ljava/lang/String;" and value ~= nil then
+         error("Objects can only be compared with null")
+      end
+      clause.op = op
+      clause.value = value
+      table.insert(clauses, clause)
+
+      i = i + 3
+      if tokens[i] == nil then
+         break
+      elseif tokens[i] ~= "and" then
+         error("Expected `and' but found `" .. tokens[i] .. "'")
+      end
+      i = i + 1
+   end
+   return clauses
+end
+
+-- ============================================================
+--- Compile a comma separated list of operands to capture at `location'
+-- @return An array of operands suitable for lj_set_breakpoint() and
+-- an array of their names
+function Condition.compile_operands(list, method_id, location)
+   local operands = {}
+   local names = {}
+   for name in list:gmatch("[^,]+") do
+      name = name:match("^%s*(.-)%s*$")
+      table.insert(operands, compile_operand(name, method_id, location))
+      table.insert(names, name)
+   end
+   return operands, names
+end
+
+return Condition
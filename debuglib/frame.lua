@@ -29,12 +29,31 @@ function Frame:__index(k)
 end
 
 -- ============================================================
+--- Read all local variables in scope at the current location
+-- @return A table of the values by name. Objects are wrapped when
+-- they are first accessed
 function Frame:locals()
-   local locals = {}
-   for k, v in pairs(self.frame.method_id.local_variable_table) do
-      locals[k] = self[k]
-   end
-   return locals
+   local values = lj_get_frame_locals(self.thread.object_raw, self.depth)
+   local vars = self.method_id.local_variable_table
+   return setmetatable({}, {
+      __index = function(t, k)
+         local v = values[k]
+         if v == nil then
+            return nil
+         end
+         v = create_return_value(v, vars[k].sig)
+         rawset(t, k, v)
+         return v
+      end,
+      __pairs = function(t)
+         return function(_, k)
+            local name = next(values, k)
+            if name ~= nil then
+               return name, t[name]
+            end
+         end, t, nil
+      end
+   })
 end
 
 function Frame:local_slot(slot, sig)
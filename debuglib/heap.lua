@@ -0,0 +1,89 @@
+-- Heap histograms
+--
+-- Formats the tables returned by lj_heap_histogram():
+--    {{name=, count=, bytes=}, ..., total_count=, total_bytes=, class_count=}
+-- and lj_heap_diff():
+--    {{name=, count=, bytes=, count_delta=, bytes_delta=}, ...,
+--     total_count_delta=, total_bytes_delta=}
+-- and retained sizes from lj_retained_sizes():
+--    {{name=, count=, shallow=, retained=}, ..., total_bytes=, object_count=, truncated=}
+-- and reference chains from lj_why_alive():
+--    {{object=, class=}, {object=, class=, kind=, field=, index=}, ...,
+--     root={kind=, thread_id=, depth=, method=}, truncated=}
+local Heap = { classname = "Heap" }
+
+-- ============================================================
+--- Format a histogram in the style of jmap -histo
+function Heap.format_histogram(histo)
+   local lines = {}
+   table.insert(lines, string.format("%5s %14s %16s  %s", "num", "#instances", "#bytes", "class name"))
+   for idx, class in ipairs(histo) do
+      table.insert(lines, string.format("%4d: %14.0f %16.0f  %s", idx, class.count, class.bytes, class.name))
+   end
+   table.insert(lines, string.format("Total %14.0f %16.0f  (%d classes)",
+                                     histo.total_count, histo.total_bytes, histo.class_count))
+   return table.concat(lines, "\n")
+end
+
+-- ============================================================
+--- Format the difference between two histograms, largest growth first
+function Heap.format_diff(diff)
+   local lines = {}
+   table.insert(lines, string.format("%5s %14s %16s %14s %16s  %s",
+                                     "num", "+instances", "+bytes", "#instances", "#bytes", "class name"))
+   for idx, class in ipairs(diff) do
+      table.insert(lines, string.format("%4d: %+14.0f %+16.0f %14.0f %16.0f  %s", idx,
+                                        class.count_delta, class.bytes_delta,
+                                        class.count, class.bytes, class.name))
+   end
+   table.insert(lines, string.format("Total %+14.0f %+16.0f",
+                                     diff.total_count_delta, diff.total_bytes_delta))
+   return table.concat(lines, "\n")
+end
+
+-- ============================================================
+--- Format the classes by retained size
+function Heap.format_retained(sizes)
+   local lines = {}
+   table.insert(lines, string.format("%5s %14s %16s %16s  %s", "num", "#instances", "#shallow", "#retained", "class name"))
+   for idx, class in ipairs(sizes) do
+      table.insert(lines, string.format("%4d: %14.0f %16.0f %16.0f  %s", idx, class.count,
+                                        class.shallow, class.retained, class.name))
+   end
+   table.insert(lines, string.format("Total %14.0f %16.0f", sizes.object_count, sizes.total_bytes))
+   if sizes.truncated then
+      table.insert(lines, string.format("(graph incomplete: %s)", sizes.truncated))
+   end
+   return table.concat(lines, "\n")
+end
+
+-- ============================================================
+--- Format a chain of references from a GC root, one object per line
+function Heap.format_path(path)
+   local lines = {}
+   local root = path.root
+   if root.method then
+      table.insert(lines, string.format("root: %s in %s (thread %.0f, depth %d)",
+                                        root.kind, root.method, root.thread_id, root.depth))
+   else
+      table.insert(lines, string.format("root: %s", root.kind))
+   end
+   for idx, step in ipairs(path) do
+      local class = step.class or "<collected>"
+      if idx == 1 then
+         table.insert(lines, string.format("   %s", class))
+      elseif step.field then
+         table.insert(lines, string.format("   -> %s %s: %s", step.kind, step.field, class))
+      elseif step.kind == "array_element" then
+         table.insert(lines, string.format("   -> [%d]: %s", step.index, class))
+      else
+         table.insert(lines, string.format("   -> %s: %s", step.kind, class))
+      end
+   end
+   if path.truncated then
+      table.insert(lines, string.format("(graph incomplete: %s, the chain may not be the shortest)", path.truncated))
+   end
+   return table.concat(lines, "\n")
+end
+
+return Heap
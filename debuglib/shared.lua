@@ -0,0 +1,23 @@
+-- State shared between the debugger and the worker states that run
+-- breakpoint actions (see lua_java/lj_worker.c). Values are kept in
+-- the native store (lua_java/lj_store.c) which is safe to use from
+-- any thread. Only nil, booleans, numbers and strings can be stored.
+
+-- ============================================================
+-- Create a table whose keys are kept in the store under `prefix'
+local function store_proxy(prefix)
+   return setmetatable({}, {
+      __index = function(t, k)
+         return lj_store_get(prefix .. k)
+      end,
+      __newindex = function(t, k, v)
+         lj_store_set(prefix .. k, v)
+      end
+   })
+end
+
+-- debugger options, set by setopts()
+options = store_proxy("options.")
+
+-- free-form values for breakpoint actions
+shared = store_proxy("shared.")
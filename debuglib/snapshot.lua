@@ -0,0 +1,66 @@
+-- Object snapshots
+--
+-- Formats the tables returned by lj_snapshot_object() which holds all
+-- instance fields of an object, read in one call:
+--    {class=, hash=, object_raw=, fields={{name=, value=}, ...}}
+-- Arrays have `length' and `elements' instead of `fields'. Referenced
+-- objects are nested snapshots, strings are Lua strings.
+local Snapshot = { classname = "Snapshot" }
+
+-- ============================================================
+local function is_snapshot(v)
+   return type(v) == "table" and v.object_raw ~= nil
+end
+
+-- ============================================================
+-- A one line description of a snapshot
+function Snapshot.header(snap)
+   local s = string.format("%s@%x", snap.class or "?", snap.hash or 0)
+   if snap.length then
+      s = s .. string.format(" (length %d)", snap.length)
+   end
+   return s
+end
+
+-- ============================================================
+local function format_value(v, prefix)
+   if is_snapshot(v) then
+      if v.fields or v.elements then
+         return Snapshot.format(v, prefix)
+      end
+      return Snapshot.header(v)
+   elseif type(v) == "string" then
+      return string.format("%q", v)
+   end
+   return tostring(v)
+end
+
+-- ============================================================
+--- Format a snapshot, nested snapshots are indented with `prefix'
+function Snapshot.format(snap, prefix)
+   prefix = prefix or ""
+   local inner = prefix .. "  "
+   local lines = { Snapshot.header(snap) .. " {" }
+   if snap.fields then
+      for idx, field in ipairs(snap.fields) do
+         table.insert(lines, string.format("%s%s = %s", inner, field.name,
+                                           format_value(field.value, inner)))
+      end
+      if snap.more_fields then
+         table.insert(lines, string.format("%s... %d more fields", inner, snap.more_fields))
+      end
+   elseif snap.elements then
+      for i = 1, snap.elements.n do
+         table.insert(lines, string.format("%s[%d] = %s", inner, i - 1,
+                                           format_value(snap.elements[i], inner)))
+      end
+      if snap.length > snap.elements.n then
+         table.insert(lines, string.format("%s... %d more elements", inner,
+                                           snap.length - snap.elements.n))
+      end
+   end
+   table.insert(lines, prefix .. "}")
+   return table.concat(lines, "\n")
+end
+
+return Snapshot
@@ -30,6 +30,60 @@ function jarray:__index(key)
    return rawget(self, key) or rawget(jarray, key) or jobject.__index(self, key)
 end
 
+-- ============================================================
+--- Read `count' elements starting at `from' with one call
+-- @return A table of the elements, with the count in `n'
+function jarray:region(from, count)
+   local elements = lj_get_array_region(self.object_raw, from, count)
+   if self.component_type:sub(-1) == ";" or self.component_type:sub(1, 1) == "[" then
+	  for idx = 1, elements.n do
+		 if elements[idx] then
+			elements[idx] = create_jobject(elements[idx])
+		 end
+	  end
+   end
+   return elements
+end
+
+-- ============================================================
+--- Copy `count' elements of a primitive array starting at `from'
+-- @return A view that can be indexed and sliced without reading the array
+function jarray:view(from, count)
+   return lj_new_array_view(self.object_raw, from, count)
+end
+
+-- ============================================================
+--- Find elements of a numeric array between `lo' and `hi' (default `lo')
+-- @return The indexes of the first `max' matches and the number of matches
+function jarray:find(lo, hi, max)
+   return lj_array_find(self.object_raw, lo, hi, max)
+end
+
+-- ============================================================
+--- Count the elements of a numeric array between `lo' and `hi'
+function jarray:count(lo, hi)
+   return lj_array_count(self.object_raw, lo, hi)
+end
+
+-- ============================================================
+--- Count, min, max and sum of a numeric array
+function jarray:stats()
+   return lj_array_stats(self.object_raw)
+end
+
+-- ============================================================
+--- Count the elements in `buckets' ranges between `lo' and `hi'
+function jarray:histogram(lo, hi, buckets)
+   return lj_array_histogram(self.object_raw, lo, hi, buckets)
+end
+
+-- ============================================================
+--- Find occurrences of the string `pattern' in a byte array
+-- @return The indexes of the first `max' matches and the number of matches
+function jarray:find_bytes(pattern, max)
+   return lj_array_find_bytes(self.object_raw, pattern, max)
+end
+
 -- ============================================================
 function jarray:__newindex(key, value)
    if type(key) == "number" then
@@ -10,6 +10,10 @@
 typedef struct {
   jfieldID field_id;
   jclass class;
+  /* filled once by lj_resolve_field_id(), `type' is 0 until then */
+  char type;                    /* signature type, 'L' for objects and arrays */
+  char is_static;
+  jint modifiers;
 } lj_field_id;
 
 void new_jmonitor(lua_State *L, jrawMonitorID monitor, const char *name);
@@ -27,6 +27,7 @@ jobject = require("java_bridge/jobject")
 jarray = require("java_bridge/jarray")
 jclass = require("java_bridge/jclass")
 jthread = require("java_bridge/jthread")
+jinstance_cursor = require("java_bridge/jinstance_cursor")
 
 jcallable_method = require("java_bridge/jcallable_method")
 
@@ -37,13 +38,8 @@ function create_jobject(object_raw)
 	  return nil
    end
 
-   -- get the class name
-   local getClassMethod_raw = lj_get_method_id(lj_find_class("java/lang/Object"),
-											   "getClass", "", "Ljava/lang/Class;")
-   local class_raw = lj_call_method(object_raw, getClassMethod_raw, false, "L", 0)
-   local getNameMethod_raw = lj_get_method_id(lj_find_class("java/lang/Class"),
-											  "getName", "", "Ljava/lang/String;")
-   local class_name = lj_call_method(class_raw, getNameMethod_raw, false, "STR", 0)
+   -- get the class and it's name
+   local class_raw, class_name = lj_get_object_class(object_raw)
 
    -- discriminate based on name
    if class_name == "java.lang.Class" then
@@ -54,17 +50,13 @@ function create_jobject(object_raw)
 	  return jarray.create(object_raw)
    end
 
-   -- see if java.lang.Thread is "assignable from" the class
-   local isAssignableFromMethod_raw = lj_get_method_id(lj_find_class("java/lang/Class"),
-													   "isAssignableFrom", "Ljava/lang/Class;", "Z")
-   if lj_call_method(lj_find_class("java/lang/Thread"),
-					 isAssignableFromMethod_raw, false, "Z", 1, "Ljava/lang/Class;",
-					 class_raw) then
+   -- subclasses of java.lang.Thread
+   if lj_is_instance_of(object_raw, lj_known.Thread) then
 	  return jthread.create(object_raw)
    end
 
    -- fallback to jobject
-   return jobject.create(object_raw)
+   return jobject.create(object_raw, jclass.create(class_raw, class_name))
 end
 
 -- ============================================================
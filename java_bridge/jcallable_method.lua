@@ -36,86 +36,150 @@ function jcallable_method.create(object, possible_methods)
    return self
 end
 
+-- ============================================================
+-- parsed argument types of each method
+local arg_types_cache = setmetatable({}, {__mode = "k"})
+local function get_arg_types(m)
+   local arg_types = arg_types_cache[m]
+   if not arg_types then
+      arg_types = parse_arg_spec(m.args)
+      arg_types_cache[m] = arg_types
+   end
+   return arg_types
+end
+
+-- ============================================================
+-- a key for the types of the arguments of a call, objects are
+-- distinguished by class
+local function call_shape(args, argc)
+   local shape = {}
+   for i = 1, argc do
+      local argi = args[i]
+      local t = type(argi)
+      if argi == JavaNull then
+         shape[i] = "0"
+      elseif t == "table" and argi.object_raw and argi.class then
+         shape[i] = "o" .. argi.class.intern_id
+      else
+         shape[i] = t
+      end
+   end
+   return table.concat(shape, ",")
+end
+
+-- ============================================================
+-- how to pass `argi' for a parameter of type `t', nil if it can't be
+-- passed
+local function match_arg(t, argi)
+   if argi == JavaNull then
+      return "NULL"
+   elseif (t == "Z") and type(argi) == "boolean" then
+      return "Z"
+   elseif (t == "I" or t == "J") and type(argi) == "number" then
+      return t
+   elseif (t == "F" or t == "D") and type(argi) == "number" then
+      return t
+   elseif string.sub(t, 1, 1) == "[" and type(argi) == "table" and argi.object_raw and argi.class.name == t then
+      return "["
+   elseif t == "Ljava/lang/String;" and type(argi) ~= "userdata" and type(argi) ~= "table" then
+      return "STR"
+   elseif (string.sub(t, 1, 1) == "L" or string.sub(t, 1, 2) == "[L") and
+      type(argi) == "table" and
+      argi.object_raw then
+      local name = t
+      -- from L; for non-arrays
+      if string.sub(t, 1, 1) == "L" then
+         name = string.sub(t, 2, #t - 1)
+      end
+      local tc = jclass.find(name)
+      assert(tc)
+      if tc:isAssignableFrom(argi.class) then
+         return "L"
+      end
+   end
+   return nil
+end
+
+-- ============================================================
+-- find the method to call with `args' and how to pass them
+local function resolve(possible_methods, args, argc)
+   for i, m in ipairs(possible_methods) do
+      local atypes = get_arg_types(m)
+      -- only try to match methods with the same number of arguments
+      if #atypes == argc then
+         local kinds = {}
+         for j, t in ipairs(atypes) do
+            local kind = match_arg(t, args[j])
+            if not kind then
+               break
+            end
+            kinds[j] = kind
+         end
+         -- call only if all args matched
+         if #kinds == argc then
+            return { method = m, kinds = kinds }
+         end
+      end
+   end
+   return nil
+end
+
+-- ============================================================
+-- resolved calls for each set of possible methods, by call shape.
+-- The sets are shared by all objects of a class (see
+-- jclass:load_members) so calls from a loop resolve only once
+local call_cache = setmetatable({}, {__mode = "k"})
+
 -- ============================================================
 -- perform the actual method call. this will match the `args'
 -- to one of the `possible_methods'
 function jcallable_method:__call(...)
    local args = {...}
-   local argc = #args
-   -- filter out non-matching methods
-   local possible2 = {}
+   local argc = select("#", ...)
    local object = self.object
-   --.... this loop only exists because there is no "continue" in lua
-   for i,m in ipairs(self.possible_methods) do
-      -- short circuit match for no args
-      if #args == 0 and m.args == "" then
-		 if m.modifiers.static and object.class.name ~= "java.lang.Class" then
-			object = object.class
-		 end
-		 return m(object.object_raw, 0)
-      end
 
-      -- only try to match methods with the same number of arguments
-      if #parse_arg_spec(m.args) == argc then
-		 table.insert(possible2, m)
+   local plans = call_cache[self.possible_methods]
+   if not plans then
+      plans = {}
+      call_cache[self.possible_methods] = plans
+   end
+   local shape = call_shape(args, argc)
+   local plan = plans[shape]
+   if not plan then
+      plan = resolve(self.possible_methods, args, argc)
+      if not plan then
+         error("No matching method for given arguments: " .. dump(self.possible_methods))
       end
+      plans[shape] = plan
    end
 
-   -- try to match types with args
+   -- marshal the args according to the plan
    local jargs = {}
-   for i, m in ipairs(possible2) do
-      local atypes = parse_arg_spec(m.args)
-      for i, t in ipairs(atypes) do
-		 local argi = args[i]
-		 if argi == JavaNull then
-			table.insert(jargs, "V")
-			table.insert(jargs, "NULL") -- value is unused
-			-- TODO redo this SOON
-		 --elseif type(argi) == "number" then
-			-- handle numeric arguments
-		 elseif (t == "Z") and type(argi) == "boolean" then
-			table.insert(jargs, t)
-			table.insert(jargs, argi)
-		 elseif (t == "I" or t == "J") and type(argi) == "number" then
-			table.insert(jargs, t)
-			table.insert(jargs, math.floor(argi))
-		 elseif (t == "F" or t == "D") and type(argi) == "number" then
-			table.insert(jargs, t)
-			table.insert(jargs, argi)
-		 elseif string.sub(t, 1, 1) == "[" and type(argi) == "table" and argi.object_raw and argi.class.name == t then
-			table.insert(jargs, "[")
-			table.insert(jargs, argi.object_raw)
-		 elseif t == "Ljava/lang/String;" and type(argi) ~= "userdata" and type(argi) ~= "table" then
-			table.insert(jargs, "STR")
-			table.insert(jargs, string.format("%s", argi))
-		 elseif (string.sub(t, 1, 1) == "L" or string.sub(t, 1, 2) == "[L") and
-		        type(argi) == "table" and
-			    argi.object_raw then
-		        --string.find(string.format("%s", argi), "jobject@") == 1 then
-			local name = t
-			-- from L; for non-arrays
-			if string.sub(t, 1, 1) == "L" then
-			   name = string.sub(t, 2, #t - 1)
-			end
-			local tc = jclass.find(name)
-			assert(tc)
-			if tc:isAssignableFrom(argi.class) then
-			   table.insert(jargs, "L")
-			   table.insert(jargs, argi.object_raw)
-			end
-		 end
-
-		 -- call only if all args matched
-		 if #jargs == (argc * 2) then
-			if m.modifiers.static and object.class.name ~= "java.lang.Class" then
-			   object = object.class
-			end
-			return m(object.object_raw, argc, table.unpack(jargs))
-		 end
+   for i, kind in ipairs(plan.kinds) do
+      local argi = args[i]
+      if kind == "NULL" then
+         jargs[i * 2 - 1] = "V"
+         jargs[i * 2] = "NULL" -- value is unused
+      elseif kind == "I" or kind == "J" then
+         jargs[i * 2 - 1] = kind
+         jargs[i * 2] = math.floor(argi)
+      elseif kind == "STR" then
+         jargs[i * 2 - 1] = kind
+         jargs[i * 2] = string.format("%s", argi)
+      elseif kind == "L" or kind == "[" then
+         jargs[i * 2 - 1] = kind
+         jargs[i * 2] = argi.object_raw
+      else
+         jargs[i * 2 - 1] = kind
+         jargs[i * 2] = argi
       end
-      --print("more than one possible method, using: " .. method_id.name .. " from " .. lj_toString(method_id.class))
    end
-   error("No matching method for given arguments: " .. dump(self.possible_methods))
+
+   local m = plan.method
+   if m.modifiers.static and object.class.name ~= "java.lang.Class" then
+      object = object.class
+   end
+   return m(object.object_raw, argc, table.unpack(jargs, 1, argc * 2))
 end
 
 return jcallable_method
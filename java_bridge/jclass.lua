@@ -1,26 +1,61 @@
 local jclass = { classname = "jclass" }
 
+-- jclass instances by name. The same name can be loaded by different
+-- class loaders so each name has a (weak) table of classes, keyed by
+-- the object_raw of the class
+jclass.interned = {}
+-- each interned class gets a number, used as a short key for the class
+jclass.next_intern_id = 1
+
 -- ============================================================
--- create a new jclass.
-function jclass.create(object_raw)
+-- create a new jclass. `class_name' is optional
+function jclass.create(object_raw, class_name)
    assert(object_raw)
    -- name is a transient and cached property in java.lang.Class, don't access it directly
    -- c.f. Class.java source
-   local getNameMethod_raw = lj_get_method_id(lj_find_class("java/lang/Class"),
-											  "getName", "", "Ljava/lang/String;")
-   local class_name = lj_call_method(object_raw, getNameMethod_raw, false, "STR", 0)
+   class_name = class_name or lj_call_method(object_raw, lj_known.Class_getName, false, "STR", 0)
 
    -- return static java.lang.Class instance
    if class_name == "java.lang.Class" then
 	  return jclass.java_lang_Class_instance
    end
 
+   -- return the interned instance
+   local classes = jclass.interned[class_name]
+   if not classes then
+	  classes = setmetatable({}, {__mode = "kv"})
+	  jclass.interned[class_name] = classes
+   end
+   for class_raw, class in pairs(classes) do
+	  if lj_is_same_object(class_raw, object_raw) then
+		 return class
+	  end
+   end
+
    -- TODO document use of global ref here
-   local self = jobject.create(object_raw):global_ref() -- call superclass ctor
+   local self = jobject.create(object_raw, jclass.java_lang_Class_instance):global_ref() -- call superclass ctor
    jclass.init_internal(self, class_name)
+   self.intern_id = jclass.next_intern_id
+   jclass.next_intern_id = jclass.next_intern_id + 1
+   classes[self.object_raw] = self
    return self
 end
 
+-- ============================================================
+-- members are loaded the first time one of these is accessed
+local lazy_members = {
+   sourcefile = function (self)
+	  if self.name ~= "java.lang.Class" then
+		 self.sourcefile = lj_get_source_filename(self.object_raw)
+	  end
+   end,
+   fields = function (self) self:load_fields() end,
+   fields_array = function (self) self:load_fields() end,
+   methods = function (self) self:load_methods() end,
+   methods_array = function (self) self:load_methods() end,
+   members = function (self) self:load_members() end
+}
+
 -- ============================================================
 function jclass:__index(key)
    if rawget(jclass, key) then
@@ -29,6 +64,10 @@ function jclass:__index(key)
    if rawget(self, key) then
 	  return rawget(self, key)
    end
+   if lazy_members[key] then
+	  lazy_members[key](self)
+	  return rawget(self, key)
+   end
 
    local field_id = self:find_field(key)
    if field_id then
@@ -90,30 +129,36 @@ end
 function jclass:init_internal(class_name)
    self.name = class_name
    self.internal_name = self.name:gsub("%.", "/")
-   if class_name ~= "java.lang.Class" then
-	  self.sourcefile = lj_get_source_filename(self.object_raw)
-   end
+   setmetatable(self, jclass)
+   return self
+end
 
-   self.fields = {}
-   self.fields_array = {}
+-- ============================================================
+function jclass:load_fields()
+   local fields = {}
+   local fields_array = {}
    for idx, field_raw in pairs(lj_get_class_fields(self.object_raw)) do
 	  local field = jfield_id.create(field_raw, self)
-	  self.fields[field.name] = field
-	  table.insert(self.fields_array, field)
+	  fields[field.name] = field
+	  table.insert(fields_array, field)
    end
-   table.sort(self.fields_array)
+   table.sort(fields_array)
+   self.fields = fields
+   self.fields_array = fields_array
+end
 
-   self.methods = {}
-   self.methods_array = {}
+-- ============================================================
+function jclass:load_methods()
+   local methods = {}
+   local methods_array = {}
    for idx, method_raw in pairs(lj_get_class_methods(self.object_raw)) do
 	  local method = jmethod_id.create(method_raw, self)
-	  self.methods[method.name .. method.sig] = method
-	  table.insert(self.methods_array, method)
+	  methods[method.name .. method.sig] = method
+	  table.insert(methods_array, method)
    end
-   table.sort(self.methods_array)
-
-   setmetatable(self, jclass)
-   return self
+   table.sort(methods_array)
+   self.methods = methods
+   self.methods_array = methods_array
 end
 
 -- ============================================================
@@ -136,57 +181,95 @@ end
 
 -- ============================================================
 function jclass:isAssignableFrom(class)
-   local isAssignableFromMethod_raw = lj_get_method_id(lj_find_class("java/lang/Class"), "isAssignableFrom", "Ljava/lang/Class;", "Z")
-   return lj_call_method(self.object_raw, isAssignableFromMethod_raw, false, "Z", 1, "Ljava/lang/Class;", class.object_raw)
+   return lj_call_method(self.object_raw, lj_known.Class_isAssignableFrom, false, "Z", 1, "Ljava/lang/Class;", class.object_raw)
 end
 
 -- ============================================================
--- search up the class hierarchy for methods called `search_name'
-function jclass:find_methods(search_name)
+-- Build the index of all members of the class, including inherited
+-- members. `members.fields' maps a name to the first field found up the
+-- class hierarchy and `members.methods' maps a name to all methods of
+-- that name (constructors are under "new"). The index of a class is
+-- built from the index of the superclass and interfaces so each class
+-- is only enumerated once.
+function jclass:load_members()
+   local fields = {}
    local methods = {}
-   local function add_methods (method_list)
-      for idx, method_id_raw in pairs(method_list) do
-		 -- match literal method names or "new" for constructors
-		 local name = lj_get_method_name(method_id_raw).name
-		 if name == search_name or (name == "<init>" and search_name == "new") then
-			table.insert(methods, jmethod_id.create(method_id_raw, self))
-            --print(dump(methods))
+   local seen = {}
+
+   local function add_method(name, method)
+	  local key = method.name .. method.sig
+	  if seen[key] then
+		 return
+	  end
+	  seen[key] = true
+	  methods[name] = methods[name] or {}
+	  table.insert(methods[name], method)
+   end
+
+   local function merge(class)
+	  local members = class.members
+	  for name, field in pairs(members.fields) do
+		 fields[name] = fields[name] or field
+	  end
+	  for name, list in pairs(members.methods) do
+		 -- constructors aren't inherited
+		 if name ~= "new" then
+			for idx, method in ipairs(list) do
+			   add_method(name, method)
+			end
 		 end
-      end
+	  end
+   end
+
+   for idx, field in ipairs(self.fields_array) do
+	  fields[field.name] = field
+   end
+   for idx, method in ipairs(self.methods_array) do
+	  add_method(method.name == "<init>" and "new" or method.name, method)
    end
-   local superclass_method_id_raw = lj_get_method_id(lj_find_class("java/lang/Class"),
-													 "getSuperclass", "", "Ljava/lang/Class;")
-   local interfaces_method_id_raw = lj_get_method_id(lj_find_class("java/lang/Class"),
-                                                     "getInterfaces", "", "[Ljava/lang/Class;")
-   local class = self.object_raw
-   while class do
-      add_methods(lj_get_class_methods(class))
-       -- all all interface methods as this is necessary to get default method implementations
-      local interfaces_raw = lj_call_method(class, interfaces_method_id_raw, false, "[", 0)
-      for i = 1, lj_get_array_length(interfaces_raw) do
-         local interface_raw = lj_get_array_element(interfaces_raw, "[Ljava/lang/Class;", i)
-         add_methods(lj_get_class_methods(interface_raw))
-      end
-      class = lj_call_method(class, superclass_method_id_raw, false, "L", 0)
+
+   local superclass_raw = lj_call_method(self.object_raw, lj_known.Class_getSuperclass, false, "L", 0)
+   if superclass_raw then
+	  merge(jclass.create(superclass_raw))
+   end
+   -- all interface methods as this is necessary to get default method implementations
+   local interfaces_raw = lj_call_method(self.object_raw, lj_known.Class_getInterfaces, false, "[", 0)
+   for i = 1, lj_get_array_length(interfaces_raw) do
+	  merge(jclass.create(lj_get_array_element(interfaces_raw, "[Ljava/lang/Class;", i)))
    end
-   return methods
+
+   self.members = { fields = fields, methods = methods }
+end
+
+-- ============================================================
+-- find methods called `search_name' in the class hierarchy. The
+-- returned array is shared and must not be modified
+local no_methods = {}
+function jclass:find_methods(search_name)
+   return self.members.methods[search_name] or no_methods
 end
 
 -- ============================================================
--- search up the class hierarchy for the first field called `search_name'
+-- find the first field called `search_name' in the class hierarchy
 function jclass:find_field(search_name)
-   local superclass_method_id_raw = lj_get_method_id(lj_find_class("java/lang/Class"),
-													 "getSuperclass", "", "Ljava/lang/Class;")
-   local class = self.object_raw
-   while class do
-      for idx, field_id_raw in pairs(lj_get_class_fields(class)) do
-		 if lj_get_field_name(field_id_raw).name == search_name then
-			return jfield_id.create(field_id_raw, self)
-		 end
-      end
-      class = lj_call_method(class, superclass_method_id_raw, false, "L", 0)
+   return self.members.fields[search_name]
+end
+
+-- ============================================================
+-- Wrap an instance of this class, without looking up its class
+function jclass:wrap_instance(object_raw)
+   -- classes, arrays and threads have their own wrappers
+   local special = rawget(self, "special_instances")
+   if special == nil then
+	  special = self.name == "java.lang.Class" or
+		 self.name:sub(1, 1) == "[" or
+		 lj_is_instance_of(object_raw, lj_known.Thread)
+	  rawset(self, "special_instances", special)
+   end
+   if special then
+	  return create_jobject(object_raw)
    end
-   return nil
+   return jobject.create(object_raw, self)
 end
 
 -- ============================================================
@@ -195,15 +278,28 @@ function jclass:find_instances()
    local instances = lj_get_class_instances(self.object_raw)
    -- transform the raw instances to jobject instances
    for i = 1, #instances do
-	  instances[i] = jobject.create(instances[i])
+	  instances[i] = self:wrap_instance(instances[i])
    end
    return instances
 end
 
+-- ============================================================
+-- Count the instances of the current class
+function jclass:count_instances()
+   return lj_count_instances(self.object_raw)
+end
+
+-- ============================================================
+-- Open a cursor over the instances of the current class, see jinstance_cursor
+function jclass:instances(page_size)
+   return jinstance_cursor.open(self, page_size)
+end
+
 -- bootstrap the lowest-level class
 jclass.java_lang_Class_instance = {}
-jclass.java_lang_Class_instance.object_raw = lj_new_global_ref(lj_find_class("java/lang/Class"))
+jclass.java_lang_Class_instance.object_raw = lj_new_global_ref(lj_known.Class)
 jclass.java_lang_Class_instance.class = jclass.java_lang_Class_instance
+jclass.java_lang_Class_instance.intern_id = 0
 setmetatable(jclass.java_lang_Class_instance, jclass)
 jclass.java_lang_Class_instance:init_internal("java.lang.Class")
 
@@ -8,10 +8,10 @@ function jfield_id.create(field_id_raw, class)
    local self = {}
    self.field_id_raw = field_id_raw
    self.class = class
-   local ljfn = lj_get_field_name(self.field_id_raw)
-   self.name = ljfn.name
-   self.sig = ljfn.sig
-   self.modifiers = lj_get_field_modifiers_table(lj_get_field_modifiers(self.field_id_raw))
+   local info = lj_get_field_info(self.field_id_raw)
+   self.name = info.name
+   self.sig = info.sig
+   self.modifiers = info.modifiers
    setmetatable(self, jfield_id)
    return self
 end
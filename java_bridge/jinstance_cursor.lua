@@ -0,0 +1,80 @@
+-- Cursor over the instances of a class. Instances are fetched a page
+-- at a time and wrapped when they are accessed. close() releases the
+-- tags numbering the instances, objects taken from the cursor remain
+-- valid.
+local jinstance_cursor = { classname = "jinstance_cursor" }
+
+-- default number of instances fetched at a time
+jinstance_cursor.page_size = 100
+
+-- ============================================================
+function jinstance_cursor.open(class, page_size)
+   assert(class)
+   local self = {
+	  class = class,
+	  cursor_raw = lj_open_instance_cursor(class.object_raw),
+	  page_size = page_size or jinstance_cursor.page_size,
+	  pages = {},
+	  objects = {}
+   }
+   self.count = #self.cursor_raw
+   setmetatable(self, jinstance_cursor)
+   return self
+end
+
+-- ============================================================
+function jinstance_cursor:__len()
+   return self.count
+end
+
+-- ============================================================
+function jinstance_cursor:__index(key)
+   if type(key) == "number" then
+	  local object = self.objects[key]
+	  if object == nil and key >= 1 and key <= self.count then
+		 local page_num = math.floor((key - 1) / self.page_size)
+		 local page = self.pages[page_num]
+		 if not page then
+			page = self.cursor_raw:fetch(page_num * self.page_size + 1, self.page_size)
+			self.pages[page_num] = page
+		 end
+		 local object_raw = page[key - page_num * self.page_size]
+		 if object_raw then
+			object = self.class:wrap_instance(object_raw)
+			self.objects[key] = object
+		 end
+	  end
+	  return object
+   end
+   return rawget(jinstance_cursor, key)
+end
+
+-- ============================================================
+--- Iterate over all instances, collected instances are skipped
+function jinstance_cursor:iterate()
+   local i = 0
+   return function()
+	  while i < self.count do
+		 i = i + 1
+		 local object = self[i]
+		 if object then
+			return i, object
+		 end
+	  end
+   end
+end
+
+-- ============================================================
+function jinstance_cursor:close()
+   self.cursor_raw:close()
+   self.pages = {}
+   self.objects = {}
+   self.count = 0
+end
+
+-- ============================================================
+function jinstance_cursor:__tostring()
+   return string.format("jinstance_cursor: %d instances of %s", self.count, self.class.name)
+end
+
+return jinstance_cursor
@@ -9,21 +9,15 @@ function jmethod_id.create(method_id_raw, class)
    local self = {}
    self.method_id_raw = method_id_raw
    self.class = class
-   local ljmn = lj_get_method_name(self.method_id_raw)
-   self.name = ljmn.name
-   self.sig = ljmn.sig
-
-   -- parse sig for args and ret
-   local sig = self.sig
-   sig = string.sub(sig, 2) -- remove (
-   self.args = string.match(sig, "^.*%)")
-   self.args = string.sub(self.args, 1, string.len(self.args) - 1)
-   self.ret = string.match(sig, "%).*$")
-   self.ret = string.sub(self.ret, 2)
-
-   self.line_number_table = lj_get_line_number_table(self.method_id_raw)
-   self.local_variable_table = lj_get_local_variable_table(self.method_id_raw)
-   self.modifiers = lj_get_method_modifiers_table(lj_get_method_modifiers(self.method_id_raw))
+   -- metadata is cached, these tables are shared with other instances
+   local info = lj_get_method_info(self.method_id_raw)
+   self.name = info.name
+   self.sig = info.sig
+   self.args = info.args
+   self.ret = info.ret
+   self.line_number_table = info.line_number_table
+   self.local_variable_table = info.local_variable_table
+   self.modifiers = info.modifiers
 
    setmetatable(self, jmethod_id)
    return self
@@ -1,13 +1,12 @@
 local jobject = { classname = "jobject" }
 
 -- ============================================================
-function jobject.create(object_raw)
+-- `class' is optional, it's looked up when not given
+function jobject.create(object_raw, class)
    assert(object_raw)
    local self = {}
    self.object_raw = object_raw
-   local getClassMethod_raw = lj_get_method_id(lj_find_class("java/lang/Object"),
-											   "getClass", "", "Ljava/lang/Class;")
-   self.class = jclass.create(lj_call_method(self.object_raw, getClassMethod_raw, false, "L", 0))
+   self.class = class or jclass.create(lj_get_object_class(self.object_raw))
    setmetatable(self, jobject)
    return self
 end
@@ -83,6 +82,11 @@ function jobject.__eq(o1, o2)
       return false
    end
 
+   -- references to the same object
+   if lj_is_same_object(o1.object_raw, o2.object_raw) then
+      return true
+   end
+
    local o1c, o2c = o1.class.name, o2.class.name
    if o1c ~= o2c then return false end
 
@@ -91,14 +95,20 @@ function jobject.__eq(o1, o2)
       return lj_toString(o1.object_raw) == lj_toString(o2.object_raw)
    end
 
-   -- TODO reference comparison? possible? useful? equals?
    return false
 end
 
+-- ============================================================
+-- Stable ID of the object, the same for every reference to it. Usable
+-- as a table key or hash
+function jobject:object_id()
+   return lj_object_id(self.object_raw)
+end
+
 -- ============================================================
 -- ALWAYS RETURNS A JOBJECT INSTANCE, has to be overridden for other classes
 function jobject:global_ref()
-   return jobject.create(lj_new_global_ref(self.object_raw))
+   return jobject.create(lj_new_global_ref(self.object_raw), self.class)
 end
 
 -- ============================================================
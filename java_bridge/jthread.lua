@@ -14,6 +14,7 @@ function jthread.create(object_raw)
    setmetatable(self, jthread)
    self.event_queue = EventQueue.new(self.name)
    self.frames = jthread.frames.new(self)
+   self.in_event = false
    return self
 end
 
@@ -37,6 +38,20 @@ function jthread:__tostring()
 						lj_toString(self.object_raw))
 end
 
+-- ============================================================
+--- Mark the thread as stopped in an event. The frames are cached until
+-- leave_event() is called
+function jthread:enter_event()
+   self.in_event = true
+   self.frames:invalidate()
+end
+
+-- ============================================================
+function jthread:leave_event()
+   self.in_event = false
+   self.frames:invalidate()
+end
+
 -- ============================================================
 function jthread:handle_events()
    while true do
@@ -46,6 +61,7 @@ function jthread:handle_events()
 	  elseif event.type == Event.TYPE_COMMAND then
 		 -- TODO copied from start_cmd()
 		 local success, m2 = pcall(event.data.chunk)
+		 lj_reset_arena()
 		 if not success then
 			dbgio:print("Error: " .. m2)
 		 elseif m2 then
@@ -70,14 +86,51 @@ function jthread.frames.new(thread)
    return self
 end
 
+-- ============================================================
+--- Fetch the whole stack with one call. The frames are reused while the
+-- thread is stopped in an event
+-- @return An array of raw frames, replaced by Frame objects when accessed
+function jthread.frames:load()
+   local frames = rawget(self, "cache")
+   if not frames then
+	  frames = lj_get_stack_trace(self.thread.object_raw)
+	  if self.thread.in_event then
+		 rawset(self, "cache", frames)
+	  end
+   end
+   return frames
+end
+
+-- ============================================================
+function jthread.frames:invalidate()
+   rawset(self, "cache", nil)
+end
+
+-- ============================================================
+-- Get frame `depth' from an array returned by load()
+local function frame_at(self, frames, depth)
+   local frame = frames[depth]
+   if frame and getmetatable(frame) ~= Frame then
+	  frame = Frame.create(frame, self.thread)
+	  frames[depth] = frame
+   end
+   return frame
+end
+
 -- ============================================================
 function jthread.frames:__len()
+   if self.thread.in_event then
+	  return #self:load()
+   end
    return lj_get_frame_count(self.thread.object_raw)
 end
 
 -- ============================================================
 function jthread.frames:__index(key)
    if type(key) == "number" then
+	  if self.thread.in_event then
+		 return frame_at(self, self:load(), key)
+	  end
 	  local frame_raw = lj_get_stack_frame(self.thread.object_raw, key)
 	  if not frame_raw then
 		 return nil
@@ -91,9 +144,10 @@ end
 -- ============================================================
 function jthread.frames:__tostring()
    local disp = ""
+   local frames = self:load()
    -- TODO limit frame count to prevent printing unreasonably large stacks
-   for i = 1, #self do
-	  local f = self[i]
+   for i = 1, #frames do
+	  local f = frame_at(self, frames, i)
       if depth == f.depth then
          disp = disp .. "*"
       end
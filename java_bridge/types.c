@@ -21,6 +21,9 @@ void new_jfield_id(lua_State *L, jfieldID field_id, jclass class)
   user_data = lua_newuserdata(L, sizeof(lj_field_id));
   user_data->field_id = field_id;
   user_data->class = class;
+  user_data->type = 0;
+  user_data->is_static = 0;
+  user_data->modifiers = 0;
   lua_getfield(L, LUA_REGISTRYINDEX, "jfield_id");
   lua_setmetatable(L, -2);
 }
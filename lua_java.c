@@ -10,6 +10,12 @@
 #include "lua_java.h"
 #include "java_bridge.h"
 #include "lj_internal.h"
+#include "lj_context.h"
+#include "lj_known.h"
+#include "lj_method_cache.h"
+
+/* arguments of lj_call_method() up to this count are kept on the stack */
+#define LJ_CALL_STACK_ARGS 8
 
  /*  _    _ _   _ _      */
  /* | |  | | | (_) |     */
@@ -19,22 +25,17 @@
  /*  \____/ \__|_|_|___/ */
 
 static jvmtiEnv *lj_jvmti; /* accessed through current_jvmti() */
-jvmtiError lj_err;  /* accessed directly externally */
+LJ_THREAD_LOCAL jvmtiError lj_err;  /* accessed directly externally */
 
 JavaVM *lj_jvm;
 
-/* TODO: is this used for anything */
-jthread lj_current_thread;
-
 /* needed to have a lua state at jvmti callback */
 lua_State *lj_L;
 
+/* cached per thread, see lj_context.c */
 JNIEnv *current_jni()
 {
-  JNIEnv *jni;
-  jint ret = (*lj_jvm)->AttachCurrentThread(lj_jvm, (void**)&jni, NULL);
-  assert(ret == JNI_OK);
-  return jni;
+  return lj_get_context()->jni;
 }
 
 jvmtiEnv *current_jvmti()
@@ -58,15 +59,20 @@ void lj_check_jvmti_error_internal(lua_State *L, const char *file, int line, con
   (void) lua_interface_error(L, "[%s:%d:%s] Error %d from JVMTI: %s", file, line, func, lj_err, errmsg);
 }
 
+/* The thread of the active event, otherwise Thread.currentThread()
+   which is looked up once per thread */
 jobject get_current_java_thread()
 {
-  JNIEnv *jni = current_jni();
+  lj_context *ctx = lj_get_context();
+  JNIEnv *jni = ctx->jni;
   jclass thread_class;
   jmethodID getCurrentThread_method_id;
   jobject current_thread;
 
-  if (lj_current_thread)
-    return lj_current_thread;
+  if (ctx->event_thread)
+    return ctx->event_thread;
+  if (ctx->thread)
+    return ctx->thread;
 
   thread_class = (*jni)->FindClass(jni, "java/lang/Thread");
   EXCEPTION_CHECK(jni);
@@ -83,7 +89,11 @@ jobject get_current_java_thread()
   EXCEPTION_CHECK(jni);
   assert(current_thread);
 
-  return current_thread;
+  ctx->thread = (*jni)->NewGlobalRef(jni, current_thread);
+  (*jni)->DeleteLocalRef(jni, current_thread);
+  (*jni)->DeleteLocalRef(jni, thread_class);
+
+  return ctx->thread;
 }
 
  /*  _                   ______                _   _                  */
@@ -93,36 +103,6 @@ jobject get_current_java_thread()
  /* | |___| |_| | (_| | | |  | |_| | | | | (__| |_| | (_) | | | \__ \ */
  /* |______\__,_|\__,_| |_|   \__,_|_| |_|\___|\__|_|\___/|_| |_|___/ */
 
-static int lj_set_breakpoint(lua_State *L)
-{
-  jmethodID method_id;
-  jlocation location;
-
-  method_id = *(jmethodID *)luaL_checkudata(L, 1, "jmethod_id");
-  location = luaL_checkinteger(L, 2);
-  lua_pop(L, 2);
-
-  lj_err = (*lj_jvmti)->SetBreakpoint(lj_jvmti, method_id, location);
-  lj_check_jvmti_error(L);
-
-  return 0;
-}
-
-static int lj_clear_breakpoint(lua_State *L)
-{
-  jmethodID method_id;
-  jlocation location;
-
-  method_id = *(jmethodID *)luaL_checkudata(L, 1, "jmethod_id");
-  location = luaL_checkinteger(L, 2);
-  lua_pop(L, 2);
-
-  lj_err = (*lj_jvmti)->ClearBreakpoint(lj_jvmti, method_id, location);
-  lj_check_jvmti_error(L);
-
-  return 0;
-}
-
 /**
  * Convenience function to see if we can return a nil
  * instead of throwing an error.
@@ -275,11 +255,20 @@ static int lj_call_method(lua_State *L)
   int is_static;
   int param_num;
   int result_count = 1;
-
-  jvalue *jargs = NULL;
+  lj_method_info *plan;
+  int is_constructor;
+  char ret_code;
+
+  /* most calls fit on the stack, others use the thread's arena */
+  jvalue stack_jargs[LJ_CALL_STACK_ARGS];
+  jvalue *jargs = stack_jargs;
+  /* type code of each parameter from the call plan, 'T' once a string
+     has been created for it so it's deleted after the call */
+  char stack_codes[LJ_CALL_STACK_ARGS + 1];
+  char *codes = stack_codes;
+  lj_arena_mark mark = lj_arena_get_mark();
 
   const char *argtype;
-  char *method_name;
 
   object = *(jobject *)luaL_checkudata(L, 1, "jobject");
   method_id = *(jmethodID *)luaL_checkudata(L, 2, "jmethod_id");
@@ -287,181 +276,225 @@ static int lj_call_method(lua_State *L)
   ret = luaL_checkstring(L, 4);
   argcount = luaL_checkinteger(L, 5);
 
-  lj_err = (*lj_jvmti)->GetMethodName(lj_jvmti, method_id, &method_name, NULL, NULL);
+  /* the call plan is compiled from the method descriptor once */
+  plan = lj_method_info_acquire(jni, method_id, &lj_err);
   lj_check_jvmti_error(L);
-
-  if (argcount > 0)
+  is_constructor = plan->is_constructor;
+  ret_code = plan->ret_code;
+  i = plan->arg_count;
+  if (argcount == i)
   {
-    jargs = malloc(sizeof(jvalue) * argcount);
-    memset(jargs, 0, sizeof(jvalue) * argcount);
+    if (argcount > LJ_CALL_STACK_ARGS)
+    {
+      jargs = lj_arena_alloc(sizeof(jvalue) * argcount);
+      codes = lj_arena_alloc(argcount + 1);
+    }
+    memcpy(codes, plan->arg_codes, argcount + 1);
   }
+  lj_method_info_release(plan);
+  if (argcount != i)
+    return lua_interface_error(L, "Method takes %d arguments, %d given\n", i, argcount);
 
   param_num = 6;
-  /* get arguments */
+  /* get arguments, the parameter type decides how the Lua value is
+     read and the type given must agree with it */
   for (i = 0; i < argcount; ++i)
   {
     argtype = luaL_checkstring(L, param_num++);
     assert(argtype);
-    if (!strcmp("V", argtype))
-    {
-      jargs[i].l = NULL;
-      param_num++; /* skip the nil */
-    }
-    else if ('L' == argtype[0] || '[' == argtype[0])
-    {
-      jargs[i].l = *(jobject *)luaL_checkudata(L, param_num++, "jobject");
-    }
-    else if (!strcmp("STR", argtype)) /* TODO non-standard indicator */
+    if (codes[i] == 'L')
     {
-      jargs[i].l = (*jni)->NewStringUTF(jni, luaL_checkstring(L, param_num++));
+      if (argtype[0] == 'V')
+      {
+        jargs[i].l = NULL;
+      }
+      else if (!strcmp(argtype, "STR")) /* TODO non-standard indicator */
+      {
+        /* created after all arguments are checked */
+        luaL_checkstring(L, param_num);
+        jargs[i].l = NULL;
+        codes[i] = 'T';
+      }
+      else if (argtype[0] == 'L' || argtype[0] == '[')
+      {
+        jargs[i].l = *(jobject *)luaL_checkudata(L, param_num, "jobject");
+      }
+      else
+      {
+        (void)lua_interface_error(L, "Argument %d is an object, '%s' given\n", i, argtype);
+      }
+      param_num++;
+      continue;
     }
-    else if (!strcmp("Z", argtype))
+
+    if (argtype[0] != codes[i] || argtype[1])
+      (void)lua_interface_error(L, "Argument %d is '%c', '%s' given\n", i, codes[i], argtype);
+    switch (codes[i])
     {
+    case 'Z':
       luaL_checktype(L, param_num, LUA_TBOOLEAN);
       jargs[i].z = lua_toboolean(L, param_num);
-      param_num++;
-    }
-    else if (!strcmp("B", argtype))
-    {
-      jargs[i].b = luaL_checkinteger(L, param_num++);
-    }
-    else if (!strcmp("C", argtype)) /* TODO should this be a one-element string? (not int) */
-    {
-      jargs[i].c = luaL_checkinteger(L, param_num++);
-    }
-    else if (!strcmp("S", argtype))
-    {
-      jargs[i].s = luaL_checkinteger(L, param_num++);
-    }
-    else if (!strcmp("I", argtype))
-    {
-      jargs[i].i = luaL_checkinteger(L, param_num++);
-    }
-    else if (!strcmp("J", argtype))
-    {
-      jargs[i].j = luaL_checkinteger(L, param_num++);
-    }
-    else if (!strcmp("F", argtype))
-    {
-      jargs[i].f = luaL_checknumber(L, param_num++);
-    }
-    else if (!strcmp("D", argtype))
-    {
-      jargs[i].d = luaL_checknumber(L, param_num++);
-    }
-    else
-    {
-      (void)lua_interface_error(L, "Unknown argument type '%s' for argument %d\n", argtype, i);
+      break;
+    case 'B':
+      jargs[i].b = luaL_checkinteger(L, param_num);
+      break;
+    case 'C': /* TODO should this be a one-element string? (not int) */
+      jargs[i].c = luaL_checkinteger(L, param_num);
+      break;
+    case 'S':
+      jargs[i].s = luaL_checkinteger(L, param_num);
+      break;
+    case 'I':
+      jargs[i].i = luaL_checkinteger(L, param_num);
+      break;
+    case 'J':
+      jargs[i].j = luaL_checkinteger(L, param_num);
+      break;
+    case 'F':
+      jargs[i].f = luaL_checknumber(L, param_num);
+      break;
+    case 'D':
+      jargs[i].d = luaL_checknumber(L, param_num);
+      break;
     }
+    param_num++;
+  }
+
+  /* nothing can fail from here on, so the strings are always deleted */
+  for (i = 0; i < argcount; ++i)
+  {
+    if (codes[i] == 'T')
+      jargs[i].l = (*jni)->NewStringUTF(jni, lua_tostring(L, 7 + 2 * i));
   }
 
   lua_pop(L, (2 * argcount) + 5);
 
   memset(&val, 0, sizeof(val));
-  /* call method - in order shown in JNI docs*/
-  if (!strcmp("V", ret))
+  /* call method - the JNI function is chosen by the method's actual
+     return type, `ret' only decides how objects are returned */
+  if (is_constructor)
+  {
+    val.l = (*jni)->NewObjectA(jni, object, method_id, jargs);
+  }
+  else switch (ret_code)
   {
+  case 'V':
     if (is_static)
       (*jni)->CallStaticVoidMethodA(jni, object, method_id, jargs);
     else
       (*jni)->CallVoidMethodA(jni, object, method_id, jargs);
-    EXCEPTION_CHECK(jni);
-    result_count = 0;
-  }
-  else if (ret[0] == 'L' || ret[0] == '[' || !strcmp("STR", ret))
-  {
-    if (!strcmp("<init>", method_name))
-      val.l = (*jni)->NewObjectA(jni, object, method_id, jargs);
-    else if (is_static)
+    break;
+  case 'L':
+    if (is_static)
       val.l = (*jni)->CallStaticObjectMethodA(jni, object, method_id, jargs);
     else
       val.l = (*jni)->CallObjectMethodA(jni, object, method_id, jargs);
-    EXCEPTION_CHECK(jni);
-    if (!strcmp("L", ret) || ret[0] == '[')
-      new_jobject(L, val.l);
-    else
-      new_string(L, jni, val.l);
-  }
-  else if (!strcmp("Z", ret))
-  {
+    break;
+  case 'Z':
     if (is_static)
       val.z = (*jni)->CallStaticBooleanMethodA(jni, object, method_id, jargs);
     else
       val.z = (*jni)->CallBooleanMethodA(jni, object, method_id, jargs);
-    EXCEPTION_CHECK(jni);
-    lua_pushboolean(L, val.z);
-  }
-  else if (!strcmp("B", ret))
-  {
+    break;
+  case 'B':
     if (is_static)
       val.b = (*jni)->CallStaticByteMethodA(jni, object, method_id, jargs);
     else
       val.b = (*jni)->CallByteMethodA(jni, object, method_id, jargs);
-    EXCEPTION_CHECK(jni);
-    lua_pushinteger(L, val.b);
-  }
-  else if (!strcmp("C", ret))
-  {
+    break;
+  case 'C':
     if (is_static)
       val.c = (*jni)->CallStaticCharMethodA(jni, object, method_id, jargs);
     else
       val.c = (*jni)->CallCharMethodA(jni, object, method_id, jargs);
-    EXCEPTION_CHECK(jni);
-    lua_pushinteger(L, val.c);
-  }
-  else if (!strcmp("S", ret))
-  {
+    break;
+  case 'S':
     if (is_static)
       val.s = (*jni)->CallStaticShortMethodA(jni, object, method_id, jargs);
     else
       val.s = (*jni)->CallShortMethodA(jni, object, method_id, jargs);
-    EXCEPTION_CHECK(jni);
-    lua_pushinteger(L, val.s);
-  }
-  else if (!strcmp("I", ret))
-  {
+    break;
+  case 'I':
     if (is_static)
       val.i = (*jni)->CallStaticIntMethodA(jni, object, method_id, jargs);
     else
       val.i = (*jni)->CallIntMethodA(jni, object, method_id, jargs);
-    EXCEPTION_CHECK(jni);
-    lua_pushinteger(L, val.i);
-  }
-  else if (!strcmp("J", ret))
-  {
+    break;
+  case 'J':
     if (is_static)
       val.j = (*jni)->CallStaticLongMethodA(jni, object, method_id, jargs);
     else
       val.j = (*jni)->CallLongMethodA(jni, object, method_id, jargs);
-    EXCEPTION_CHECK(jni);
-    lua_pushinteger(L, val.j);
-  }
-  else if (!strcmp("F", ret))
-  {
+    break;
+  case 'F':
     if (is_static)
       val.f = (*jni)->CallStaticFloatMethodA(jni, object, method_id, jargs);
     else
       val.f = (*jni)->CallFloatMethodA(jni, object, method_id, jargs);
-    EXCEPTION_CHECK(jni);
-    lua_pushnumber(L, val.f);
-  }
-  else if (!strcmp("D", ret))
-  {
+    break;
+  case 'D':
     if (is_static)
       val.d = (*jni)->CallStaticDoubleMethodA(jni, object, method_id, jargs);
     else
       val.d = (*jni)->CallDoubleMethodA(jni, object, method_id, jargs);
-    EXCEPTION_CHECK(jni);
-    lua_pushnumber(L, val.d);
+    break;
   }
-  else
+  EXCEPTION_CHECK(jni);
+
+  for (i = 0; i < argcount; ++i)
   {
-    (void)lua_interface_error(L, "Unknown return type '%s'", ret);
+    if (codes[i] == 'T')
+      (*jni)->DeleteLocalRef(jni, jargs[i].l);
   }
 
-  if (argcount > 0)
-    free(jargs);
-  free_jvmti_refs(lj_jvmti, method_name, (void *)-1);
+  if (is_constructor || ret_code == 'L')
+  {
+    if (val.l == NULL)
+    {
+      lua_pushnil(L);
+    }
+    else if (ret[0] == 'S') /* STR */
+    {
+      new_string(L, jni, val.l);
+      (*jni)->DeleteLocalRef(jni, val.l);
+    }
+    else
+    {
+      new_jobject(L, val.l);
+    }
+  }
+  else switch (ret_code)
+  {
+  case 'V':
+    result_count = 0;
+    break;
+  case 'Z':
+    lua_pushboolean(L, val.z);
+    break;
+  case 'B':
+    lua_pushinteger(L, val.b);
+    break;
+  case 'C':
+    lua_pushinteger(L, val.c);
+    break;
+  case 'S':
+    lua_pushinteger(L, val.s);
+    break;
+  case 'I':
+    lua_pushinteger(L, val.i);
+    break;
+  case 'J':
+    lua_pushinteger(L, val.j);
+    break;
+  case 'F':
+    lua_pushnumber(L, val.f);
+    break;
+  case 'D':
+    lua_pushnumber(L, val.d);
+    break;
+  }
+
+  lj_arena_release(mark);
 
   return result_count;
 }
@@ -470,29 +503,12 @@ static int lj_toString(lua_State *L)
 {
   JNIEnv *jni = current_jni();
   jobject object;
-  jclass class;
-  jmethodID method_id;
   jstring string;
 
   object = *(jobject *)luaL_checkudata(L, 1, "jobject");
   lua_pop(L, 1);
 
-  class = (*jni)->FindClass(jni, "java/lang/Object");
-  EXCEPTION_CHECK(jni);
-  if (class == NULL)
-  {
-    lua_pushnil(L);
-    return 1;
-  }
-  method_id = (*jni)->GetMethodID(jni, class, "toString", "()Ljava/lang/String;");
-  EXCEPTION_CHECK(jni);
-  if (method_id == NULL)
-  {
-    lua_pushnil(L);
-    return 1;
-  }
-
-  string = (jstring)(*jni)->CallObjectMethod(jni, object, method_id);
+  string = (jstring)(*jni)->CallObjectMethod(jni, object, lj_known.Object_toString);
   EXCEPTION_CHECK(jni);
   if (string == NULL)
   {
@@ -501,6 +517,7 @@ static int lj_toString(lua_State *L)
   }
 
   new_string(L, jni, string);
+  (*jni)->DeleteLocalRef(jni, string);
 
   return 1;
 }
@@ -511,103 +528,91 @@ static int lj_get_field(lua_State *L)
   jvalue val;
   jobject object;
   lj_field_id *field_id;
-  char *sig;
-  int is_static;
 
   object = *(jobject *)luaL_checkudata(L, 1, "jobject");
   field_id = (lj_field_id *)luaL_checkudata(L, 2, "jfield_id");
-  luaL_checktype(L, 3, LUA_TBOOLEAN);
-  is_static = lua_toboolean(L, -1);
-  lua_pop(L, 3);
+  /* the third argument (is static) is from before fields knew it */
+  lua_settop(L, 0);
 
-  lj_err = (*lj_jvmti)->GetFieldName(lj_jvmti, field_id->class, field_id->field_id,
-									 NULL, &sig, NULL);
+  lj_err = lj_resolve_field_id(field_id);
   lj_check_jvmti_error(L);
 
-  if (*sig == 'L' || *sig == '[')
+  switch (field_id->type)
   {
-    if (is_static)
+  case 'L':
+    if (field_id->is_static)
       val.l = (*jni)->GetStaticObjectField(jni, object, field_id->field_id);
     else
       val.l = (*jni)->GetObjectField(jni, object, field_id->field_id);
     EXCEPTION_CHECK(jni);
     new_jobject(L, val.l);
-  }
-  else if (!strcmp(sig, "Z"))
-  {
-    if (is_static)
+    break;
+  case 'Z':
+    if (field_id->is_static)
       val.z = (*jni)->GetStaticBooleanField(jni, object, field_id->field_id);
     else
       val.z = (*jni)->GetBooleanField(jni, object, field_id->field_id);
     EXCEPTION_CHECK(jni);
     lua_pushboolean(L, val.z);
-  }
-  else if (!strcmp(sig, "B"))
-  {
-    if (is_static)
+    break;
+  case 'B':
+    if (field_id->is_static)
       val.b = (*jni)->GetStaticByteField(jni, object, field_id->field_id);
     else
       val.b = (*jni)->GetByteField(jni, object, field_id->field_id);
     EXCEPTION_CHECK(jni);
     lua_pushinteger(L, val.b);
-  }
-  else if (!strcmp(sig, "C"))
-  {
-    if (is_static)
+    break;
+  case 'C':
+    if (field_id->is_static)
       val.c = (*jni)->GetStaticCharField(jni, object, field_id->field_id);
     else
       val.c = (*jni)->GetCharField(jni, object, field_id->field_id);
     EXCEPTION_CHECK(jni);
     lua_pushinteger(L, val.c);
-  }
-  else if (!strcmp(sig, "S"))
-  {
-    if (is_static)
+    break;
+  case 'S':
+    if (field_id->is_static)
       val.s = (*jni)->GetStaticShortField(jni, object, field_id->field_id);
     else
       val.s = (*jni)->GetShortField(jni, object, field_id->field_id);
     EXCEPTION_CHECK(jni);
     lua_pushinteger(L, val.s);
-  }
-  else if (!strcmp(sig, "I"))
-  {
-    if (is_static)
+    break;
+  case 'I':
+    if (field_id->is_static)
       val.i = (*jni)->GetStaticIntField(jni, object, field_id->field_id);
     else
       val.i = (*jni)->GetIntField(jni, object, field_id->field_id);
     EXCEPTION_CHECK(jni);
     lua_pushinteger(L, val.i);
-  }
-  else if (!strcmp(sig, "J"))
-  {
-    if (is_static)
+    break;
+  case 'J':
+    if (field_id->is_static)
       val.j = (*jni)->GetStaticLongField(jni, object, field_id->field_id);
     else
       val.j = (*jni)->GetLongField(jni, object, field_id->field_id);
     EXCEPTION_CHECK(jni);
     lua_pushinteger(L, val.j);
-  }
-  else if (!strcmp(sig, "F"))
-  {
-    if (is_static)
+    break;
+  case 'F':
+    if (field_id->is_static)
       val.f = (*jni)->GetStaticFloatField(jni, object, field_id->field_id);
     else
       val.f = (*jni)->GetFloatField(jni, object, field_id->field_id);
     EXCEPTION_CHECK(jni);
     lua_pushnumber(L, val.f);
-  }
-  else if (!strcmp(sig, "D"))
-  {
-    if (is_static)
+    break;
+  case 'D':
+    if (field_id->is_static)
       val.d = (*jni)->GetStaticDoubleField(jni, object, field_id->field_id);
     else
       val.d = (*jni)->GetDoubleField(jni, object, field_id->field_id);
     EXCEPTION_CHECK(jni);
     lua_pushnumber(L, val.d);
-  }
-  else
-  {
-    lj_print_message("Unknown return type '%s' for field\n", sig);
+    break;
+  default:
+    lj_print_message("Unknown type '%c' for field\n", field_id->type);
     lua_pushnil(L);
   }
 
@@ -819,6 +824,16 @@ static int lj_delete_global_ref(lua_State *L)
   return 0;
 }
 
+static int lj_is_same_object(lua_State *L)
+{
+  JNIEnv *jni = current_jni();
+  jobject o1 = *(jobject *)luaL_checkudata(L, 1, "jobject");
+  jobject o2 = *(jobject *)luaL_checkudata(L, 2, "jobject");
+  lua_pop(L, 2);
+  lua_pushboolean(L, (*jni)->IsSameObject(jni, o1, o2));
+  return 1;
+}
+
  /*           _____ _____  */
  /*     /\   |  __ \_   _| */
  /*    /  \  | |__) || |   */
@@ -829,33 +844,59 @@ static int lj_delete_global_ref(lua_State *L)
 /* from lua_jvmti_event.c */
 int lj_set_jvmti_callback(lua_State *L);
 int lj_clear_jvmti_callback(lua_State *L);
+int lj_get_event_thread_stats(lua_State *L);
 void lj_init_jvmti_event();
 
 /* registration for subordinate .c files */
+void lj_array_register(lua_State *L);
+void lj_array_scan_register(lua_State *L);
+void lj_breakpoint_register(lua_State *L);
 void lj_class_register(lua_State *L);
+void lj_context_register(lua_State *L);
 void lj_field_register(lua_State *L);
 void lj_force_early_return_register(lua_State *L);
+void lj_heap_register(lua_State *L);
+void lj_heap_graph_register(lua_State *L);
+void lj_instance_cursor_register(lua_State *L);
+void lj_known_register(lua_State *L);
 void lj_method_register(lua_State *L);
+void lj_method_cache_register(lua_State *L);
 void lj_raw_monitor_register(lua_State *L);
+void lj_snapshot_register(lua_State *L);
 void lj_stack_frame_register(lua_State *L);
+void lj_thread_dump_register(lua_State *L);
+void lj_store_register(lua_State *L);
+void lj_tag_register(lua_State *L);
+void lj_trace_register(lua_State *L);
 void lj_watch_register(lua_State *L);
 
-void lj_init(lua_State *L, JavaVM *jvm, jvmtiEnv *jvmti)
+/* Register the Lua functions in `L'. This is done for the debugger's
+   state and for each worker state (see lj_worker.c) */
+void lj_open(lua_State *L)
 {
-  lj_L = L;
-
   /* add C functions */
+  lj_array_register(L);
+  lj_array_scan_register(L);
+  lj_breakpoint_register(L);
   lj_class_register(L);
+  lj_context_register(L);
   lj_field_register(L);
   lj_force_early_return_register(L);
+  lj_heap_register(L);
+  lj_heap_graph_register(L);
+  lj_instance_cursor_register(L);
+  lj_known_register(L);
   lj_method_register(L);
+  lj_method_cache_register(L);
   lj_raw_monitor_register(L);
+  lj_snapshot_register(L);
   lj_stack_frame_register(L);
+  lj_thread_dump_register(L);
+  lj_store_register(L);
+  lj_tag_register(L);
+  lj_trace_register(L);
   lj_watch_register(L);
 
-  lua_register(L, "lj_set_breakpoint",             lj_set_breakpoint);
-  lua_register(L, "lj_clear_breakpoint",           lj_clear_breakpoint);
-
   lua_register(L, "lj_get_local_variable",         lj_get_local_variable);
   lua_register(L, "lj_pointer_to_string",          lj_pointer_to_string);
   lua_register(L, "lj_call_method",                lj_call_method);
@@ -872,14 +913,25 @@ void lj_init(lua_State *L, JavaVM *jvm, jvmtiEnv *jvmti)
 
   lua_register(L, "lj_new_global_ref",             lj_new_global_ref);
   lua_register(L, "lj_delete_global_ref",          lj_delete_global_ref);
+  lua_register(L, "lj_is_same_object",             lj_is_same_object);
 
-  lua_register(L, "lj_set_jvmti_callback",         lj_set_jvmti_callback);
-  lua_register(L, "lj_clear_jvmti_callback",       lj_clear_jvmti_callback);
+  lua_register(L, "lj_get_event_thread_stats",     lj_get_event_thread_stats);
+}
+
+void lj_init(lua_State *L, JavaVM *jvm, jvmtiEnv *jvmti)
+{
+  lj_L = L;
 
   /* save pointers for global use */
   lj_jvm = jvm;
   lj_jvmti = jvmti;
 
+  lj_open(L);
+
+  /* callbacks are kept in the registry of the debugger's state */
+  lua_register(L, "lj_set_jvmti_callback",         lj_set_jvmti_callback);
+  lua_register(L, "lj_clear_jvmti_callback",       lj_clear_jvmti_callback);
+
   lj_err = EV_ENABLET(BREAKPOINT, NULL);
   lj_check_jvmti_error(L);
 
@@ -11,6 +11,7 @@
 #include <assert.h>
 
 void lj_init(lua_State *L, JavaVM *jvm, jvmtiEnv *jvmti);
+void lj_open(lua_State *L);
 void lj_print_message(const char *format, ...);
 
 #endif /* LUA_JAVA_H_ */
@@ -0,0 +1,325 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "myjni.h"
+#include "jni_util.h"
+#include "lua_interface.h"
+#include "lua_java.h"
+#include "java_bridge.h"
+#include "lj_internal.h"
+#include "lj_context.h"
+#include "lj_array.h"
+
+/* Bulk array access. Regions of an array are read with one
+   Get<Type>ArrayRegion call instead of one call per element.
+
+   A view is a userdata holding a copy of the elements, it can be
+   indexed and sliced from Lua without any further JNI calls. A slice
+   points into the elements of its parent view, the parent is kept
+   alive as the uservalue of the slice. */
+
+#define ARRAY_VIEW "lj_array_view"
+
+char lj_array_element_type(JNIEnv *jni, jobject array)
+{
+  jclass class;
+  char *sig;
+  char type = 0;
+
+  class = (*jni)->GetObjectClass(jni, array);
+  if ((*current_jvmti())->GetClassSignature(current_jvmti(), class, &sig, NULL) == JVMTI_ERROR_NONE)
+  {
+    if (sig[0] == '[')
+      type = (sig[1] == '[') ? 'L' : sig[1];
+    free_jvmti_refs(current_jvmti(), sig, (void *)-1);
+  }
+  (*jni)->DeleteLocalRef(jni, class);
+
+  return type;
+}
+
+size_t lj_array_element_size(char type)
+{
+  switch (type)
+  {
+  case 'Z': return sizeof(jboolean);
+  case 'B': return sizeof(jbyte);
+  case 'C': return sizeof(jchar);
+  case 'S': return sizeof(jshort);
+  case 'I': return sizeof(jint);
+  case 'J': return sizeof(jlong);
+  case 'F': return sizeof(jfloat);
+  case 'D': return sizeof(jdouble);
+  }
+  return 0;
+}
+
+int lj_get_primitive_region(JNIEnv *jni, jarray array, char type, jsize from, jsize count, void *buf)
+{
+  switch (type)
+  {
+  case 'Z': (*jni)->GetBooleanArrayRegion(jni, array, from, count, buf); break;
+  case 'B': (*jni)->GetByteArrayRegion(jni, array, from, count, buf); break;
+  case 'C': (*jni)->GetCharArrayRegion(jni, array, from, count, buf); break;
+  case 'S': (*jni)->GetShortArrayRegion(jni, array, from, count, buf); break;
+  case 'I': (*jni)->GetIntArrayRegion(jni, array, from, count, buf); break;
+  case 'J': (*jni)->GetLongArrayRegion(jni, array, from, count, buf); break;
+  case 'F': (*jni)->GetFloatArrayRegion(jni, array, from, count, buf); break;
+  case 'D': (*jni)->GetDoubleArrayRegion(jni, array, from, count, buf); break;
+  default:
+    return 0;
+  }
+  if ((*jni)->ExceptionCheck(jni))
+  {
+    (*jni)->ExceptionClear(jni);
+    return 0;
+  }
+  return 1;
+}
+
+static void push_element(lua_State *L, char type, const void *data, jsize i)
+{
+  switch (type)
+  {
+  case 'Z': lua_pushboolean(L, ((const jboolean *)data)[i]); break;
+  case 'B': lua_pushinteger(L, ((const jbyte *)data)[i]); break;
+  case 'C': lua_pushinteger(L, ((const jchar *)data)[i]); break;
+  case 'S': lua_pushinteger(L, ((const jshort *)data)[i]); break;
+  case 'I': lua_pushinteger(L, ((const jint *)data)[i]); break;
+  case 'J': lua_pushinteger(L, ((const jlong *)data)[i]); break;
+  case 'F': lua_pushnumber(L, ((const jfloat *)data)[i]); break;
+  case 'D': lua_pushnumber(L, ((const jdouble *)data)[i]); break;
+  default: lua_pushnil(L);
+  }
+}
+
+/* Check the 1-based `from' and optional `count' arguments at `idx' and
+   `idx + 1' against `length'. Returns the 0-based start and sets the
+   count, clipped to the end of the array. */
+static jsize check_range(lua_State *L, int idx, jsize length, jsize *count)
+{
+  lua_Integer from = luaL_optinteger(L, idx, 1);
+  lua_Integer n = luaL_optinteger(L, idx + 1, length - from + 1);
+
+  if (from < 1 || from > (lua_Integer)length + 1)
+    luaL_error(L, "Index %d out of range, length is %d", (int)from, (int)length);
+  if (n < 0)
+    luaL_error(L, "Invalid count: %d", (int)n);
+  if (n > length - from + 1)
+    n = length - from + 1;
+  *count = (jsize)n;
+  return (jsize)(from - 1);
+}
+
+/* lj_get_array_region(array, from, count) returns a table of `count'
+   elements starting at `from'. Objects are raw jobjects with their own
+   global references, null elements are nil. */
+static int lj_get_array_region(lua_State *L)
+{
+  JNIEnv *jni = current_jni();
+  jobject array;
+  char type;
+  jsize length;
+  jsize from;
+  jsize count;
+  jsize i;
+  void *buf;
+  jobject element;
+  lj_arena_mark mark;
+
+  array = *(jobject *)luaL_checkudata(L, 1, "jobject");
+  type = lj_array_element_type(jni, array);
+  if (!type)
+    return luaL_error(L, "Not an array");
+  length = (*jni)->GetArrayLength(jni, array);
+  from = check_range(L, 2, length, &count);
+  lua_settop(L, 0);
+
+  /* elements can be nil, `n' is the count */
+  lua_createtable(L, count, 1);
+  lua_pushinteger(L, count);
+  lua_setfield(L, -2, "n");
+  if (type == 'L')
+  {
+    /* the command thread never pops a local frame, don't keep a local
+       reference per element */
+    for (i = 0; i < count; ++i)
+    {
+      element = (*jni)->GetObjectArrayElement(jni, array, from + i);
+      if (element)
+      {
+        new_jobject(L, (*jni)->NewGlobalRef(jni, element));
+        (*jni)->DeleteLocalRef(jni, element);
+      }
+      else
+      {
+        lua_pushnil(L);
+      }
+      lua_rawseti(L, -2, i + 1);
+    }
+    return 1;
+  }
+
+  mark = lj_arena_get_mark();
+  buf = lj_arena_alloc(lj_array_element_size(type) * (count ? count : 1));
+  if (!buf)
+    return luaL_error(L, "Out of memory");
+  if (!lj_get_primitive_region(jni, array, type, from, count, buf))
+  {
+    lj_arena_release(mark);
+    return luaL_error(L, "Failed to read array region");
+  }
+  for (i = 0; i < count; ++i)
+  {
+    push_element(L, type, buf, i);
+    lua_rawseti(L, -2, i + 1);
+  }
+  lj_arena_release(mark);
+
+  return 1;
+}
+
+lj_array_view *lj_test_array_view(lua_State *L, int idx)
+{
+  return luaL_testudata(L, idx, ARRAY_VIEW);
+}
+
+/* lj_new_array_view(array, from, count) copies `count' elements of a
+   primitive array starting at `from' into a new view */
+static int lj_new_array_view(lua_State *L)
+{
+  JNIEnv *jni = current_jni();
+  jobject array;
+  lj_array_view *view;
+  char type;
+  size_t size;
+  jsize length;
+  jsize from;
+  jsize count;
+
+  array = *(jobject *)luaL_checkudata(L, 1, "jobject");
+  type = lj_array_element_type(jni, array);
+  size = lj_array_element_size(type);
+  if (!size)
+    return luaL_error(L, "Views are only available for primitive arrays");
+  length = (*jni)->GetArrayLength(jni, array);
+  from = check_range(L, 2, length, &count);
+  lua_settop(L, 0);
+
+  /* the elements follow the header, which is a multiple of 8 bytes */
+  view = lua_newuserdata(L, sizeof(lj_array_view) + size * count);
+  view->data = view + 1;
+  view->length = count;
+  view->type = type;
+  luaL_setmetatable(L, ARRAY_VIEW);
+
+  if (!lj_get_primitive_region(jni, array, type, from, count, view->data))
+    return luaL_error(L, "Failed to read array region");
+
+  return 1;
+}
+
+static int array_view_len(lua_State *L)
+{
+  lj_array_view *view = luaL_checkudata(L, 1, ARRAY_VIEW);
+  lua_pushinteger(L, view->length);
+  return 1;
+}
+
+/* view:slice(from, count) returns a view of part of `view' sharing its
+   elements */
+static int array_view_slice(lua_State *L)
+{
+  lj_array_view *view = luaL_checkudata(L, 1, ARRAY_VIEW);
+  lj_array_view *slice;
+  jsize from;
+  jsize count;
+
+  from = check_range(L, 2, view->length, &count);
+  lua_settop(L, 1);
+
+  slice = lua_newuserdata(L, sizeof(lj_array_view));
+  slice->data = (char *)view->data + lj_array_element_size(view->type) * from;
+  slice->length = count;
+  slice->type = view->type;
+  luaL_setmetatable(L, ARRAY_VIEW);
+  lua_pushvalue(L, 1);
+  lua_setuservalue(L, -2);
+
+  return 1;
+}
+
+/* view:totable() */
+static int array_view_totable(lua_State *L)
+{
+  lj_array_view *view = luaL_checkudata(L, 1, ARRAY_VIEW);
+  jsize i;
+
+  lua_createtable(L, view->length, 0);
+  for (i = 0; i < view->length; ++i)
+  {
+    push_element(L, view->type, view->data, i);
+    lua_rawseti(L, -2, i + 1);
+  }
+
+  return 1;
+}
+
+static int array_view_index(lua_State *L)
+{
+  lj_array_view *view = luaL_checkudata(L, 1, ARRAY_VIEW);
+  lua_Integer index;
+  char type[2];
+
+  if (lua_type(L, 2) == LUA_TNUMBER)
+  {
+    index = lua_tointeger(L, 2);
+    if (index < 1 || index > view->length)
+      lua_pushnil(L);
+    else
+      push_element(L, view->type, view->data, (jsize)index - 1);
+    return 1;
+  }
+
+  if (lua_type(L, 2) == LUA_TSTRING && !strcmp(lua_tostring(L, 2), "type"))
+  {
+    type[0] = view->type;
+    type[1] = 0;
+    lua_pushstring(L, type);
+    return 1;
+  }
+
+  /* methods */
+  luaL_getmetatable(L, ARRAY_VIEW);
+  lua_pushvalue(L, 2);
+  lua_rawget(L, -2);
+  return 1;
+}
+
+static int array_view_tostring(lua_State *L)
+{
+  lj_array_view *view = luaL_checkudata(L, 1, ARRAY_VIEW);
+  lua_pushfstring(L, "lj_array_view@%p: %c[%d]", view->data, view->type, (int)view->length);
+  return 1;
+}
+
+void lj_array_register(lua_State *L)
+{
+  if (luaL_newmetatable(L, ARRAY_VIEW))
+  {
+    lua_pushcfunction(L, array_view_len);
+    lua_setfield(L, -2, "__len");
+    lua_pushcfunction(L, array_view_index);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, array_view_tostring);
+    lua_setfield(L, -2, "__tostring");
+    lua_pushcfunction(L, array_view_slice);
+    lua_setfield(L, -2, "slice");
+    lua_pushcfunction(L, array_view_totable);
+    lua_setfield(L, -2, "totable");
+  }
+  lua_pop(L, 1);
+
+  lua_register(L, "lj_get_array_region",           lj_get_array_region);
+  lua_register(L, "lj_new_array_view",             lj_new_array_view);
+}
@@ -0,0 +1,28 @@
+#ifndef LJ_ARRAY_H_
+#define LJ_ARRAY_H_
+
+#include "lua_java.h"
+
+/* A copy of (part of) a primitive array, read with one JNI call. Slices
+   share the elements of the view they are taken from. */
+typedef struct {
+  void *data;
+  jsize length;
+  char type;                    /* element signature, eg. 'I' */
+} lj_array_view;
+
+/* Element signature of `array' with 'L' for objects and arrays, 0 if
+   it isn't an array */
+char lj_array_element_type(JNIEnv *jni, jobject array);
+
+/* Size in bytes of a primitive element, 0 for objects */
+size_t lj_array_element_size(char type);
+
+/* Read `count' primitive elements starting at `from' (0-based) into
+   `buf'. Returns 0 if an exception was thrown. */
+int lj_get_primitive_region(JNIEnv *jni, jarray array, char type, jsize from, jsize count, void *buf);
+
+/* The view at `idx' or NULL if it isn't a view */
+lj_array_view *lj_test_array_view(lua_State *L, int idx);
+
+#endif /* LJ_ARRAY_H_ */
@@ -0,0 +1,659 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "myjni.h"
+#include "jni_util.h"
+#include "lua_interface.h"
+#include "lua_java.h"
+#include "java_bridge.h"
+#include "lj_internal.h"
+#include "lj_array.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LJ_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+/* Search and statistics over primitive arrays.
+
+   The elements are scanned in place with GetPrimitiveArrayCritical, or
+   from an array view. No JNI or Lua calls are made while the critical
+   region is held, results are collected in C and pushed after it is
+   released.
+
+   Range scans of int[] and byte[] have SSE2 and AVX2 kernels, byte
+   pattern search has an SSE2 kernel and int[] statistics an AVX2 one.
+   AVX2 is used if the CPU supports it, checked once at startup. Other
+   types use the scalar kernels. */
+
+#define SCAN_DEFAULT_MAX_FOUND 1000
+
+typedef struct {
+  void *data;
+  jsize length;
+  char type;
+  jarray array;                 /* NULL for views */
+} scan_source;
+
+/* matches, the first `max_found' indexes are kept in `found' */
+typedef struct {
+  jsize *found;
+  jsize max_found;
+  jsize count;
+} scan_result;
+
+static int have_avx2;
+
+static void add_match(scan_result *res, jsize index)
+{
+  if (res->count < res->max_found)
+    res->found[res->count] = index;
+  res->count++;
+}
+
+/* ============================================================ */
+/* scalar kernels */
+
+#define SCAN_RANGE_KERNEL(NAME, T)                                      \
+  static void NAME(const T *data, jsize from, jsize n, T lo, T hi, scan_result *res) \
+  {                                                                     \
+    jsize i;                                                            \
+    for (i = from; i < n; ++i)                                          \
+      if (data[i] >= lo && data[i] <= hi)                               \
+        add_match(res, i);                                              \
+  }
+
+SCAN_RANGE_KERNEL(scan_range_b, jbyte)
+SCAN_RANGE_KERNEL(scan_range_c, jchar)
+SCAN_RANGE_KERNEL(scan_range_s, jshort)
+SCAN_RANGE_KERNEL(scan_range_i, jint)
+SCAN_RANGE_KERNEL(scan_range_j, jlong)
+SCAN_RANGE_KERNEL(scan_range_f, jfloat)
+SCAN_RANGE_KERNEL(scan_range_d, jdouble)
+
+typedef struct {
+  double min;
+  double max;
+  double sum;                   /* floating point types */
+  jlong isum;                   /* integral types, wraps on overflow */
+} scan_stats;
+
+#define STATS_KERNEL(NAME, T, SUM)                                      \
+  static void NAME(const T *data, jsize from, jsize n, scan_stats *stats) \
+  {                                                                     \
+    jsize i;                                                            \
+    for (i = from; i < n; ++i)                                          \
+    {                                                                   \
+      if (data[i] < stats->min)                                         \
+        stats->min = data[i];                                           \
+      if (data[i] > stats->max)                                         \
+        stats->max = data[i];                                           \
+      stats->SUM += data[i];                                            \
+    }                                                                   \
+  }
+
+STATS_KERNEL(stats_b, jbyte, isum)
+STATS_KERNEL(stats_c, jchar, isum)
+STATS_KERNEL(stats_s, jshort, isum)
+STATS_KERNEL(stats_i, jint, isum)
+STATS_KERNEL(stats_j, jlong, isum)
+STATS_KERNEL(stats_f, jfloat, sum)
+STATS_KERNEL(stats_d, jdouble, sum)
+
+static void find_bytes_scalar(const jbyte *data, jsize from, jsize n,
+                              const char *pattern, jsize m, scan_result *res)
+{
+  jsize i;
+  for (i = from; i + m <= n; ++i)
+    if (data[i] == pattern[0] && !memcmp(data + i, pattern, m))
+      add_match(res, i);
+}
+
+/* ============================================================ */
+/* SIMD kernels, each returns the index where the scalar kernel has to
+   continue */
+
+#ifdef LJ_SCAN_X86
+
+static void add_mask(scan_result *res, jsize base, unsigned int mask)
+{
+  if (res->count >= res->max_found)
+  {
+    /* counting only */
+    res->count += __builtin_popcount(mask);
+    return;
+  }
+  while (mask)
+  {
+    add_match(res, base + __builtin_ctz(mask));
+    mask &= mask - 1;
+  }
+}
+
+#ifdef __SSE2__
+static jsize scan_range_i_sse2(const jint *data, jsize n, jint lo, jint hi, scan_result *res)
+{
+  __m128i vlo = _mm_set1_epi32(lo);
+  __m128i vhi = _mm_set1_epi32(hi);
+  jsize i;
+
+  for (i = 0; i + 4 <= n; i += 4)
+  {
+    __m128i x = _mm_loadu_si128((const __m128i *)(data + i));
+    __m128i out = _mm_or_si128(_mm_cmpgt_epi32(vlo, x), _mm_cmpgt_epi32(x, vhi));
+    unsigned int mask = ~_mm_movemask_ps(_mm_castsi128_ps(out)) & 0xf;
+    if (mask)
+      add_mask(res, i, mask);
+  }
+  return i;
+}
+
+static jsize scan_range_b_sse2(const jbyte *data, jsize n, jbyte lo, jbyte hi, scan_result *res)
+{
+  __m128i vlo = _mm_set1_epi8(lo);
+  __m128i vhi = _mm_set1_epi8(hi);
+  jsize i;
+
+  for (i = 0; i + 16 <= n; i += 16)
+  {
+    __m128i x = _mm_loadu_si128((const __m128i *)(data + i));
+    __m128i out = _mm_or_si128(_mm_cmpgt_epi8(vlo, x), _mm_cmpgt_epi8(x, vhi));
+    unsigned int mask = ~_mm_movemask_epi8(out) & 0xffff;
+    if (mask)
+      add_mask(res, i, mask);
+  }
+  return i;
+}
+
+/* compare the first and last byte of the pattern 16 positions at a
+   time, then the whole pattern at the candidates */
+static jsize find_bytes_sse2(const jbyte *data, jsize n, const char *pattern, jsize m, scan_result *res)
+{
+  __m128i first = _mm_set1_epi8(pattern[0]);
+  __m128i last = _mm_set1_epi8(pattern[m - 1]);
+  jsize i;
+
+  for (i = 0; i + m - 1 + 16 <= n; i += 16)
+  {
+    __m128i f = _mm_loadu_si128((const __m128i *)(data + i));
+    __m128i l = _mm_loadu_si128((const __m128i *)(data + i + m - 1));
+    unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(f, first),
+                                                        _mm_cmpeq_epi8(l, last)));
+    while (mask)
+    {
+      jsize pos = i + __builtin_ctz(mask);
+      if (!memcmp(data + pos, pattern, m))
+        add_match(res, pos);
+      mask &= mask - 1;
+    }
+  }
+  return i;
+}
+#endif /* __SSE2__ */
+
+__attribute__((target("avx2")))
+static jsize scan_range_i_avx2(const jint *data, jsize n, jint lo, jint hi, scan_result *res)
+{
+  __m256i vlo = _mm256_set1_epi32(lo);
+  __m256i vhi = _mm256_set1_epi32(hi);
+  jsize i;
+
+  for (i = 0; i + 8 <= n; i += 8)
+  {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(data + i));
+    __m256i out = _mm256_or_si256(_mm256_cmpgt_epi32(vlo, x), _mm256_cmpgt_epi32(x, vhi));
+    unsigned int mask = ~_mm256_movemask_ps(_mm256_castsi256_ps(out)) & 0xff;
+    if (mask)
+      add_mask(res, i, mask);
+  }
+  return i;
+}
+
+__attribute__((target("avx2")))
+static jsize scan_range_b_avx2(const jbyte *data, jsize n, jbyte lo, jbyte hi, scan_result *res)
+{
+  __m256i vlo = _mm256_set1_epi8(lo);
+  __m256i vhi = _mm256_set1_epi8(hi);
+  jsize i;
+
+  for (i = 0; i + 32 <= n; i += 32)
+  {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(data + i));
+    __m256i out = _mm256_or_si256(_mm256_cmpgt_epi8(vlo, x), _mm256_cmpgt_epi8(x, vhi));
+    unsigned int mask = ~(unsigned int)_mm256_movemask_epi8(out);
+    if (mask)
+      add_mask(res, i, mask);
+  }
+  return i;
+}
+
+__attribute__((target("avx2")))
+static jsize stats_i_avx2(const jint *data, jsize n, scan_stats *stats)
+{
+  __m256i vmin = _mm256_set1_epi32(0x7fffffff);
+  __m256i vmax = _mm256_set1_epi32(-0x7fffffff - 1);
+  __m256i vsum = _mm256_setzero_si256();
+  jint mins[8];
+  jint maxs[8];
+  jlong sums[4];
+  jsize i;
+  int j;
+
+  for (i = 0; i + 8 <= n; i += 8)
+  {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(data + i));
+    vmin = _mm256_min_epi32(vmin, x);
+    vmax = _mm256_max_epi32(vmax, x);
+    /* widen to 64 bits for the sum */
+    vsum = _mm256_add_epi64(vsum, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(x)));
+    vsum = _mm256_add_epi64(vsum, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(x, 1)));
+  }
+  if (i == 0)
+    return 0;
+
+  _mm256_storeu_si256((__m256i *)mins, vmin);
+  _mm256_storeu_si256((__m256i *)maxs, vmax);
+  _mm256_storeu_si256((__m256i *)sums, vsum);
+  for (j = 0; j < 8; ++j)
+  {
+    if (mins[j] < stats->min)
+      stats->min = mins[j];
+    if (maxs[j] > stats->max)
+      stats->max = maxs[j];
+  }
+  for (j = 0; j < 4; ++j)
+    stats->isum += sums[j];
+  return i;
+}
+
+#endif /* LJ_SCAN_X86 */
+
+/* ============================================================ */
+/* dispatch */
+
+static void scan_range_int(const jint *data, jsize n, jint lo, jint hi, scan_result *res)
+{
+  jsize from = 0;
+#ifdef LJ_SCAN_X86
+  if (have_avx2)
+    from = scan_range_i_avx2(data, n, lo, hi, res);
+#ifdef __SSE2__
+  else
+    from = scan_range_i_sse2(data, n, lo, hi, res);
+#endif
+#endif
+  scan_range_i(data, from, n, lo, hi, res);
+}
+
+static void scan_range_byte(const jbyte *data, jsize n, jbyte lo, jbyte hi, scan_result *res)
+{
+  jsize from = 0;
+#ifdef LJ_SCAN_X86
+  if (have_avx2)
+    from = scan_range_b_avx2(data, n, lo, hi, res);
+#ifdef __SSE2__
+  else
+    from = scan_range_b_sse2(data, n, lo, hi, res);
+#endif
+#endif
+  scan_range_b(data, from, n, lo, hi, res);
+}
+
+static void find_bytes(const jbyte *data, jsize n, const char *pattern, jsize m, scan_result *res)
+{
+  jsize from = 0;
+#if defined(LJ_SCAN_X86) && defined(__SSE2__)
+  from = find_bytes_sse2(data, n, pattern, m, res);
+#endif
+  find_bytes_scalar(data, from, n, pattern, m, res);
+}
+
+/* Limits of the integral element types, the range of a scan is clipped
+   to these. Returns 0 for floating point types. */
+static int integral_limits(char type, double *min, double *max)
+{
+  switch (type)
+  {
+  case 'B': *min = -128; *max = 127; return 1;
+  case 'C': *min = 0; *max = 65535; return 1;
+  case 'S': *min = -32768; *max = 32767; return 1;
+  case 'I': *min = -2147483648.0; *max = 2147483647.0; return 1;
+  case 'J': *min = -9223372036854775808.0; *max = 9223372036854775807.0; return 1;
+  }
+  return 0;
+}
+
+/* Scan for elements between `lo' and `hi' inclusive */
+static void scan_range(const scan_source *src, double lo, double hi, scan_result *res)
+{
+  double min;
+  double max;
+
+  if (integral_limits(src->type, &min, &max))
+  {
+    lo = ceil(lo);
+    hi = floor(hi);
+    if (lo < min)
+      lo = min;
+    if (hi > max)
+      hi = max;
+    if (lo > hi)
+      return;
+  }
+
+  switch (src->type)
+  {
+  case 'B': scan_range_byte(src->data, src->length, (jbyte)lo, (jbyte)hi, res); break;
+  case 'C': scan_range_c(src->data, 0, src->length, (jchar)lo, (jchar)hi, res); break;
+  case 'S': scan_range_s(src->data, 0, src->length, (jshort)lo, (jshort)hi, res); break;
+  case 'I': scan_range_int(src->data, src->length, (jint)lo, (jint)hi, res); break;
+  case 'J':
+    /* doubles can't hold the limits of long exactly */
+    scan_range_j(src->data, 0, src->length,
+                 lo <= min ? (jlong)0x8000000000000000ULL : (jlong)lo,
+                 hi >= max ? (jlong)0x7fffffffffffffffLL : (jlong)hi, res);
+    break;
+  case 'F': scan_range_f(src->data, 0, src->length, (jfloat)lo, (jfloat)hi, res); break;
+  case 'D': scan_range_d(src->data, 0, src->length, lo, hi, res); break;
+  }
+}
+
+static void compute_stats(const scan_source *src, scan_stats *stats)
+{
+  jsize from = 0;
+
+  stats->min = HUGE_VAL;
+  stats->max = -HUGE_VAL;
+  stats->sum = 0;
+  stats->isum = 0;
+
+  switch (src->type)
+  {
+  case 'B': stats_b(src->data, 0, src->length, stats); break;
+  case 'C': stats_c(src->data, 0, src->length, stats); break;
+  case 'S': stats_s(src->data, 0, src->length, stats); break;
+  case 'I':
+#ifdef LJ_SCAN_X86
+    if (have_avx2)
+      from = stats_i_avx2(src->data, src->length, stats);
+#endif
+    stats_i(src->data, from, src->length, stats);
+    break;
+  case 'J': stats_j(src->data, 0, src->length, stats); break;
+  case 'F': stats_f(src->data, 0, src->length, stats); break;
+  case 'D': stats_d(src->data, 0, src->length, stats); break;
+  }
+}
+
+static double element_value(const scan_source *src, jsize i)
+{
+  switch (src->type)
+  {
+  case 'B': return ((const jbyte *)src->data)[i];
+  case 'C': return ((const jchar *)src->data)[i];
+  case 'S': return ((const jshort *)src->data)[i];
+  case 'I': return ((const jint *)src->data)[i];
+  case 'J': return (double)((const jlong *)src->data)[i];
+  case 'F': return ((const jfloat *)src->data)[i];
+  case 'D': return ((const jdouble *)src->data)[i];
+  }
+  return 0;
+}
+
+/* ============================================================ */
+/* Lua functions */
+
+/* Get the elements of the array or view at `idx'. Arrays are held with
+   GetPrimitiveArrayCritical until release_source(), nothing that can
+   call JNI or raise a Lua error may be done in between. */
+static void get_source(lua_State *L, int idx, scan_source *src)
+{
+  JNIEnv *jni = current_jni();
+  lj_array_view *view;
+
+  view = lj_test_array_view(L, idx);
+  if (view)
+  {
+    src->data = view->data;
+    src->length = view->length;
+    src->type = view->type;
+    src->array = NULL;
+  }
+  else
+  {
+    src->array = *(jobject *)luaL_checkudata(L, idx, "jobject");
+    src->type = lj_array_element_type(jni, src->array);
+    src->length = (*jni)->GetArrayLength(jni, src->array);
+    src->data = NULL;
+  }
+
+  if (src->type == 0 || src->type == 'L' || src->type == 'Z')
+    luaL_error(L, "Not a numeric array");
+}
+
+static void acquire_source(scan_source *src)
+{
+  JNIEnv *jni = current_jni();
+  if (src->array)
+    src->data = (*jni)->GetPrimitiveArrayCritical(jni, src->array, NULL);
+}
+
+static void release_source(scan_source *src)
+{
+  JNIEnv *jni = current_jni();
+  if (src->array && src->data)
+    (*jni)->ReleasePrimitiveArrayCritical(jni, src->array, src->data, JNI_ABORT);
+}
+
+static void push_result(lua_State *L, scan_result *res)
+{
+  jsize i;
+  jsize n = res->count < res->max_found ? res->count : res->max_found;
+
+  lua_createtable(L, n, 0);
+  for (i = 0; i < n; ++i)
+  {
+    lua_pushinteger(L, res->found[i] + 1);
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_pushinteger(L, res->count);
+}
+
+/* lj_array_find(array, lo, hi, max) returns the indexes of the first
+   `max' elements between `lo' and `hi' (default `lo') and the total
+   number of matches */
+static int lj_array_find(lua_State *L)
+{
+  scan_source src;
+  scan_result res;
+  double lo;
+  double hi;
+
+  get_source(L, 1, &src);
+  lo = luaL_checknumber(L, 2);
+  hi = luaL_optnumber(L, 3, lo);
+  res.max_found = luaL_optinteger(L, 4, SCAN_DEFAULT_MAX_FOUND);
+  luaL_argcheck(L, res.max_found >= 0, 4, "must not be negative");
+  res.count = 0;
+  res.found = malloc(sizeof(jsize) * (res.max_found > 0 ? res.max_found : 1));
+  if (!res.found)
+    return luaL_error(L, "Out of memory");
+
+  acquire_source(&src);
+  if (src.data)
+    scan_range(&src, lo, hi, &res);
+  release_source(&src);
+
+  push_result(L, &res);
+  free(res.found);
+
+  return 2;
+}
+
+/* lj_array_count(array, lo, hi) returns the number of elements between
+   `lo' and `hi' (default `lo') */
+static int lj_array_count(lua_State *L)
+{
+  scan_source src;
+  scan_result res = { NULL, 0, 0 };
+  double lo;
+  double hi;
+
+  get_source(L, 1, &src);
+  lo = luaL_checknumber(L, 2);
+  hi = luaL_optnumber(L, 3, lo);
+
+  acquire_source(&src);
+  if (src.data)
+    scan_range(&src, lo, hi, &res);
+  release_source(&src);
+
+  lua_pushinteger(L, res.count);
+
+  return 1;
+}
+
+/* lj_array_stats(array) returns {count=, min=, max=, sum=}, min and max
+   are nil for empty arrays */
+static int lj_array_stats(lua_State *L)
+{
+  scan_source src;
+  scan_stats stats;
+  int is_float;
+
+  get_source(L, 1, &src);
+  is_float = (src.type == 'F' || src.type == 'D');
+
+  acquire_source(&src);
+  if (src.data)
+    compute_stats(&src, &stats);
+  release_source(&src);
+  if (!src.data)
+    return luaL_error(L, "Cannot access array elements");
+
+  lua_newtable(L);
+  lua_pushinteger(L, src.length);
+  lua_setfield(L, -2, "count");
+  if (src.length > 0)
+  {
+    lua_pushnumber(L, stats.min);
+    lua_setfield(L, -2, "min");
+    lua_pushnumber(L, stats.max);
+    lua_setfield(L, -2, "max");
+  }
+  if (is_float)
+    lua_pushnumber(L, stats.sum);
+  else
+    lua_pushnumber(L, (lua_Number)stats.isum);
+  lua_setfield(L, -2, "sum");
+
+  return 1;
+}
+
+/* lj_array_histogram(array, lo, hi, buckets) counts the elements in
+   `buckets' equal ranges between `lo' and `hi'. Returns an array of
+   counts with the elements outside the range in `below' and `above'. */
+static int lj_array_histogram(lua_State *L)
+{
+  scan_source src;
+  double lo;
+  double hi;
+  double width;
+  int buckets;
+  jsize *counts;
+  jsize below = 0;
+  jsize above = 0;
+  jsize i;
+  int b;
+
+  get_source(L, 1, &src);
+  lo = luaL_checknumber(L, 2);
+  hi = luaL_checknumber(L, 3);
+  buckets = luaL_optinteger(L, 4, 10);
+  luaL_argcheck(L, hi > lo, 3, "must be greater than lo");
+  luaL_argcheck(L, buckets > 0, 4, "must be positive");
+  width = (hi - lo) / buckets;
+
+  counts = calloc(buckets, sizeof(jsize));
+  if (!counts)
+    return luaL_error(L, "Out of memory");
+
+  acquire_source(&src);
+  for (i = 0; src.data && i < src.length; ++i)
+  {
+    double v = element_value(&src, i);
+    if (v != v)
+      continue;                 /* NaN */
+    if (v < lo)
+      below++;
+    else if (v > hi)
+      above++;
+    else
+    {
+      b = (int)((v - lo) / width);
+      counts[b < buckets ? b : buckets - 1]++;
+    }
+  }
+  release_source(&src);
+
+  lua_createtable(L, buckets, 2);
+  for (b = 0; b < buckets; ++b)
+  {
+    lua_pushinteger(L, counts[b]);
+    lua_rawseti(L, -2, b + 1);
+  }
+  lua_pushinteger(L, below);
+  lua_setfield(L, -2, "below");
+  lua_pushinteger(L, above);
+  lua_setfield(L, -2, "above");
+  free(counts);
+
+  return 1;
+}
+
+/* lj_array_find_bytes(array, pattern, max) returns the indexes of the
+   first `max' occurrences of `pattern' in a byte[] and the total number
+   of occurrences */
+static int lj_array_find_bytes(lua_State *L)
+{
+  scan_source src;
+  scan_result res;
+  const char *pattern;
+  size_t m;
+
+  get_source(L, 1, &src);
+  if (src.type != 'B')
+    return luaL_error(L, "Not a byte array");
+  pattern = luaL_checklstring(L, 2, &m);
+  luaL_argcheck(L, m > 0, 2, "empty pattern");
+  res.max_found = luaL_optinteger(L, 3, SCAN_DEFAULT_MAX_FOUND);
+  luaL_argcheck(L, res.max_found >= 0, 3, "must not be negative");
+  res.count = 0;
+  res.found = malloc(sizeof(jsize) * (res.max_found > 0 ? res.max_found : 1));
+  if (!res.found)
+    return luaL_error(L, "Out of memory");
+
+  acquire_source(&src);
+  if (src.data && (jsize)m <= src.length)
+    find_bytes(src.data, src.length, pattern, (jsize)m, &res);
+  release_source(&src);
+
+  push_result(L, &res);
+  free(res.found);
+
+  return 2;
+}
+
+void lj_array_scan_register(lua_State *L)
+{
+#ifdef LJ_SCAN_X86
+  have_avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+  lua_register(L, "lj_array_find",                 lj_array_find);
+  lua_register(L, "lj_array_count",                lj_array_count);
+  lua_register(L, "lj_array_stats",                lj_array_stats);
+  lua_register(L, "lj_array_histogram",            lj_array_histogram);
+  lua_register(L, "lj_array_find_bytes",           lj_array_find_bytes);
+}
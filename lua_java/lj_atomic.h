@@ -0,0 +1,148 @@
+#ifndef LJ_ATOMIC_H_
+#define LJ_ATOMIC_H_
+
+/* Minimal atomics and thread-local storage for data shared between
+   JVMTI event threads without a raw monitor. Counters are 32-bit
+   except for the 64-bit statistics counters. */
+
+#include <stdint.h>
+
+#ifdef _WIN32
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#define LJ_THREAD_LOCAL __declspec(thread)
+#define LJ_INLINE __inline
+
+static LJ_INLINE uint32_t lj_atomic_load_acquire(volatile uint32_t *p)
+{
+  uint32_t v = *p;
+  MemoryBarrier();
+  return v;
+}
+
+static LJ_INLINE void lj_atomic_store_release(volatile uint32_t *p, uint32_t v)
+{
+  MemoryBarrier();
+  *p = v;
+}
+
+static LJ_INLINE uint32_t lj_atomic_fetch_add(volatile uint32_t *p, uint32_t v)
+{
+  return (uint32_t)InterlockedExchangeAdd((volatile LONG *)p, (LONG)v);
+}
+
+/* returns the old value, with acquire and release ordering */
+static LJ_INLINE uint32_t lj_atomic_fetch_sub(volatile uint32_t *p, uint32_t v)
+{
+  return (uint32_t)InterlockedExchangeAdd((volatile LONG *)p, -(LONG)v);
+}
+
+static LJ_INLINE uint32_t lj_atomic_exchange(volatile uint32_t *p, uint32_t v)
+{
+  return (uint32_t)InterlockedExchange((volatile LONG *)p, (LONG)v);
+}
+
+static LJ_INLINE int64_t lj_atomic_load64(volatile int64_t *p)
+{
+  return InterlockedCompareExchange64((volatile LONGLONG *)p, 0, 0);
+}
+
+static LJ_INLINE void lj_atomic_fetch_add64(volatile int64_t *p, int64_t v)
+{
+  InterlockedExchangeAdd64((volatile LONGLONG *)p, v);
+}
+
+/* orders earlier stores before later loads */
+static LJ_INLINE void lj_atomic_fence()
+{
+  MemoryBarrier();
+}
+
+static LJ_INLINE void *lj_atomic_load_ptr(void *volatile *p)
+{
+  void *v = *p;
+  MemoryBarrier();
+  return v;
+}
+
+static LJ_INLINE void lj_atomic_store_ptr(void *volatile *p, void *v)
+{
+  MemoryBarrier();
+  *p = v;
+}
+
+/* returns non-zero if *p was `expected' and has been replaced */
+static LJ_INLINE int lj_atomic_cas_ptr(void *volatile *p, void *expected, void *desired)
+{
+  return InterlockedCompareExchangePointer(p, desired, expected) == expected;
+}
+
+#else  /* _WIN32 */
+
+#define LJ_THREAD_LOCAL __thread
+#define LJ_INLINE inline
+
+static LJ_INLINE uint32_t lj_atomic_load_acquire(volatile uint32_t *p)
+{
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static LJ_INLINE void lj_atomic_store_release(volatile uint32_t *p, uint32_t v)
+{
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static LJ_INLINE uint32_t lj_atomic_fetch_add(volatile uint32_t *p, uint32_t v)
+{
+  return __atomic_fetch_add(p, v, __ATOMIC_RELAXED);
+}
+
+/* returns the old value, with acquire and release ordering */
+static LJ_INLINE uint32_t lj_atomic_fetch_sub(volatile uint32_t *p, uint32_t v)
+{
+  return __atomic_fetch_sub(p, v, __ATOMIC_ACQ_REL);
+}
+
+static LJ_INLINE uint32_t lj_atomic_exchange(volatile uint32_t *p, uint32_t v)
+{
+  return __atomic_exchange_n(p, v, __ATOMIC_ACQ_REL);
+}
+
+static LJ_INLINE int64_t lj_atomic_load64(volatile int64_t *p)
+{
+  return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static LJ_INLINE void lj_atomic_fetch_add64(volatile int64_t *p, int64_t v)
+{
+  __atomic_fetch_add(p, v, __ATOMIC_RELAXED);
+}
+
+/* orders earlier stores before later loads */
+static LJ_INLINE void lj_atomic_fence()
+{
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static LJ_INLINE void *lj_atomic_load_ptr(void *volatile *p)
+{
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static LJ_INLINE void lj_atomic_store_ptr(void *volatile *p, void *v)
+{
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+/* returns non-zero if *p was `expected' and has been replaced */
+static LJ_INLINE int lj_atomic_cas_ptr(void *volatile *p, void *expected, void *desired)
+{
+  return __atomic_compare_exchange_n(p, &expected, desired, 0,
+                                     __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+#endif /* _WIN32 */
+
+#endif /* LJ_ATOMIC_H_ */
@@ -0,0 +1,747 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "myjni.h"
+#include "jni_util.h"
+#include "lua_interface.h"
+#include "lua_java.h"
+#include "java_bridge.h"
+#include "lj_internal.h"
+#include "lj_breakpoint.h"
+#include "lj_trace.h"
+
+/* Table of installed breakpoints, keyed by (method_id, location).
+
+   The table is changed by the command thread while holding
+   `breakpoint_lock'. JVMTI breakpoint events look up breakpoints
+   without the lock: entries are published with release stores and a
+   cleared entry is unlinked first and only freed once no lookup can
+   still see it. Lookups count themselves in `lookups' for the parity of
+   `lookup_epoch', clearing a breakpoint advances the epoch and waits
+   for the lookups counted under the old parity to finish.
+
+   Each entry holds a reference for the table, callbacks take another
+   while they use it. The last one released frees it.
+
+   Entries are also chained by id in `breakpoints_by_id', which is only
+   used by the command thread with the lock held. */
+
+#define BREAKPOINT_TABLE_SIZE 1024 /* must be a power of 2 */
+
+static lj_breakpoint *volatile breakpoint_table[BREAKPOINT_TABLE_SIZE];
+static lj_breakpoint *breakpoints_by_id[BREAKPOINT_TABLE_SIZE];
+static jrawMonitorID breakpoint_lock;
+static volatile uint32_t lookup_epoch;
+static volatile uint32_t lookups[2];
+static jint next_breakpoint_id = 1;
+static volatile uint32_t breakpoint_generation;
+
+static unsigned int breakpoint_hash(jmethodID method_id, jlocation location)
+{
+  uintptr_t h = (uintptr_t)method_id;
+  h ^= h >> 4;
+  h ^= (uintptr_t)location * 0x9E3779B1u;
+  h ^= h >> 16;
+  return (unsigned int)(h & (BREAKPOINT_TABLE_SIZE - 1));
+}
+
+static void lock_breakpoints()
+{
+  jvmtiError err = (*current_jvmti())->RawMonitorEnter(current_jvmti(), breakpoint_lock);
+  assert(err == JVMTI_ERROR_NONE);
+  (void)err;
+}
+
+static void unlock_breakpoints()
+{
+  jvmtiError err = (*current_jvmti())->RawMonitorExit(current_jvmti(), breakpoint_lock);
+  assert(err == JVMTI_ERROR_NONE);
+  (void)err;
+}
+
+/* must be called with breakpoint_lock held, or between begin_lookup()
+   and end_lookup() */
+static lj_breakpoint *find_breakpoint(jmethodID method_id, jlocation location)
+{
+  lj_breakpoint *bp = lj_atomic_load_ptr((void *volatile *)&breakpoint_table[breakpoint_hash(method_id, location)]);
+  while (bp && (bp->method_id != method_id || bp->location != location))
+    bp = lj_atomic_load_ptr((void *volatile *)&bp->next);
+  return bp;
+}
+
+/* returns the parity to give to end_lookup() */
+static uint32_t begin_lookup()
+{
+  uint32_t epoch;
+
+  for (;;)
+  {
+    epoch = lj_atomic_load_acquire(&lookup_epoch);
+    lj_atomic_fetch_add(&lookups[epoch & 1], 1);
+    lj_atomic_fence();
+    /* counted under the current parity, a clear that advanced the
+       epoch in between may not have waited for us */
+    if (lj_atomic_load_acquire(&lookup_epoch) == epoch)
+      return epoch & 1;
+    lj_atomic_fetch_sub(&lookups[epoch & 1], 1);
+  }
+}
+
+static void end_lookup(uint32_t parity)
+{
+  lj_atomic_fetch_sub(&lookups[parity], 1);
+}
+
+/* Wait until no lookup can see entries unlinked before the call. Must
+   be called with breakpoint_lock held. Lookups are short and never
+   block so this spins. */
+static void wait_for_lookups()
+{
+  uint32_t epoch = lj_atomic_fetch_add(&lookup_epoch, 1);
+  lj_atomic_fence();
+  while (lj_atomic_load_acquire(&lookups[epoch & 1]))
+    ;
+}
+
+/* must be called with breakpoint_lock held */
+static lj_breakpoint *find_breakpoint_by_id(jint id)
+{
+  lj_breakpoint *bp = breakpoints_by_id[id & (BREAKPOINT_TABLE_SIZE - 1)];
+  while (bp && bp->id != id)
+    bp = bp->id_next;
+  return bp;
+}
+
+static void free_breakpoint(lj_breakpoint *bp)
+{
+  int i;
+  for (i = 0; i < bp->clause_count; ++i)
+    free(bp->clauses[i].sval);
+  free(bp->clauses);
+  free(bp->captures);
+  free(bp->action);
+  free(bp);
+}
+
+/* must be called with breakpoint_lock held */
+static void unlink_breakpoint(lj_breakpoint *bp)
+{
+  lj_breakpoint *volatile *p = &breakpoint_table[breakpoint_hash(bp->method_id, bp->location)];
+  lj_breakpoint **q = &breakpoints_by_id[bp->id & (BREAKPOINT_TABLE_SIZE - 1)];
+  while (*p != bp)
+    p = &(*p)->next;
+  lj_atomic_store_ptr((void *volatile *)p, bp->next);
+  while (*q != bp)
+    q = &(*q)->id_next;
+  *q = bp->id_next;
+  wait_for_lookups();
+  /* callbacks in progress keep a reference, the last one frees it */
+  lj_breakpoint_release(bp);
+}
+
+lj_breakpoint *lj_breakpoint_acquire(jmethodID method_id, jlocation location)
+{
+  lj_breakpoint *bp;
+  uint32_t parity;
+
+  parity = begin_lookup();
+  bp = find_breakpoint(method_id, location);
+  if (bp && bp->enabled)
+    lj_atomic_fetch_add(&bp->refcount, 1);
+  else
+    bp = NULL;
+  end_lookup(parity);
+
+  return bp;
+}
+
+uint32_t lj_breakpoint_generation()
+{
+  return lj_atomic_load_acquire(&breakpoint_generation);
+}
+
+void lj_breakpoint_release(lj_breakpoint *bp)
+{
+  if (lj_atomic_fetch_sub(&bp->refcount, 1) == 1)
+    free_breakpoint(bp);
+}
+
+ /*  _____                _ _ _   _                  */
+ /* / ____|              | (_) | (_)                 */
+ /* | |     ___  _ __   __| |_| |_ _  ___  _ __  ___  */
+ /* | |    / _ \| '_ \ / _` | | __| |/ _ \| '_ \/ __| */
+ /* | |___| (_) | | | | (_| | | |_| | (_) | | | \__ \ */
+ /*  \_____\___/|_| |_|\__,_|_|\__|_|\___/|_| |_|___/ */
+
+/* Conditions are evaluated on the thread that hit the breakpoint,
+   before anything is done in Lua. The frame of the breakpoint is
+   always at depth 0. Any error reading a value (e.g. the local
+   variable is not live at the location) makes the clause false. */
+
+int lj_operand_read(JNIEnv *jni, jthread thread, const lj_operand *operand, lj_operand_value *val)
+{
+  jvmtiEnv *jvmti = current_jvmti();
+  jvmtiError err = JVMTI_ERROR_NONE;
+  jvmtiThreadInfo info;
+  jobject this_object;
+  jint val_i;
+  jlong val_j;
+  jfloat val_f;
+  jdouble val_d;
+
+  memset(val, 0, sizeof(lj_operand_value));
+
+  switch (operand->source)
+  {
+  case LJ_OPERAND_THREAD_NAME:
+    err = (*jvmti)->GetThreadInfo(jvmti, thread, &info);
+    if (err != JVMTI_ERROR_NONE)
+      return 0;
+    (*jni)->DeleteLocalRef(jni, info.thread_group);
+    (*jni)->DeleteLocalRef(jni, info.context_class_loader);
+    val->jvmti_str = info.name;
+    val->str = info.name;
+    return 1;
+
+  case LJ_OPERAND_LOCAL:
+    switch (operand->type)
+    {
+    case 'Z': case 'B': case 'C': case 'S': case 'I':
+      err = (*jvmti)->GetLocalInt(jvmti, thread, 0, operand->slot, &val_i);
+      val->ival = val_i;
+      break;
+    case 'J':
+      err = (*jvmti)->GetLocalLong(jvmti, thread, 0, operand->slot, &val_j);
+      val->ival = val_j;
+      break;
+    case 'F':
+      err = (*jvmti)->GetLocalFloat(jvmti, thread, 0, operand->slot, &val_f);
+      val->dval = val_f;
+      break;
+    case 'D':
+      err = (*jvmti)->GetLocalDouble(jvmti, thread, 0, operand->slot, &val_d);
+      val->dval = val_d;
+      break;
+    default:
+      err = (*jvmti)->GetLocalObject(jvmti, thread, 0, operand->slot, &val->object);
+      break;
+    }
+    if (err != JVMTI_ERROR_NONE)
+      return 0;
+    break;
+
+  case LJ_OPERAND_THIS_FIELD:
+    err = (*jvmti)->GetLocalObject(jvmti, thread, 0, 0, &this_object);
+    if (err != JVMTI_ERROR_NONE || this_object == NULL)
+      return 0;
+    switch (operand->type)
+    {
+    case 'Z':
+      val->ival = (*jni)->GetBooleanField(jni, this_object, operand->field_id);
+      break;
+    case 'B':
+      val->ival = (*jni)->GetByteField(jni, this_object, operand->field_id);
+      break;
+    case 'C':
+      val->ival = (*jni)->GetCharField(jni, this_object, operand->field_id);
+      break;
+    case 'S':
+      val->ival = (*jni)->GetShortField(jni, this_object, operand->field_id);
+      break;
+    case 'I':
+      val->ival = (*jni)->GetIntField(jni, this_object, operand->field_id);
+      break;
+    case 'J':
+      val->ival = (*jni)->GetLongField(jni, this_object, operand->field_id);
+      break;
+    case 'F':
+      val->dval = (*jni)->GetFloatField(jni, this_object, operand->field_id);
+      break;
+    case 'D':
+      val->dval = (*jni)->GetDoubleField(jni, this_object, operand->field_id);
+      break;
+    default:
+      val->object = (*jni)->GetObjectField(jni, this_object, operand->field_id);
+      break;
+    }
+    (*jni)->DeleteLocalRef(jni, this_object);
+    if ((*jni)->ExceptionCheck(jni))
+    {
+      (*jni)->ExceptionClear(jni);
+      return 0;
+    }
+    break;
+  }
+
+  if (operand->type == 'T' && val->object)
+  {
+    val->string_ref = (jstring)val->object;
+    val->str = (*jni)->GetStringUTFChars(jni, val->string_ref, NULL);
+  }
+
+  return 1;
+}
+
+void lj_operand_release(JNIEnv *jni, lj_operand_value *val)
+{
+  if (val->string_ref && val->str)
+    (*jni)->ReleaseStringUTFChars(jni, val->string_ref, val->str);
+  if (val->jvmti_str)
+    free_jvmti_refs(current_jvmti(), val->jvmti_str, (void *)-1);
+  if (val->object)
+    (*jni)->DeleteLocalRef(jni, val->object);
+}
+
+static int test_op(lj_condition_op op, int cmp)
+{
+  switch (op)
+  {
+  case LJ_OP_EQ: return cmp == 0;
+  case LJ_OP_NE: return cmp != 0;
+  case LJ_OP_LT: return cmp < 0;
+  case LJ_OP_LE: return cmp <= 0;
+  case LJ_OP_GT: return cmp > 0;
+  case LJ_OP_GE: return cmp >= 0;
+  }
+  return 0;
+}
+
+static int eval_clause(JNIEnv *jni, jthread thread, const lj_condition_clause *clause)
+{
+  lj_operand_value val;
+  int result = 0;
+
+  if (!lj_operand_read(jni, thread, &clause->operand, &val))
+    return 0;
+
+  switch (clause->operand.type)
+  {
+  case 'Z': case 'B': case 'C': case 'S': case 'I': case 'J':
+    if ((jdouble)clause->ival == clause->dval)
+      result = test_op(clause->op, (val.ival > clause->ival) - (val.ival < clause->ival));
+    else
+      result = test_op(clause->op, (val.ival > clause->dval) - (val.ival < clause->dval));
+    break;
+  case 'F': case 'D':
+    result = test_op(clause->op, (val.dval > clause->dval) - (val.dval < clause->dval));
+    break;
+  default:
+    if (clause->is_null)
+    {
+      int is_null = val.object == NULL && val.str == NULL;
+      result = clause->op == LJ_OP_EQ ? is_null : !is_null;
+    }
+    else if (val.str)
+    {
+      result = test_op(clause->op, strcmp(val.str, clause->sval));
+    }
+    else
+    {
+      /* a null string is different from any string constant */
+      result = clause->op == LJ_OP_NE;
+    }
+    break;
+  }
+
+  lj_operand_release(jni, &val);
+
+  return result;
+}
+
+int lj_breakpoint_check(lj_breakpoint *bp, JNIEnv *jni, jthread thread)
+{
+  int i;
+
+  for (i = 0; i < bp->clause_count; ++i)
+  {
+    if (!eval_clause(jni, thread, &bp->clauses[i]))
+      return 0;
+  }
+
+  lj_atomic_fetch_add64(&bp->hit_count, 1);
+
+  return 1;
+}
+
+/* Read the operand from a compiled clause table, see debuglib/condition.lua */
+static void parse_operand(lua_State *L, int idx, lj_operand *operand)
+{
+  const char *source;
+  const char *sig;
+
+  lua_getfield(L, idx, "source");
+  lua_getfield(L, idx, "sig");
+  source = lua_tostring(L, -2);
+  sig = lua_tostring(L, -1);
+  if (!source || !sig)
+    (void)lua_interface_error(L, "Operand must have a source and sig");
+
+  if (!strcmp(sig, "Ljava/lang/String;"))
+    operand->type = 'T';
+  else
+    operand->type = *sig;
+
+  if (!strcmp(source, "local"))
+  {
+    operand->source = LJ_OPERAND_LOCAL;
+    lua_getfield(L, idx, "slot");
+    operand->slot = luaL_checkinteger(L, -1);
+    lua_pop(L, 1);
+  }
+  else if (!strcmp(source, "field"))
+  {
+    operand->source = LJ_OPERAND_THIS_FIELD;
+    lua_getfield(L, idx, "field_id");
+    operand->field_id = ((lj_field_id *)luaL_checkudata(L, -1, "jfield_id"))->field_id;
+    lua_pop(L, 1);
+  }
+  else if (!strcmp(source, "thread_name"))
+  {
+    operand->source = LJ_OPERAND_THREAD_NAME;
+    operand->type = 'T';
+  }
+  else
+  {
+    (void)lua_interface_error(L, "Unknown operand source '%s'", source);
+  }
+
+  lua_pop(L, 2);
+}
+
+static lj_condition_op parse_op(lua_State *L, const char *op)
+{
+  if (!strcmp(op, "=="))
+    return LJ_OP_EQ;
+  else if (!strcmp(op, "~=") || !strcmp(op, "!="))
+    return LJ_OP_NE;
+  else if (!strcmp(op, "<"))
+    return LJ_OP_LT;
+  else if (!strcmp(op, "<="))
+    return LJ_OP_LE;
+  else if (!strcmp(op, ">"))
+    return LJ_OP_GT;
+  else if (!strcmp(op, ">="))
+    return LJ_OP_GE;
+  (void)lua_interface_error(L, "Unknown operator '%s'", op);
+  return LJ_OP_EQ;
+}
+
+/* Read an array of clause tables at `idx' into `bp'. On error `bp' is
+   freed by the pending breakpoint holding it. */
+static void parse_condition(lua_State *L, int idx, lj_breakpoint *bp)
+{
+  lj_condition_clause *clause;
+  int count;
+  int i;
+
+  luaL_checktype(L, idx, LUA_TTABLE);
+  for (count = 0; ; ++count)
+  {
+    lua_rawgeti(L, idx, count + 1);
+    if (lua_isnil(L, -1))
+      break;
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+  if (count == 0)
+    return;
+
+  bp->clauses = calloc(count, sizeof(lj_condition_clause));
+  if (!bp->clauses)
+    (void)luaL_error(L, "Out of memory");
+  bp->clause_count = count;
+
+  for (i = 0; i < count; ++i)
+  {
+    clause = &bp->clauses[i];
+    lua_rawgeti(L, idx, i + 1);
+    luaL_checktype(L, -1, LUA_TTABLE);
+
+    parse_operand(L, lua_gettop(L), &clause->operand);
+
+    lua_getfield(L, -1, "op");
+    clause->op = parse_op(L, luaL_checkstring(L, -1));
+    lua_pop(L, 1);
+
+    lua_getfield(L, -1, "value");
+    switch (lua_type(L, -1))
+    {
+    case LUA_TNIL:
+      if (clause->operand.type != 'L' && clause->operand.type != '[' && clause->operand.type != 'T')
+        (void)lua_interface_error(L, "Only objects can be compared with null");
+      if (clause->op != LJ_OP_EQ && clause->op != LJ_OP_NE)
+        (void)lua_interface_error(L, "null can only be compared with == or ~=");
+      clause->is_null = 1;
+      break;
+    case LUA_TBOOLEAN:
+      if (clause->operand.type == 'L' || clause->operand.type == '[' || clause->operand.type == 'T')
+        (void)lua_interface_error(L, "Only primitives can be compared with a boolean constant");
+      clause->ival = lua_toboolean(L, -1);
+      clause->dval = clause->ival;
+      break;
+    case LUA_TNUMBER:
+      if (clause->operand.type == 'L' || clause->operand.type == '[' || clause->operand.type == 'T')
+        (void)lua_interface_error(L, "Only primitives can be compared with a number constant");
+      clause->dval = lua_tonumber(L, -1);
+      clause->ival = (jlong)clause->dval;
+      break;
+    case LUA_TSTRING:
+      if (clause->operand.type != 'T')
+        (void)lua_interface_error(L, "Only strings can be compared with a string constant");
+      clause->sval = strdup(lua_tostring(L, -1));
+      if (!clause->sval)
+        (void)luaL_error(L, "Out of memory");
+      break;
+    default:
+      (void)lua_interface_error(L, "Invalid constant in condition");
+    }
+    lua_pop(L, 2);
+  }
+}
+
+/* Read an array of operand tables at `idx' into `bp' as the values
+   captured by a tracepoint */
+static void parse_captures(lua_State *L, int idx, lj_breakpoint *bp)
+{
+  int count;
+  int i;
+
+  luaL_checktype(L, idx, LUA_TTABLE);
+  for (count = 0; ; ++count)
+  {
+    lua_rawgeti(L, idx, count + 1);
+    if (lua_isnil(L, -1))
+      break;
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+  if (count > LJ_TRACE_MAX_VALUES)
+    (void)lua_interface_error(L, "At most %d values can be captured", LJ_TRACE_MAX_VALUES);
+
+  bp->kind = LJ_BREAKPOINT_TRACE;
+  if (count == 0)
+    return;
+
+  bp->captures = calloc(count, sizeof(lj_operand));
+  if (!bp->captures)
+    (void)luaL_error(L, "Out of memory");
+  bp->capture_count = count;
+
+  for (i = 0; i < count; ++i)
+  {
+    lua_rawgeti(L, idx, i + 1);
+    luaL_checktype(L, -1, LUA_TTABLE);
+    parse_operand(L, lua_gettop(L), &bp->captures[i]);
+    lua_pop(L, 1);
+  }
+}
+
+/* Lua wrappers for breakpoint operations */
+
+#define PENDING_BREAKPOINT "yellow_tree_pending_breakpoint"
+
+/* Frees a breakpoint that was being set when an error was raised */
+static int pending_breakpoint_gc(lua_State *L)
+{
+  lj_breakpoint **pending = luaL_checkudata(L, 1, PENDING_BREAKPOINT);
+  if (*pending)
+    free_breakpoint(*pending);
+  *pending = NULL;
+  return 0;
+}
+
+/* lj_set_breakpoint(method_id, location [, condition [, captures [, action]]])
+   Giving a (possibly empty) captures table makes a tracepoint */
+static int lj_set_breakpoint(lua_State *L)
+{
+  jmethodID method_id;
+  jlocation location;
+  lj_breakpoint *bp;
+  lj_breakpoint **pending;
+
+  method_id = *(jmethodID *)luaL_checkudata(L, 1, "jmethod_id");
+  location = luaL_checkinteger(L, 2);
+
+  /* parsing raises errors, until it's done the breakpoint is owned by
+     a userdata that frees it when collected */
+  lua_settop(L, 5);
+  pending = lua_newuserdata(L, sizeof(lj_breakpoint *));
+  *pending = NULL;
+  luaL_setmetatable(L, PENDING_BREAKPOINT);
+  bp = calloc(1, sizeof(lj_breakpoint));
+  if (!bp)
+    return luaL_error(L, "Out of memory");
+  *pending = bp;
+
+  bp->method_id = method_id;
+  bp->location = location;
+  bp->enabled = 1;
+  if (!lua_isnoneornil(L, 3))
+    parse_condition(L, 3, bp);
+  if (!lua_isnoneornil(L, 4))
+    parse_captures(L, 4, bp);
+  if (!lua_isnoneornil(L, 5))
+  {
+    bp->action = strdup(luaL_checkstring(L, 5));
+    if (!bp->action)
+      return luaL_error(L, "Out of memory");
+  }
+  *pending = NULL;
+  lua_settop(L, 0);
+
+  lj_err = (*current_jvmti())->SetBreakpoint(current_jvmti(), method_id, location);
+  if (lj_err != JVMTI_ERROR_NONE)
+    free_breakpoint(bp);
+  lj_check_jvmti_error(L);
+
+  lock_breakpoints();
+  bp->id = next_breakpoint_id++;
+  bp->refcount = 1;
+  bp->next = breakpoint_table[breakpoint_hash(method_id, location)];
+  lj_atomic_store_ptr((void *volatile *)&breakpoint_table[breakpoint_hash(method_id, location)], bp);
+  bp->id_next = breakpoints_by_id[bp->id & (BREAKPOINT_TABLE_SIZE - 1)];
+  breakpoints_by_id[bp->id & (BREAKPOINT_TABLE_SIZE - 1)] = bp;
+  unlock_breakpoints();
+
+  lua_pushinteger(L, bp->id);
+
+  return 1;
+}
+
+static int lj_clear_breakpoint(lua_State *L)
+{
+  jmethodID method_id;
+  jlocation location;
+  lj_breakpoint *bp;
+
+  method_id = *(jmethodID *)luaL_checkudata(L, 1, "jmethod_id");
+  location = luaL_checkinteger(L, 2);
+  lua_pop(L, 2);
+
+  lj_err = (*current_jvmti())->ClearBreakpoint(current_jvmti(), method_id, location);
+  lj_check_jvmti_error(L);
+
+  lock_breakpoints();
+  bp = find_breakpoint(method_id, location);
+  if (bp)
+  {
+    unlink_breakpoint(bp);
+    lj_atomic_fetch_add(&breakpoint_generation, 1);
+  }
+  unlock_breakpoints();
+
+  return 0;
+}
+
+static int lj_find_breakpoint(lua_State *L)
+{
+  jmethodID method_id;
+  jlocation location;
+  lj_breakpoint *bp;
+
+  method_id = *(jmethodID *)luaL_checkudata(L, 1, "jmethod_id");
+  location = luaL_checkinteger(L, 2);
+  lua_pop(L, 2);
+
+  lock_breakpoints();
+  bp = find_breakpoint(method_id, location);
+  if (bp)
+    lua_pushinteger(L, bp->id);
+  else
+    lua_pushnil(L);
+  unlock_breakpoints();
+
+  return 1;
+}
+
+static int lj_get_breakpoint_info(lua_State *L)
+{
+  jint id;
+  lj_breakpoint *bp;
+  lj_breakpoint copy;
+
+  id = luaL_checkinteger(L, 1);
+  lua_pop(L, 1);
+
+  lock_breakpoints();
+  bp = find_breakpoint_by_id(id);
+  if (bp)
+  {
+    copy = *bp;
+    copy.hit_count = lj_atomic_load64(&bp->hit_count);
+  }
+  unlock_breakpoints();
+
+  if (!bp)
+  {
+    lua_pushnil(L);
+    return 1;
+  }
+
+  lua_newtable(L);
+  lua_pushinteger(L, copy.id);
+  lua_setfield(L, -2, "id");
+  new_jmethod_id(L, copy.method_id);
+  lua_setfield(L, -2, "method_id_raw");
+  lua_pushinteger(L, copy.location);
+  lua_setfield(L, -2, "location");
+  lua_pushboolean(L, copy.enabled);
+  lua_setfield(L, -2, "enabled");
+  lua_pushboolean(L, copy.clause_count > 0);
+  lua_setfield(L, -2, "conditional");
+  lua_pushboolean(L, copy.kind == LJ_BREAKPOINT_TRACE);
+  lua_setfield(L, -2, "trace");
+  lua_pushboolean(L, copy.action != NULL);
+  lua_setfield(L, -2, "has_action");
+  lua_pushinteger(L, copy.hit_count);
+  lua_setfield(L, -2, "hit_count");
+
+  return 1;
+}
+
+static int lj_set_breakpoint_enabled(lua_State *L)
+{
+  jint id;
+  int enabled;
+  lj_breakpoint *bp;
+
+  id = luaL_checkinteger(L, 1);
+  luaL_checktype(L, 2, LUA_TBOOLEAN);
+  enabled = lua_toboolean(L, 2);
+  lua_pop(L, 2);
+
+  lock_breakpoints();
+  bp = find_breakpoint_by_id(id);
+  if (bp)
+    bp->enabled = enabled;
+  unlock_breakpoints();
+
+  if (!bp)
+    (void)lua_interface_error(L, "Unknown breakpoint id %d", id);
+
+  return 0;
+}
+
+void lj_breakpoint_register(lua_State *L)
+{
+  /* created once, this is also called for worker states */
+  if (!breakpoint_lock)
+  {
+    lj_err = (*current_jvmti())->CreateRawMonitor(current_jvmti(), "yellow_tree_breakpoint_lock", &breakpoint_lock);
+    lj_check_jvmti_error(L);
+  }
+
+  if (luaL_newmetatable(L, PENDING_BREAKPOINT))
+  {
+    lua_pushcfunction(L, pending_breakpoint_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_pop(L, 1);
+
+  lua_register(L, "lj_set_breakpoint",             lj_set_breakpoint);
+  lua_register(L, "lj_clear_breakpoint",           lj_clear_breakpoint);
+  lua_register(L, "lj_find_breakpoint",            lj_find_breakpoint);
+  lua_register(L, "lj_get_breakpoint_info",        lj_get_breakpoint_info);
+  lua_register(L, "lj_set_breakpoint_enabled",     lj_set_breakpoint_enabled);
+}
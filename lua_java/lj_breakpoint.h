@@ -0,0 +1,100 @@
+#ifndef LJ_BREAKPOINT_H_
+#define LJ_BREAKPOINT_H_
+
+#include <stdint.h>
+
+#include "lua_java.h"
+
+/* Where a value examined at a breakpoint comes from */
+typedef enum {
+  LJ_OPERAND_LOCAL,             /* local variable in the breakpoint frame */
+  LJ_OPERAND_THIS_FIELD,        /* instance field of `this' */
+  LJ_OPERAND_THREAD_NAME        /* name of the thread hitting the breakpoint */
+} lj_operand_source;
+
+typedef struct {
+  lj_operand_source source;
+  jint slot;
+  jfieldID field_id;
+  /* first char of the signature, or 'T' for java.lang.String */
+  char type;
+} lj_operand;
+
+/* A value read from an operand, see lj_operand_read() */
+typedef struct {
+  jlong ival;
+  jdouble dval;
+  jobject object;
+  const char *str;
+  /* for releasing `str' */
+  jstring string_ref;
+  char *jvmti_str;
+} lj_operand_value;
+
+typedef enum {
+  LJ_OP_EQ, LJ_OP_NE, LJ_OP_LT, LJ_OP_LE, LJ_OP_GT, LJ_OP_GE
+} lj_condition_op;
+
+/* One clause of a breakpoint condition, comparing an operand to a
+   constant. All clauses of a condition must be true. */
+typedef struct {
+  lj_operand operand;
+  lj_condition_op op;
+  int is_null;                  /* compare an object against null */
+  jlong ival;
+  jdouble dval;
+  char *sval;
+} lj_condition_clause;
+
+typedef enum {
+  LJ_BREAKPOINT_STOP,           /* call into Lua, usually suspending the thread */
+  LJ_BREAKPOINT_TRACE           /* record captures in the trace log and continue */
+} lj_breakpoint_kind;
+
+/* A breakpoint installed through lj_set_breakpoint(). Entries live in
+   a hash table keyed by (method_id, location) so the JVMTI callback
+   can find them without entering Lua. The `id' is the handle that is
+   passed to Lua. */
+typedef struct lj_breakpoint {
+  jint id;
+  jmethodID method_id;
+  jlocation location;
+  volatile int enabled;
+  volatile int64_t hit_count;
+  lj_breakpoint_kind kind;
+
+  /* condition and captures are fixed when the breakpoint is set */
+  int clause_count;
+  lj_condition_clause *clauses;
+  int capture_count;
+  lj_operand *captures;
+  /* Lua code run in a worker state, see lj_worker.c */
+  char *action;
+
+  /* private to lj_breakpoint.c */
+  volatile uint32_t refcount;   /* one is held by the table until cleared */
+  struct lj_breakpoint *volatile next;
+  struct lj_breakpoint *id_next;
+} lj_breakpoint;
+
+/* Find an enabled breakpoint without locking. The result must be given
+   back with lj_breakpoint_release(). NULL if there is no breakpoint at
+   the location or it is disabled. */
+lj_breakpoint *lj_breakpoint_acquire(jmethodID method_id, jlocation location);
+/* Evaluate the breakpoint condition on the thread that hit it and
+   count the hit if it is true. */
+int lj_breakpoint_check(lj_breakpoint *bp, JNIEnv *jni, jthread thread);
+void lj_breakpoint_release(lj_breakpoint *bp);
+
+/* Changes whenever a breakpoint is cleared, so caches keyed by
+   breakpoint id can drop entries of cleared breakpoints. Ids are never
+   reused so new breakpoints don't change it. */
+uint32_t lj_breakpoint_generation();
+
+/* Read an operand in the top frame of `thread'. Returns 0 if the value
+   is not available. A successful read must be followed by
+   lj_operand_release(). */
+int lj_operand_read(JNIEnv *jni, jthread thread, const lj_operand *operand, lj_operand_value *val);
+void lj_operand_release(JNIEnv *jni, lj_operand_value *val);
+
+#endif /* LJ_BREAKPOINT_H_ */
@@ -4,7 +4,9 @@
 #include "lua_java.h"
 #include "java_bridge.h"
 #include "lj_internal.h"
+#include "lj_tag.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 /* Lua wrappers for class operations */
@@ -147,17 +149,31 @@ static int lj_get_loaded_classes(lua_State *L)
   return 1;
 }
 
-/* This value is used to tag all objects visited. It is then
-   incremented for the next iteration. We need to tag all items and
-   then retrieve them. There is no reason/method to clear all tags so
-   we increment the number so it's different next time. It's
-   *possible* that if you used this method (max jlong) times that
-   there may be objects leftover with an old tag.
- */
-static jlong class_instances_search_tag = 1000;
+/* instances already tagged by someone else keep their tag and are
+   found by it */
+typedef struct {
+  jlong *tags;                  /* the search tag, then the others */
+  jint count;
+  jint capacity;
+  int out_of_memory;
+} instance_search;
 
 static jint heap_iter_tag_item(jlong class_tag, jlong size, jlong* tag_ptr, jint length, void* user_data) {
-  *tag_ptr = class_instances_search_tag;
+  instance_search *search = user_data;
+  if (!*tag_ptr) {
+	*tag_ptr = search->tags[0];
+  } else if (*tag_ptr != search->tags[0]) {
+	if (search->count == search->capacity) {
+	  jlong *tags = realloc(search->tags, search->capacity * 2 * sizeof(jlong));
+	  if (!tags) {
+		search->out_of_memory = 1;
+		return JVMTI_VISIT_ABORT;
+	  }
+	  search->tags = tags;
+	  search->capacity *= 2;
+	}
+	search->tags[search->count++] = *tag_ptr;
+  }
   return 0;
 }
 
@@ -165,34 +181,62 @@ static int lj_get_class_instances(lua_State *L) {
   jclass class;
   jvmtiHeapCallbacks callbacks;
   JNIEnv *jni = current_jni();
-  jobject *obj_output;
-  jlong *tag_output;
-  jint output_count;
+  jobject *obj_output = NULL;
+  jlong *tag_output = NULL;
+  jint output_count = 0;
+  instance_search search;
+  jlong tag;
+  int count = 0;
   int i;
 
   class = *(jclass *)luaL_checkudata(L, 1, "jobject");
   lua_pop(L, 1);
 
-  /* get a new tag for this search */
-  class_instances_search_tag++;
+  /* get a tag for this search */
+  tag = lj_tag_range_acquire("class_instances");
+  if (!tag)
+	return luaL_error(L, "All object tags are in use");
 
+  search.capacity = 64;
+  search.tags = malloc(search.capacity * sizeof(jlong));
+  if (!search.tags) {
+	lj_tag_range_release(tag, NULL, 0);
+	return luaL_error(L, "Out of memory");
+  }
+  search.tags[0] = tag;
+  search.count = 1;
+  search.out_of_memory = 0;
   memset(&callbacks, 0, sizeof(jvmtiHeapCallbacks));
   callbacks.heap_iteration_callback = &heap_iter_tag_item;
 
-  lj_err = (*current_jvmti())->IterateThroughHeap(current_jvmti(), 0, class, &callbacks, L);
-  lj_check_jvmti_error(L);
-
+  lj_err = (*current_jvmti())->IterateThroughHeap(current_jvmti(), 0, class, &callbacks, &search);
+  if (lj_err == JVMTI_ERROR_NONE && search.out_of_memory)
+	lj_err = JVMTI_ERROR_OUT_OF_MEMORY;
   /* get all tagged objects */
-  lj_err = (*current_jvmti())->GetObjectsWithTags(current_jvmti(), 1, &class_instances_search_tag, &output_count, &obj_output, &tag_output);
+  if (lj_err == JVMTI_ERROR_NONE)
+	lj_err = (*current_jvmti())->GetObjectsWithTags(current_jvmti(), search.count, search.tags,
+													&output_count, &obj_output, &tag_output);
+  free(search.tags);
+  if (lj_err != JVMTI_ERROR_NONE)
+	lj_tag_range_release(tag, class, 1);
   lj_check_jvmti_error(L);
 
-  /* add it to the result */
+  /* add it to the result, clearing the tags on the way */
   lua_createtable(L, output_count, 0);
   for (i = 0; i < output_count; ++i) {
+	if (tag_output[i] == tag) {
+	  (*current_jvmti())->SetTag(current_jvmti(), obj_output[i], 0);
+	} else if (!(*jni)->IsInstanceOf(jni, obj_output[i], class)) {
+	  /* another object with the same tag */
+	  (*jni)->DeleteLocalRef(jni, obj_output[i]);
+	  continue;
+	}
 	new_jobject(L, (*jni)->NewGlobalRef(jni, obj_output[i]));
 	EXCEPTION_CHECK(jni);
-	lua_rawseti(L, -2, i + 1);
+	(*jni)->DeleteLocalRef(jni, obj_output[i]);
+	lua_rawseti(L, -2, ++count);
   }
+  lj_tag_range_release(tag, NULL, 0);
 
   if (obj_output)
 	free_jvmti_refs(current_jvmti(), obj_output, tag_output, (void *)-1);
@@ -0,0 +1,155 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "myjni.h"
+#include "jni_util.h"
+#include "lua_interface.h"
+#include "lua_java.h"
+#include "java_bridge.h"
+#include "lj_internal.h"
+#include "lj_atomic.h"
+#include "lj_context.h"
+
+/* from lua_java.c */
+extern JavaVM *lj_jvm;
+
+/* The context is allocated on first use in a thread and freed by
+   lj_context_thread_end() when the thread ends. */
+static LJ_THREAD_LOCAL lj_context *thread_context;
+
+/* enough for jvalue, the arena buffer is at the start of the context */
+#define ARENA_ALIGN 8
+
+lj_context *lj_get_context()
+{
+  lj_context *ctx = thread_context;
+  JNIEnv *jni;
+  jint ret;
+
+  if (ctx)
+    return ctx;
+
+  ret = (*lj_jvm)->GetEnv(lj_jvm, (void **)&jni, JNI_VERSION_1_6);
+  if (ret == JNI_EDETACHED)
+    ret = (*lj_jvm)->AttachCurrentThread(lj_jvm, (void **)&jni, NULL);
+  assert(ret == JNI_OK);
+
+  ctx = calloc(1, sizeof(lj_context));
+  if (!ctx)
+    (*jni)->FatalError(jni, "Out of memory allocating the agent thread context");
+  ctx->jni = jni;
+
+  thread_context = ctx;
+  return ctx;
+}
+
+void lj_context_thread_end()
+{
+  lj_context *ctx = thread_context;
+  lj_arena_block *block;
+
+  if (!ctx)
+    return;
+
+  if (ctx->thread)
+    (*ctx->jni)->DeleteGlobalRef(ctx->jni, ctx->thread);
+  while (ctx->arena.overflow)
+  {
+    block = ctx->arena.overflow;
+    ctx->arena.overflow = block->next;
+    free(block);
+  }
+  thread_context = NULL;
+  free(ctx);
+}
+
+void lj_context_begin_event(lj_context_saved *saved, JNIEnv *jni, jthread thread, jvmtiEvent event)
+{
+  lj_context *ctx = lj_get_context();
+
+  saved->event_thread = ctx->event_thread;
+  saved->event = ctx->event;
+  saved->mark = lj_arena_get_mark();
+  saved->event_mark = ctx->event_mark;
+
+  ctx->jni = jni;
+  ctx->event_thread = thread;
+  ctx->event = event;
+  ctx->event_depth++;
+  ctx->event_mark = saved->mark;
+}
+
+void lj_context_end_event(lj_context_saved *saved)
+{
+  lj_context *ctx = lj_get_context();
+
+  lj_arena_release(saved->mark);
+
+  ctx->event_thread = saved->event_thread;
+  ctx->event = saved->event;
+  ctx->event_depth--;
+  ctx->event_mark = saved->event_mark;
+}
+
+void *lj_arena_alloc(size_t size)
+{
+  lj_arena *arena = &lj_get_context()->arena;
+  lj_arena_block *block;
+  void *p;
+
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  if (arena->used + size <= LJ_ARENA_SIZE)
+  {
+    p = arena->buf + arena->used;
+    arena->used += size;
+    return p;
+  }
+
+  /* header is padded to keep the alignment */
+  block = malloc(ARENA_ALIGN + size);
+  if (!block)
+    return NULL;
+  block->next = arena->overflow;
+  arena->overflow = block;
+  return (char *)block + ARENA_ALIGN;
+}
+
+lj_arena_mark lj_arena_get_mark()
+{
+  lj_arena *arena = &lj_get_context()->arena;
+  lj_arena_mark mark;
+  mark.used = arena->used;
+  mark.overflow = arena->overflow;
+  return mark;
+}
+
+void lj_arena_release(lj_arena_mark mark)
+{
+  lj_arena *arena = &lj_get_context()->arena;
+  lj_arena_block *block;
+
+  while (arena->overflow != mark.overflow)
+  {
+    block = arena->overflow;
+    arena->overflow = block->next;
+    free(block);
+  }
+  arena->used = mark.used;
+}
+
+void lj_arena_reset()
+{
+  lj_arena_release(lj_get_context()->event_mark);
+}
+
+/* lj_reset_arena() is called by the command loops after each command */
+static int lj_reset_arena(lua_State *L)
+{
+  lj_arena_reset();
+  return 0;
+}
+
+void lj_context_register(lua_State *L)
+{
+  lua_register(L, "lj_reset_arena",                lj_reset_arena);
+}
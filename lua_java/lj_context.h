@@ -0,0 +1,71 @@
+#ifndef LJ_CONTEXT_H_
+#define LJ_CONTEXT_H_
+
+#include <stddef.h>
+
+#include "lua_java.h"
+
+/* Scratch memory for the current thread. Allocations are released
+   together, when the event they were made in ends, by
+   lj_arena_release() or by lj_arena_reset() between commands. A Lua
+   error can skip lj_arena_release(), the memory is then reclaimed at
+   the next of these boundaries. */
+#define LJ_ARENA_SIZE 8192
+
+typedef struct lj_arena_block {
+  struct lj_arena_block *next;
+} lj_arena_block;
+
+typedef struct {
+  char buf[LJ_ARENA_SIZE];      /* must be first, for alignment */
+  size_t used;
+  /* allocations that don't fit in `buf', most recent first */
+  lj_arena_block *overflow;
+} lj_arena;
+
+typedef struct {
+  size_t used;
+  lj_arena_block *overflow;
+} lj_arena_mark;
+
+/* Per-thread state of the agent, created on first use */
+typedef struct {
+  lj_arena arena;               /* must be first, for alignment */
+  JNIEnv *jni;
+  /* thread of the active event, a local reference valid until the
+     event ends */
+  jthread event_thread;
+  /* the active event or 0 */
+  jvmtiEvent event;
+  /* global reference from Thread.currentThread(), used outside events */
+  jthread thread;
+  int event_depth;
+  /* arena in use when the active event began, empty outside events */
+  lj_arena_mark event_mark;
+} lj_context;
+
+/* state saved by lj_context_begin_event() for nested events */
+typedef struct {
+  jthread event_thread;
+  jvmtiEvent event;
+  lj_arena_mark mark;
+  lj_arena_mark event_mark;
+} lj_context_saved;
+
+lj_context *lj_get_context();
+/* Free the calling thread's context, called when the thread ends after
+   everything else that may use it */
+void lj_context_thread_end();
+
+void lj_context_begin_event(lj_context_saved *saved, JNIEnv *jni, jthread thread, jvmtiEvent event);
+void lj_context_end_event(lj_context_saved *saved);
+
+void *lj_arena_alloc(size_t size);
+lj_arena_mark lj_arena_get_mark();
+void lj_arena_release(lj_arena_mark mark);
+/* Release everything allocated since the active event began, or the
+   whole arena outside events. Only for points where no C code of the
+   event is using the arena, eg. between commands. */
+void lj_arena_reset();
+
+#endif /* LJ_CONTEXT_H_ */
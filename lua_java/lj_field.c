@@ -9,6 +9,33 @@
 
 /* Lua wrappers for field operations */
 
+static void set_field_type(lj_field_id *field_id, const char *sig, jint modifiers)
+{
+  field_id->type = (*sig == '[') ? 'L' : *sig;
+  field_id->is_static = (modifiers & JVM_ACC_STATIC) != 0;
+  field_id->modifiers = modifiers;
+}
+
+jvmtiError lj_resolve_field_id(lj_field_id *field_id)
+{
+  jvmtiError err;
+  jint modifiers;
+  char *sig = NULL;
+
+  if (field_id->type)
+    return JVMTI_ERROR_NONE;
+
+  err = (*current_jvmti())->GetFieldName(current_jvmti(), field_id->class, field_id->field_id, NULL, &sig, NULL);
+  if (err != JVMTI_ERROR_NONE)
+    return err;
+  err = (*current_jvmti())->GetFieldModifiers(current_jvmti(), field_id->class, field_id->field_id, &modifiers);
+  if (err == JVMTI_ERROR_NONE)
+    set_field_type(field_id, sig, modifiers);
+  free_jvmti_refs(current_jvmti(), sig, (void *)-1);
+
+  return err;
+}
+
 static int lj_get_field_id(lua_State *L)
 {
   JNIEnv *jni = current_jni();
@@ -108,13 +135,8 @@ static int lj_get_field_modifiers(lua_State *L)
   return 1;
 }
 
-static int lj_get_field_modifiers_table(lua_State *L)
+static void push_modifiers_table(lua_State *L, lua_Integer modifiers)
 {
-  lua_Integer modifiers;
-
-  modifiers = luaL_checkinteger(L, 1);
-  lua_pop(L, 1);
-
   /* do all this in C because there are no bitwise ops in Lua */
   lua_newtable(L);
 
@@ -137,6 +159,50 @@ static int lj_get_field_modifiers_table(lua_State *L)
   lua_setfield(L, -2, "synthetic");
   lua_pushboolean(L, modifiers & JVM_ACC_ENUM);
   lua_setfield(L, -2, "enum");
+}
+
+static int lj_get_field_modifiers_table(lua_State *L)
+{
+  lua_Integer modifiers;
+
+  modifiers = luaL_checkinteger(L, 1);
+  lua_pop(L, 1);
+
+  push_modifiers_table(L, modifiers);
+
+  return 1;
+}
+
+/* lj_get_field_info(field_id) returns the name, signature and
+   modifiers of a field, also saving the type in `field_id' */
+static int lj_get_field_info(lua_State *L)
+{
+  lj_field_id *field_id;
+  char *field_name = NULL;
+  char *sig = NULL;
+  jint modifiers;
+
+  field_id = (lj_field_id *)luaL_checkudata(L, 1, "jfield_id");
+  lua_pop(L, 1);
+
+  lj_err = (*current_jvmti())->GetFieldName(current_jvmti(), field_id->class, field_id->field_id, &field_name, &sig, NULL);
+  lj_check_jvmti_error(L);
+  lj_err = (*current_jvmti())->GetFieldModifiers(current_jvmti(), field_id->class, field_id->field_id, &modifiers);
+  if (lj_err != JVMTI_ERROR_NONE)
+    free_jvmti_refs(current_jvmti(), field_name, sig, (void *)-1);
+  lj_check_jvmti_error(L);
+
+  set_field_type(field_id, sig, modifiers);
+
+  lua_newtable(L);
+  lua_pushstring(L, field_name);
+  lua_setfield(L, -2, "name");
+  lua_pushstring(L, sig);
+  lua_setfield(L, -2, "sig");
+  push_modifiers_table(L, modifiers);
+  lua_setfield(L, -2, "modifiers");
+
+  free_jvmti_refs(current_jvmti(), field_name, sig, (void *)-1);
 
   return 1;
 }
@@ -148,4 +214,5 @@ void lj_field_register(lua_State *L)
   lua_register(L, "lj_get_field_declaring_class",  lj_get_field_declaring_class);
   lua_register(L, "lj_get_field_modifiers",        lj_get_field_modifiers);
   lua_register(L, "lj_get_field_modifiers_table",  lj_get_field_modifiers_table);
+  lua_register(L, "lj_get_field_info",             lj_get_field_info);
 }
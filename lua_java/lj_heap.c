@@ -0,0 +1,630 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "myjni.h"
+#include "jni_util.h"
+#include "lua_interface.h"
+#include "lua_java.h"
+#include "java_bridge.h"
+#include "lj_internal.h"
+#include "lj_tag.h"
+#include "lj_heap.h"
+
+/* Heap histograms: instance count and shallow size of each class.
+
+   Every loaded class is tagged with base + its index in the class list
+   from a tag range, then a single IterateThroughHeap pass adds each
+   object to the counters of its class by the class tag. Objects of
+   classes loaded during the pass have no class tag and are only
+   included in the totals.
+
+   Histograms can be saved as named snapshots, kept as arrays sorted by
+   class name so two snapshots are compared with a single merge. Classes
+   with the same name from different loaders are combined. Snapshots are
+   shared by all Lua states and accessed while holding `snapshot_lock'. */
+
+#define HEAP_HISTOGRAM_DEFAULT_TOP 20
+
+typedef struct {
+  char *name;                   /* eg. java.lang.String or [I */
+  jlong count;
+  jlong bytes;
+} heap_class_stats;
+
+typedef struct {
+  heap_class_stats *classes;
+  jint class_count;
+  jlong total_count;
+  jlong total_bytes;
+} heap_histogram;
+
+typedef struct heap_snapshot {
+  char *name;
+  heap_histogram histo;         /* sorted by class name */
+  struct heap_snapshot *next;
+} heap_snapshot;
+
+/* difference of a class between two snapshots */
+typedef struct {
+  const char *name;
+  jlong count;
+  jlong bytes;
+  jlong count_delta;
+  jlong bytes_delta;
+} heap_class_delta;
+
+static heap_snapshot *snapshots;
+static jrawMonitorID snapshot_lock;
+
+typedef struct {
+  jlong base;
+  jint class_count;
+  jlong *counts;
+  jlong *bytes;
+  jlong total_count;
+  jlong total_bytes;
+} histogram_pass;
+
+static jint heap_iter_count_item(jlong class_tag, jlong size, jlong *tag_ptr, jint length, void *user_data)
+{
+  histogram_pass *pass = user_data;
+  jlong index = class_tag - pass->base;
+
+  if (index >= 0 && index < pass->class_count)
+  {
+    pass->counts[index]++;
+    pass->bytes[index] += size;
+  }
+  pass->total_count++;
+  pass->total_bytes += size;
+  return 0;
+}
+
+char *lj_class_display_name(const char *sig)
+{
+  char *name;
+  char *p;
+
+  name = strdup(sig[0] == 'L' ? sig + 1 : sig);
+  if (!name)
+    return NULL;
+  if (sig[0] == 'L')
+    name[strlen(name) - 1] = 0;
+  for (p = name; *p; ++p)
+    if (*p == '/')
+      *p = '.';
+  return name;
+}
+
+static void free_histogram(heap_histogram *histo)
+{
+  jint i;
+  for (i = 0; i < histo->class_count; ++i)
+    free(histo->classes[i].name);
+  free(histo->classes);
+  histo->classes = NULL;
+  histo->class_count = 0;
+}
+
+/* Fill `histo' with the classes that have instances, tagging the
+   classes from the range at `base' */
+static jvmtiError collect_histogram(heap_histogram *histo, jlong base)
+{
+  jvmtiEnv *jvmti = current_jvmti();
+  JNIEnv *jni = current_jni();
+  jvmtiHeapCallbacks callbacks;
+  histogram_pass pass;
+  jclass *classes = NULL;
+  jint class_count = 0;
+  jlong *old_tags;
+  char *sig;
+  jvmtiError err;
+  jint i;
+
+  memset(histo, 0, sizeof(heap_histogram));
+  memset(&pass, 0, sizeof(histogram_pass));
+
+  pass.base = base;
+  err = (*jvmti)->GetLoadedClasses(jvmti, &class_count, &classes);
+  if (err != JVMTI_ERROR_NONE)
+    return err;
+
+  /* classes tagged by someone else get their tag back afterwards */
+  old_tags = calloc(class_count ? class_count : 1, sizeof(jlong));
+  pass.class_count = class_count;
+  pass.counts = calloc(class_count ? class_count : 1, sizeof(jlong));
+  pass.bytes = calloc(class_count ? class_count : 1, sizeof(jlong));
+  if (!old_tags || !pass.counts || !pass.bytes)
+  {
+    free(old_tags);
+    free(pass.counts);
+    free(pass.bytes);
+    for (i = 0; i < class_count; ++i)
+      (*jni)->DeleteLocalRef(jni, classes[i]);
+    free_jvmti_refs(jvmti, classes, (void *)-1);
+    return JVMTI_ERROR_OUT_OF_MEMORY;
+  }
+  for (i = 0; i < class_count; ++i)
+  {
+    (*jvmti)->GetTag(jvmti, classes[i], &old_tags[i]);
+    (*jvmti)->SetTag(jvmti, classes[i], pass.base + i);
+  }
+
+  memset(&callbacks, 0, sizeof(jvmtiHeapCallbacks));
+  callbacks.heap_iteration_callback = &heap_iter_count_item;
+  err = (*jvmti)->IterateThroughHeap(jvmti, 0, NULL, &callbacks, &pass);
+
+  if (err == JVMTI_ERROR_NONE)
+  {
+    histo->classes = malloc(sizeof(heap_class_stats) * (class_count ? class_count : 1));
+    if (!histo->classes)
+      err = JVMTI_ERROR_OUT_OF_MEMORY;
+    histo->total_count = pass.total_count;
+    histo->total_bytes = pass.total_bytes;
+  }
+
+  /* the class tags are restored directly */
+  for (i = 0; i < class_count; ++i)
+  {
+    if (err == JVMTI_ERROR_NONE && pass.counts[i] > 0 &&
+        (*jvmti)->GetClassSignature(jvmti, classes[i], &sig, NULL) == JVMTI_ERROR_NONE)
+    {
+      histo->classes[histo->class_count].name = lj_class_display_name(sig);
+      histo->classes[histo->class_count].count = pass.counts[i];
+      histo->classes[histo->class_count].bytes = pass.bytes[i];
+      if (histo->classes[histo->class_count].name)
+        histo->class_count++;
+      else
+        err = JVMTI_ERROR_OUT_OF_MEMORY;
+      free_jvmti_refs(jvmti, sig, (void *)-1);
+    }
+    (*jvmti)->SetTag(jvmti, classes[i], old_tags[i]);
+    (*jni)->DeleteLocalRef(jni, classes[i]);
+  }
+
+  free(old_tags);
+  free(pass.counts);
+  free(pass.bytes);
+  free_jvmti_refs(jvmti, classes, (void *)-1);
+  if (err != JVMTI_ERROR_NONE)
+    free_histogram(histo);
+
+  return err;
+}
+
+static int compare_bytes(const void *a, const void *b)
+{
+  const heap_class_stats *c1 = a;
+  const heap_class_stats *c2 = b;
+  if (c1->bytes != c2->bytes)
+    return c1->bytes > c2->bytes ? -1 : 1;
+  if (c1->count != c2->count)
+    return c1->count > c2->count ? -1 : 1;
+  return strcmp(c1->name, c2->name);
+}
+
+/* lj_heap_histogram(top) returns the `top' classes by shallow size:
+     {{name=, count=, bytes=}, ..., total_count=, total_bytes=, class_count=}
+   All classes are returned if `top' is 0. */
+static int lj_heap_histogram(lua_State *L)
+{
+  heap_histogram histo;
+  jlong base;
+  int top;
+  int i;
+
+  top = luaL_optinteger(L, 1, HEAP_HISTOGRAM_DEFAULT_TOP);
+  lua_settop(L, 0);
+
+  base = lj_tag_range_acquire("heap_histogram");
+  if (!base)
+    return luaL_error(L, "All object tags are in use");
+  lj_err = collect_histogram(&histo, base);
+  lj_tag_range_release(base, NULL, 0);
+  lj_check_jvmti_error(L);
+
+  qsort(histo.classes, histo.class_count, sizeof(heap_class_stats), compare_bytes);
+  if (top <= 0 || top > histo.class_count)
+    top = histo.class_count;
+
+  lua_createtable(L, top, 3);
+  for (i = 0; i < top; ++i)
+  {
+    lua_createtable(L, 0, 3);
+    lua_pushstring(L, histo.classes[i].name);
+    lua_setfield(L, -2, "name");
+    lua_pushnumber(L, (lua_Number)histo.classes[i].count);
+    lua_setfield(L, -2, "count");
+    lua_pushnumber(L, (lua_Number)histo.classes[i].bytes);
+    lua_setfield(L, -2, "bytes");
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_pushnumber(L, (lua_Number)histo.total_count);
+  lua_setfield(L, -2, "total_count");
+  lua_pushnumber(L, (lua_Number)histo.total_bytes);
+  lua_setfield(L, -2, "total_bytes");
+  lua_pushinteger(L, histo.class_count);
+  lua_setfield(L, -2, "class_count");
+
+  free_histogram(&histo);
+
+  return 1;
+}
+
+static void lock_snapshots()
+{
+  jvmtiError err = (*current_jvmti())->RawMonitorEnter(current_jvmti(), snapshot_lock);
+  assert(err == JVMTI_ERROR_NONE);
+  (void)err;
+}
+
+static void unlock_snapshots()
+{
+  jvmtiError err = (*current_jvmti())->RawMonitorExit(current_jvmti(), snapshot_lock);
+  assert(err == JVMTI_ERROR_NONE);
+  (void)err;
+}
+
+static int compare_name(const void *a, const void *b)
+{
+  return strcmp(((const heap_class_stats *)a)->name, ((const heap_class_stats *)b)->name);
+}
+
+/* Sort by name and combine classes with the same name */
+static void sort_by_name(heap_histogram *histo)
+{
+  jint i;
+  jint j = 0;
+
+  qsort(histo->classes, histo->class_count, sizeof(heap_class_stats), compare_name);
+  for (i = 1; i < histo->class_count; ++i)
+  {
+    if (!strcmp(histo->classes[i].name, histo->classes[j].name))
+    {
+      histo->classes[j].count += histo->classes[i].count;
+      histo->classes[j].bytes += histo->classes[i].bytes;
+      free(histo->classes[i].name);
+    }
+    else
+    {
+      histo->classes[++j] = histo->classes[i];
+    }
+  }
+  if (histo->class_count > 0)
+    histo->class_count = j + 1;
+}
+
+/* Collect a histogram sorted by name, raises a Lua error on failure */
+static void collect_sorted_histogram(lua_State *L, heap_histogram *histo)
+{
+  jlong base;
+
+  base = lj_tag_range_acquire("heap_histogram");
+  if (!base)
+    luaL_error(L, "All object tags are in use");
+  lj_err = collect_histogram(histo, base);
+  lj_tag_range_release(base, NULL, 0);
+  lj_check_jvmti_error(L);
+
+  sort_by_name(histo);
+}
+
+/* must be called with snapshot_lock held */
+static heap_snapshot **find_snapshot(const char *name)
+{
+  heap_snapshot **p = &snapshots;
+  while (*p && strcmp((*p)->name, name))
+    p = &(*p)->next;
+  return p;
+}
+
+static void free_snapshot(heap_snapshot *snap)
+{
+  free_histogram(&snap->histo);
+  free(snap->name);
+  free(snap);
+}
+
+/* lj_heap_snapshot(name) saves a histogram of the heap as `name',
+   replacing any snapshot with that name. Returns the number of classes,
+   instances and bytes. */
+static int lj_heap_snapshot(lua_State *L)
+{
+  heap_snapshot *snap;
+  heap_snapshot *old;
+  heap_snapshot **p;
+  heap_histogram histo;
+  const char *name;
+
+  name = luaL_checkstring(L, 1);
+
+  collect_sorted_histogram(L, &histo);
+  snap = calloc(1, sizeof(heap_snapshot));
+  if (snap)
+    snap->name = strdup(name);
+  if (!snap || !snap->name)
+  {
+    free(snap);
+    free_histogram(&histo);
+    return luaL_error(L, "Out of memory");
+  }
+  snap->histo = histo;
+
+  lock_snapshots();
+  p = find_snapshot(name);
+  old = *p;
+  if (old)
+  {
+    snap->next = old->next;
+    *p = snap;
+  }
+  else
+  {
+    snap->next = snapshots;
+    snapshots = snap;
+  }
+  unlock_snapshots();
+  if (old)
+    free_snapshot(old);
+
+  lua_settop(L, 0);
+  lua_pushinteger(L, histo.class_count);
+  lua_pushnumber(L, (lua_Number)histo.total_count);
+  lua_pushnumber(L, (lua_Number)histo.total_bytes);
+
+  return 3;
+}
+
+/* lj_heap_drop_snapshot(name) */
+static int lj_heap_drop_snapshot(lua_State *L)
+{
+  heap_snapshot *snap;
+  heap_snapshot **p;
+  const char *name;
+
+  name = luaL_checkstring(L, 1);
+
+  lock_snapshots();
+  p = find_snapshot(name);
+  snap = *p;
+  if (snap)
+    *p = snap->next;
+  unlock_snapshots();
+
+  lua_pop(L, 1);
+  lua_pushboolean(L, snap != NULL);
+  if (snap)
+    free_snapshot(snap);
+
+  return 1;
+}
+
+/* lj_heap_snapshots() returns {{name=, class_count=, total_count=, total_bytes=}, ...} */
+static int lj_heap_snapshots(lua_State *L)
+{
+  heap_snapshot *snap;
+  int count = 0;
+  int i = 0;
+
+  lock_snapshots();
+  for (snap = snapshots; snap; snap = snap->next)
+    count++;
+  /* only tables of a known size are created while the lock is held,
+     the snapshots can't change */
+  lua_createtable(L, count, 0);
+  for (snap = snapshots; snap; snap = snap->next)
+  {
+    lua_createtable(L, 0, 4);
+    lua_pushstring(L, snap->name);
+    lua_setfield(L, -2, "name");
+    lua_pushinteger(L, snap->histo.class_count);
+    lua_setfield(L, -2, "class_count");
+    lua_pushnumber(L, (lua_Number)snap->histo.total_count);
+    lua_setfield(L, -2, "total_count");
+    lua_pushnumber(L, (lua_Number)snap->histo.total_bytes);
+    lua_setfield(L, -2, "total_bytes");
+    lua_rawseti(L, -2, ++i);
+  }
+  unlock_snapshots();
+
+  return 1;
+}
+
+/* Merge `a' and `b' (sorted by name) into `deltas' which must have
+   room for both. Only classes that changed are added. */
+static jint diff_histograms(const heap_histogram *a, const heap_histogram *b, heap_class_delta *deltas)
+{
+  jint i = 0;
+  jint j = 0;
+  jint n = 0;
+  int cmp;
+  heap_class_delta d;
+
+  while (i < a->class_count || j < b->class_count)
+  {
+    if (i == a->class_count)
+      cmp = 1;
+    else if (j == b->class_count)
+      cmp = -1;
+    else
+      cmp = strcmp(a->classes[i].name, b->classes[j].name);
+
+    if (cmp < 0)
+    {
+      /* gone */
+      d.name = a->classes[i].name;
+      d.count = 0;
+      d.bytes = 0;
+      d.count_delta = -a->classes[i].count;
+      d.bytes_delta = -a->classes[i].bytes;
+      i++;
+    }
+    else if (cmp > 0)
+    {
+      /* new */
+      d.name = b->classes[j].name;
+      d.count = b->classes[j].count;
+      d.bytes = b->classes[j].bytes;
+      d.count_delta = d.count;
+      d.bytes_delta = d.bytes;
+      j++;
+    }
+    else
+    {
+      d.name = b->classes[j].name;
+      d.count = b->classes[j].count;
+      d.bytes = b->classes[j].bytes;
+      d.count_delta = d.count - a->classes[i].count;
+      d.bytes_delta = d.bytes - a->classes[i].bytes;
+      i++;
+      j++;
+    }
+    if (d.count_delta || d.bytes_delta)
+      deltas[n++] = d;
+  }
+
+  return n;
+}
+
+/* largest growth first */
+static int compare_growth(const void *a, const void *b)
+{
+  const heap_class_delta *d1 = a;
+  const heap_class_delta *d2 = b;
+  if (d1->bytes_delta != d2->bytes_delta)
+    return d1->bytes_delta > d2->bytes_delta ? -1 : 1;
+  if (d1->count_delta != d2->count_delta)
+    return d1->count_delta > d2->count_delta ? -1 : 1;
+  return strcmp(d1->name, d2->name);
+}
+
+/* lj_heap_diff(a, b, top) compares snapshot `a' with snapshot `b', or
+   with the current heap if `b' is nil. Returns the `top' classes by
+   growth in bytes (all if 0):
+     {{name=, count=, bytes=, count_delta=, bytes_delta=}, ...,
+      total_count_delta=, total_bytes_delta=} */
+static int lj_heap_diff(lua_State *L)
+{
+  const char *name_a;
+  const char *name_b;
+  heap_histogram current;
+  heap_snapshot *snap_a;
+  heap_snapshot *snap_b;
+  const heap_histogram *histo_b;
+  heap_class_delta *deltas = NULL;
+  jint delta_count = 0;
+  jlong total_count_delta = 0;
+  jlong total_bytes_delta = 0;
+  char *names = NULL;
+  size_t names_len;
+  char *p;
+  int top;
+  int found = 1;
+  int out_of_memory = 0;
+  jint i;
+
+  name_a = luaL_checkstring(L, 1);
+  name_b = luaL_optstring(L, 2, NULL);
+  top = luaL_optinteger(L, 3, HEAP_HISTOGRAM_DEFAULT_TOP);
+
+  memset(&current, 0, sizeof(heap_histogram));
+  if (!name_b)
+    collect_sorted_histogram(L, &current);
+
+  lock_snapshots();
+  snap_a = *find_snapshot(name_a);
+  snap_b = name_b ? *find_snapshot(name_b) : NULL;
+  histo_b = name_b ? (snap_b ? &snap_b->histo : NULL) : &current;
+  if (!snap_a || !histo_b)
+  {
+    found = 0;
+  }
+  else
+  {
+    deltas = malloc(sizeof(heap_class_delta) * (snap_a->histo.class_count + histo_b->class_count + 1));
+    if (deltas)
+    {
+      delta_count = diff_histograms(&snap_a->histo, histo_b, deltas);
+      total_count_delta = histo_b->total_count - snap_a->histo.total_count;
+      total_bytes_delta = histo_b->total_bytes - snap_a->histo.total_bytes;
+      /* copy the names, the snapshots may be dropped once unlocked */
+      names_len = 0;
+      for (i = 0; i < delta_count; ++i)
+        names_len += strlen(deltas[i].name) + 1;
+      names = malloc(names_len + 1);
+    }
+    if (names)
+    {
+      p = names;
+      for (i = 0; i < delta_count; ++i)
+      {
+        strcpy(p, deltas[i].name);
+        deltas[i].name = p;
+        p += strlen(p) + 1;
+      }
+    }
+    else
+    {
+      out_of_memory = 1;
+    }
+  }
+  unlock_snapshots();
+
+  if (!found || out_of_memory)
+  {
+    free(names);
+    free(deltas);
+    free_histogram(&current);
+    if (out_of_memory)
+      return luaL_error(L, "Out of memory");
+    return luaL_error(L, "No heap snapshot named '%s'", snap_a ? name_b : name_a);
+  }
+
+  qsort(deltas, delta_count, sizeof(heap_class_delta), compare_growth);
+  if (top <= 0 || top > delta_count)
+    top = delta_count;
+
+  lua_settop(L, 0);
+  lua_createtable(L, top, 2);
+  for (i = 0; i < top; ++i)
+  {
+    lua_createtable(L, 0, 5);
+    lua_pushstring(L, deltas[i].name);
+    lua_setfield(L, -2, "name");
+    lua_pushnumber(L, (lua_Number)deltas[i].count);
+    lua_setfield(L, -2, "count");
+    lua_pushnumber(L, (lua_Number)deltas[i].bytes);
+    lua_setfield(L, -2, "bytes");
+    lua_pushnumber(L, (lua_Number)deltas[i].count_delta);
+    lua_setfield(L, -2, "count_delta");
+    lua_pushnumber(L, (lua_Number)deltas[i].bytes_delta);
+    lua_setfield(L, -2, "bytes_delta");
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_pushnumber(L, (lua_Number)total_count_delta);
+  lua_setfield(L, -2, "total_count_delta");
+  lua_pushnumber(L, (lua_Number)total_bytes_delta);
+  lua_setfield(L, -2, "total_bytes_delta");
+
+  free(names);
+  free(deltas);
+  free_histogram(&current);
+
+  return 1;
+}
+
+void lj_heap_register(lua_State *L)
+{
+  /* created once, this is also called for worker states */
+  if (!snapshot_lock)
+  {
+    lj_err = (*current_jvmti())->CreateRawMonitor(current_jvmti(), "yellow_tree_heap_snapshot_lock", &snapshot_lock);
+    lj_check_jvmti_error(L);
+  }
+
+  lua_register(L, "lj_heap_histogram",             lj_heap_histogram);
+  lua_register(L, "lj_heap_snapshot",              lj_heap_snapshot);
+  lua_register(L, "lj_heap_drop_snapshot",         lj_heap_drop_snapshot);
+  lua_register(L, "lj_heap_snapshots",             lj_heap_snapshots);
+  lua_register(L, "lj_heap_diff",                  lj_heap_diff);
+}
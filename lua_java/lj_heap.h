@@ -0,0 +1,9 @@
+#ifndef LJ_HEAP_H_
+#define LJ_HEAP_H_
+
+/* Ljava/lang/String; -> java.lang.String, arrays keep their signature
+   with dots, eg. [Ljava.lang.String;. The result must be freed, NULL if
+   out of memory. */
+char *lj_class_display_name(const char *sig);
+
+#endif /* LJ_HEAP_H_ */
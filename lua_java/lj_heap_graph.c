@@ -0,0 +1,1496 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "myjni.h"
+#include "jni_util.h"
+#include "lua_interface.h"
+#include "lua_java.h"
+#include "java_bridge.h"
+#include "lj_internal.h"
+#include "lj_method_cache.h"
+#include "lj_tag.h"
+#include "lj_heap.h"
+
+/* The object graph, as reported by FollowReferences.
+
+   Objects are numbered by tagging them with base + number from a tag
+   range. The loaded classes are numbered first, so the class tag passed
+   to the callback gives the number of an object's class. Objects that
+   already have a tag from someone else keep it and are numbered through
+   a hash table instead. No references to the classes are held during
+   the traversal, they would make every class a JNI local root of the
+   calling thread and hide the real paths to them.
+
+   References between objects are kept as edges between the numbers,
+   references from the roots are kept separately with the kind of root.
+   The graph is bounded by a maximum number of objects and of edges and
+   a time budget. If any is exceeded, or memory runs out, the traversal
+   is aborted and the graph is incomplete. Heap callbacks can't call JNI
+   or JVMTI, the time is read from the system clock.
+
+   Retained sizes come from the dominator tree of the graph: the
+   retained size of an object is the size of everything it dominates,
+   which would be collected along with it. */
+
+#define GRAPH_DEFAULT_MAX_OBJECTS 5000000
+#define GRAPH_DEFAULT_MAX_EDGES 20000000 /* 16 bytes each */
+#define GRAPH_DEFAULT_TIMEOUT 10
+#define GRAPH_TIME_CHECK_INTERVAL 4096
+#define GRAPH_DEFAULT_TOP 20
+
+typedef enum {
+  GRAPH_COMPLETE,
+  GRAPH_MAX_OBJECTS,
+  GRAPH_MAX_EDGES,
+  GRAPH_TIMEOUT,
+  GRAPH_OUT_OF_MEMORY
+} graph_status;
+
+typedef struct {
+  jint from;
+  jint to;
+  jint kind;                    /* jvmtiHeapReferenceKind */
+  jint index;                   /* field, array or constant pool index, -1 if none */
+} graph_edge;
+
+typedef struct {
+  jint to;
+  jint kind;
+  /* stack locals and JNI locals */
+  jlong thread_id;
+  jint depth;
+  jmethodID method;
+} graph_root;
+
+typedef struct {
+  jlong tag;                    /* 0 if the slot is free */
+  jint number;
+} foreign_tag;
+
+typedef struct {
+  jlong base;
+  jint max_objects;
+  jint object_count;
+  jint object_capacity;
+  jint *class_of;               /* class number of each object, -1 if not known */
+  jlong *sizes;                 /* 0 until the object is reached */
+  jclass *classes;              /* by number, NULL if unloaded since */
+  jint class_count;
+  graph_edge *edges;
+  jint edge_count;
+  jint edge_capacity;
+  jint max_edges;
+  graph_root *roots;
+  jint root_count;
+  jint root_capacity;
+  foreign_tag *foreign;         /* open addressing, capacity is a power of 2 */
+  jint foreign_count;
+  jint foreign_capacity;
+  int jni_globals;
+  struct timespec deadline;
+  jint callbacks;
+  graph_status status;
+} heap_graph;
+
+static foreign_tag *find_foreign(heap_graph *graph, jlong tag)
+{
+  jint mask = graph->foreign_capacity - 1;
+  jint i = (jint)(((uint64_t)tag * 0x9e3779b97f4a7c15ULL) >> 32) & mask;
+
+  while (graph->foreign[i].tag && graph->foreign[i].tag != tag)
+    i = (i + 1) & mask;
+  return &graph->foreign[i];
+}
+
+/* 0 if out of memory, the table is left as it was */
+static int grow_foreign(heap_graph *graph)
+{
+  foreign_tag *old = graph->foreign;
+  foreign_tag *grown;
+  jint old_capacity = graph->foreign_capacity;
+  jint i;
+
+  grown = calloc(old_capacity ? old_capacity * 2 : 1024, sizeof(foreign_tag));
+  if (!grown)
+    return 0;
+  graph->foreign = grown;
+  graph->foreign_capacity = old_capacity ? old_capacity * 2 : 1024;
+  for (i = 0; i < old_capacity; ++i)
+    if (old[i].tag)
+      *find_foreign(graph, old[i].tag) = old[i];
+  free(old);
+  return 1;
+}
+
+/* Number of the object with `tag', -1 if it isn't numbered */
+static jint known_number(heap_graph *graph, jlong tag)
+{
+  foreign_tag *f;
+
+  if (tag >= graph->base && tag < graph->base + graph->object_count)
+    return (jint)(tag - graph->base);
+  if (!tag || !graph->foreign_count)
+    return -1;
+  f = find_foreign(graph, tag);
+  return f->tag ? f->number : -1;
+}
+
+/* Number of the object tagged `*tag_ptr', numbering it if it's new. -1
+   with the reason in `status' if it can't be numbered. */
+static jint object_number(heap_graph *graph, jlong *tag_ptr, jint class_number)
+{
+  jint number = known_number(graph, *tag_ptr);
+  jint capacity;
+  jint *class_of;
+  jlong *sizes;
+  foreign_tag *f;
+
+  if (number >= 0)
+    return number;
+  if (graph->object_count == graph->max_objects)
+  {
+    graph->status = GRAPH_MAX_OBJECTS;
+    return -1;
+  }
+
+  if (graph->object_count == graph->object_capacity)
+  {
+    capacity = graph->object_capacity ? graph->object_capacity * 2 : 65536;
+    if (capacity > graph->max_objects)
+      capacity = graph->max_objects;
+    class_of = realloc(graph->class_of, capacity * sizeof(jint));
+    if (class_of)
+      graph->class_of = class_of;
+    sizes = class_of ? realloc(graph->sizes, capacity * sizeof(jlong)) : NULL;
+    if (!sizes)
+    {
+      graph->status = GRAPH_OUT_OF_MEMORY;
+      return -1;
+    }
+    graph->sizes = sizes;
+    graph->object_capacity = capacity;
+  }
+  if (*tag_ptr && (graph->foreign_count + 1) * 2 > graph->foreign_capacity && !grow_foreign(graph))
+  {
+    graph->status = GRAPH_OUT_OF_MEMORY;
+    return -1;
+  }
+  number = graph->object_count++;
+  graph->class_of[number] = class_number;
+  graph->sizes[number] = 0;
+  if (*tag_ptr)
+  {
+    f = find_foreign(graph, *tag_ptr);
+    f->tag = *tag_ptr;
+    f->number = number;
+    graph->foreign_count++;
+  }
+  else
+  {
+    *tag_ptr = graph->base + number;
+  }
+  return number;
+}
+
+/* Tag of object `number', foreign tags are only looked up here */
+static jlong object_tag(heap_graph *graph, jint number)
+{
+  jint i;
+
+  for (i = 0; i < graph->foreign_capacity; ++i)
+    if (graph->foreign[i].tag && graph->foreign[i].number == number)
+      return graph->foreign[i].tag;
+  return graph->base + number;
+}
+
+static int past_deadline(heap_graph *graph)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec > graph->deadline.tv_sec ||
+    (now.tv_sec == graph->deadline.tv_sec && now.tv_nsec >= graph->deadline.tv_nsec);
+}
+
+/* 0 with the reason in `status' if the edge can't be added */
+static int add_edge(heap_graph *graph, jint from, jint to, jint kind, jint index)
+{
+  graph_edge *edge;
+  graph_edge *edges;
+  jint capacity;
+
+  if (graph->edge_count == graph->max_edges)
+  {
+    graph->status = GRAPH_MAX_EDGES;
+    return 0;
+  }
+  if (graph->edge_count == graph->edge_capacity)
+  {
+    capacity = graph->edge_capacity ? graph->edge_capacity * 2 : 65536;
+    if (capacity > graph->max_edges)
+      capacity = graph->max_edges;
+    edges = realloc(graph->edges, capacity * sizeof(graph_edge));
+    if (!edges)
+    {
+      graph->status = GRAPH_OUT_OF_MEMORY;
+      return 0;
+    }
+    graph->edges = edges;
+    graph->edge_capacity = capacity;
+  }
+  edge = &graph->edges[graph->edge_count++];
+  edge->from = from;
+  edge->to = to;
+  edge->kind = kind;
+  edge->index = index;
+  return 1;
+}
+
+/* 0 if out of memory */
+static int add_root(heap_graph *graph, jint to, jvmtiHeapReferenceKind kind, const jvmtiHeapReferenceInfo *info)
+{
+  graph_root *root;
+  graph_root *roots;
+  jint capacity;
+
+  if (graph->root_count == graph->root_capacity)
+  {
+    capacity = graph->root_capacity ? graph->root_capacity * 2 : 1024;
+    roots = realloc(graph->roots, capacity * sizeof(graph_root));
+    if (!roots)
+    {
+      graph->status = GRAPH_OUT_OF_MEMORY;
+      return 0;
+    }
+    graph->roots = roots;
+    graph->root_capacity = capacity;
+  }
+  root = &graph->roots[graph->root_count++];
+  memset(root, 0, sizeof(graph_root));
+  root->to = to;
+  root->kind = kind;
+  root->depth = -1;
+  if (kind == JVMTI_HEAP_REFERENCE_STACK_LOCAL && info)
+  {
+    root->thread_id = info->stack_local.thread_id;
+    root->depth = info->stack_local.depth;
+    root->method = info->stack_local.method;
+  }
+  else if (kind == JVMTI_HEAP_REFERENCE_JNI_LOCAL && info)
+  {
+    root->thread_id = info->jni_local.thread_id;
+    root->depth = info->jni_local.depth;
+    root->method = info->jni_local.method;
+  }
+  return 1;
+}
+
+static jint JNICALL graph_follow_reference(jvmtiHeapReferenceKind kind, const jvmtiHeapReferenceInfo *info,
+                                           jlong class_tag, jlong referrer_class_tag, jlong size,
+                                           jlong *tag_ptr, jlong *referrer_tag_ptr, jint length, void *user_data)
+{
+  heap_graph *graph = user_data;
+  jint class_number;
+  jint from;
+  jint to;
+  jint index = -1;
+
+  /* the debugger's own references are JNI global references */
+  if (kind == JVMTI_HEAP_REFERENCE_JNI_GLOBAL && !graph->jni_globals)
+    return 0;
+
+  if (++graph->callbacks % GRAPH_TIME_CHECK_INTERVAL == 0 && past_deadline(graph))
+  {
+    graph->status = GRAPH_TIMEOUT;
+    return JVMTI_VISIT_ABORT;
+  }
+
+  class_number = known_number(graph, class_tag);
+  if (class_number >= graph->class_count)
+    class_number = -1;
+  to = object_number(graph, tag_ptr, class_number);
+  if (to < 0)
+    return JVMTI_VISIT_ABORT;
+  graph->sizes[to] = size;
+  if (graph->class_of[to] < 0)
+    graph->class_of[to] = class_number;
+
+  if (!referrer_tag_ptr)
+    return add_root(graph, to, kind, info) ? JVMTI_VISIT_OBJECTS : JVMTI_VISIT_ABORT;
+
+  switch (kind)
+  {
+  case JVMTI_HEAP_REFERENCE_FIELD:
+  case JVMTI_HEAP_REFERENCE_STATIC_FIELD:
+    index = info->field.index;
+    break;
+  case JVMTI_HEAP_REFERENCE_ARRAY_ELEMENT:
+    index = info->array.index;
+    break;
+  case JVMTI_HEAP_REFERENCE_CONSTANT_POOL:
+    index = info->constant_pool.index;
+    break;
+  default:
+    break;
+  }
+
+  /* the referrer was numbered when it was reached */
+  from = known_number(graph, *referrer_tag_ptr);
+  if (from >= 0 && !add_edge(graph, from, to, kind, index))
+    return JVMTI_VISIT_ABORT;
+
+  return JVMTI_VISIT_OBJECTS;
+}
+
+/* Number `obj' before the traversal */
+static jint number_object(heap_graph *graph, jobject obj, jint class_number)
+{
+  jlong tag = 0;
+  jlong new_tag;
+  jint number;
+
+  (*current_jvmti())->GetTag(current_jvmti(), obj, &tag);
+  new_tag = tag;
+  number = object_number(graph, &new_tag, class_number);
+  if (number >= 0 && new_tag != tag)
+    (*current_jvmti())->SetTag(current_jvmti(), obj, new_tag);
+  return number;
+}
+
+static void free_graph(heap_graph *graph)
+{
+  JNIEnv *jni = current_jni();
+  jint i;
+
+  if (graph->classes)
+  {
+    for (i = 0; i < graph->class_count; ++i)
+      if (graph->classes[i])
+        (*jni)->DeleteLocalRef(jni, graph->classes[i]);
+  }
+  free(graph->classes);
+  free(graph->class_of);
+  free(graph->sizes);
+  free(graph->edges);
+  free(graph->roots);
+  free(graph->foreign);
+  if (graph->base)
+    lj_tag_range_release(graph->base, NULL, 1);
+  memset(graph, 0, sizeof(heap_graph));
+}
+
+/* Limits of a graph, from the optional arguments of the Lua functions */
+typedef struct {
+  jint max_objects;
+  jint max_edges;
+  double timeout;
+  int jni_globals;
+} graph_limits;
+
+static void release_classes(jclass *classes, jint count)
+{
+  JNIEnv *jni = current_jni();
+  jint i;
+
+  for (i = 0; i < count; ++i)
+    (*jni)->DeleteLocalRef(jni, classes[i]);
+  free_jvmti_refs(current_jvmti(), classes, (void *)-1);
+}
+
+/* Get the loaded classes again after the traversal, by number. Classes
+   unloaded in between are left NULL, new ones weren't numbered. */
+static jvmtiError find_classes(heap_graph *graph)
+{
+  jvmtiEnv *jvmti = current_jvmti();
+  JNIEnv *jni = current_jni();
+  jclass *loaded;
+  jint count;
+  jint number;
+  jlong tag;
+  jvmtiError err;
+  jint i;
+
+  graph->classes = calloc(graph->class_count ? graph->class_count : 1, sizeof(jclass));
+  if (!graph->classes)
+    return JVMTI_ERROR_OUT_OF_MEMORY;
+  err = (*jvmti)->GetLoadedClasses(jvmti, &count, &loaded);
+  if (err != JVMTI_ERROR_NONE)
+    return err;
+
+  for (i = 0; i < count; ++i)
+  {
+    tag = 0;
+    (*jvmti)->GetTag(jvmti, loaded[i], &tag);
+    number = known_number(graph, tag);
+    if (number >= 0 && number < graph->class_count && !graph->classes[number])
+      graph->classes[number] = loaded[i];
+    else
+      (*jni)->DeleteLocalRef(jni, loaded[i]);
+  }
+  free_jvmti_refs(jvmti, loaded, (void *)-1);
+
+  return JVMTI_ERROR_NONE;
+}
+
+/* Follow the references from the roots, numbering the objects with
+   tags from the range at `base'. The loaded classes are numbered
+   first, then the `target_count' objects in `targets' with their
+   numbers stored in `numbers'. If they can't all be numbered, there is
+   no traversal and `status' says why. The range is released by
+   free_graph(), which must be called on success. */
+static jvmtiError build_graph(heap_graph *graph, jlong base, jobject *targets, jint target_count, jint *numbers,
+                              const graph_limits *limits)
+{
+  jvmtiEnv *jvmti = current_jvmti();
+  jvmtiHeapCallbacks callbacks;
+  jclass *loaded;
+  jvmtiError err;
+  jint i;
+
+  memset(graph, 0, sizeof(heap_graph));
+  graph->base = base;
+  graph->jni_globals = limits->jni_globals;
+  graph->max_edges = limits->max_edges;
+
+  err = (*jvmti)->GetLoadedClasses(jvmti, &graph->class_count, &loaded);
+  if (err != JVMTI_ERROR_NONE)
+  {
+    free_graph(graph);
+    return err;
+  }
+
+  graph->max_objects = limits->max_objects;
+  if (graph->max_objects < graph->class_count + target_count)
+    graph->max_objects = graph->class_count + target_count;
+
+  for (i = 0; i < graph->class_count; ++i)
+    number_object(graph, loaded[i], -1);
+  for (i = 0; i < target_count; ++i)
+    numbers[i] = number_object(graph, targets[i], -1);
+  release_classes(loaded, graph->class_count);
+
+  if (graph->status == GRAPH_COMPLETE)
+  {
+    clock_gettime(CLOCK_MONOTONIC, &graph->deadline);
+    graph->deadline.tv_sec += (time_t)limits->timeout;
+    graph->deadline.tv_nsec += (long)((limits->timeout - (time_t)limits->timeout) * 1e9);
+    if (graph->deadline.tv_nsec >= 1000000000)
+    {
+      graph->deadline.tv_sec++;
+      graph->deadline.tv_nsec -= 1000000000;
+    }
+
+    memset(&callbacks, 0, sizeof(jvmtiHeapCallbacks));
+    callbacks.heap_reference_callback = &graph_follow_reference;
+    err = (*jvmti)->FollowReferences(jvmti, 0, NULL, NULL, &callbacks, graph);
+  }
+  if (err == JVMTI_ERROR_NONE)
+    err = find_classes(graph);
+  if (err != JVMTI_ERROR_NONE)
+    free_graph(graph);
+
+  return err;
+}
+
+/* Breadth-first search from the roots to `target'. Fills `via' with
+   the edge each object was first reached by, or -(root + 2) for
+   objects reached from a root. Returns 0 if `target' isn't reached, -1
+   if out of memory. */
+static int shortest_path(heap_graph *graph, jint target, jint *via)
+{
+  jint *offsets;
+  jint *out;
+  jint *queue;
+  jint head = 0;
+  jint tail = 0;
+  jint found = 0;
+  jint v;
+  jint i;
+
+  /* the edges by referrer */
+  offsets = calloc(graph->object_count + 1, sizeof(jint));
+  out = malloc((graph->edge_count ? graph->edge_count : 1) * sizeof(jint));
+  queue = malloc((graph->object_count ? graph->object_count : 1) * sizeof(jint));
+  if (!offsets || !out || !queue)
+  {
+    free(queue);
+    free(out);
+    free(offsets);
+    return -1;
+  }
+  for (i = 0; i < graph->edge_count; ++i)
+    offsets[graph->edges[i].from + 1]++;
+  for (i = 0; i < graph->object_count; ++i)
+    offsets[i + 1] += offsets[i];
+  for (i = 0; i < graph->edge_count; ++i)
+    out[offsets[graph->edges[i].from]++] = i;
+  /* filling moved each offset to the start of the next referrer */
+  for (i = graph->object_count; i > 0; --i)
+    offsets[i] = offsets[i - 1];
+  offsets[0] = 0;
+
+  for (i = 0; i < graph->object_count; ++i)
+    via[i] = -1;
+  for (i = 0; i < graph->root_count; ++i)
+  {
+    v = graph->roots[i].to;
+    if (via[v] == -1)
+    {
+      via[v] = -(i + 2);
+      queue[tail++] = v;
+    }
+  }
+
+  while (head < tail && !found)
+  {
+    v = queue[head++];
+    if (v == target)
+    {
+      found = 1;
+      break;
+    }
+    for (i = offsets[v]; i < offsets[v + 1]; ++i)
+    {
+      jint to = graph->edges[out[i]].to;
+      if (via[to] == -1)
+      {
+        via[to] = out[i];
+        queue[tail++] = to;
+      }
+    }
+  }
+
+  free(queue);
+  free(out);
+  free(offsets);
+
+  return found;
+}
+
+/* Immediate dominators by Lengauer-Tarjan with path compression, over
+   the objects and a super root (number `object_count') which
+   references all the roots. */
+typedef struct {
+  jint node_count;              /* objects and the super root */
+  jint *idom;                   /* -1 if not reachable */
+  jint *order;                  /* reachable nodes in depth-first preorder */
+  jint reached;
+  jlong *retained;              /* size of the objects each node dominates, itself included */
+} dominator_tree;
+
+/* Successors (or predecessors if `reverse') of each node as offsets into
+   `adj', including the edges from the super root. 0 if out of memory,
+   nothing is allocated then. */
+static int adjacency(heap_graph *graph, int reverse, jint **offsets_out, jint **adj_out)
+{
+  jint n = graph->object_count;
+  jint *offsets = calloc(n + 2, sizeof(jint));
+  jint *adj = malloc((graph->edge_count + graph->root_count + 1) * sizeof(jint));
+  jint from;
+  jint to;
+  jint i;
+
+  *offsets_out = NULL;
+  *adj_out = NULL;
+  if (!offsets || !adj)
+  {
+    free(adj);
+    free(offsets);
+    return 0;
+  }
+
+  for (i = 0; i < graph->edge_count; ++i)
+    offsets[(reverse ? graph->edges[i].to : graph->edges[i].from) + 1]++;
+  for (i = 0; i < graph->root_count; ++i)
+    offsets[(reverse ? graph->roots[i].to : n) + 1]++;
+  for (i = 0; i < n + 1; ++i)
+    offsets[i + 1] += offsets[i];
+
+  for (i = 0; i < graph->edge_count + graph->root_count; ++i)
+  {
+    if (i < graph->edge_count)
+    {
+      from = graph->edges[i].from;
+      to = graph->edges[i].to;
+    }
+    else
+    {
+      from = n;
+      to = graph->roots[i - graph->edge_count].to;
+    }
+    if (reverse)
+      adj[offsets[to]++] = from;
+    else
+      adj[offsets[from]++] = to;
+  }
+  /* filling moved each offset to the start of the next node */
+  for (i = n + 1; i > 0; --i)
+    offsets[i] = offsets[i - 1];
+  offsets[0] = 0;
+
+  *offsets_out = offsets;
+  *adj_out = adj;
+  return 1;
+}
+
+/* Node with the lowest semidominator on the path from `v' to the root of
+   its tree in the forest, compressing the path */
+static jint eval_node(jint v, jint *ancestor, jint *label, const jint *semi, jint *stack)
+{
+  jint top = 0;
+  jint x;
+  jint a;
+
+  if (ancestor[v] < 0)
+    return v;
+  for (x = v; ancestor[ancestor[x]] >= 0; x = ancestor[x])
+    stack[top++] = x;
+  while (top > 0)
+  {
+    x = stack[--top];
+    a = ancestor[x];
+    if (semi[label[a]] < semi[label[x]])
+      label[x] = label[a];
+    ancestor[x] = ancestor[a];
+  }
+  return label[v];
+}
+
+/* 0 if out of memory, `tree' must still be freed with free_dominators() */
+static int compute_dominators(heap_graph *graph, dominator_tree *tree)
+{
+  jint n = graph->object_count + 1;
+  jint root = graph->object_count;
+  jint *succ_offsets;
+  jint *succ;
+  jint *pred_offsets;
+  jint *pred;
+  jint *semi;                   /* preorder number of the semidominator, 0 if not reached */
+  jint *parent;
+  jint *ancestor;
+  jint *label;
+  jint *bucket;                 /* first node in the bucket of each node */
+  jint *next;                   /* next node in the same bucket */
+  jint *stack;
+  jint *pos;
+  jint top;
+  jint count = 0;
+  jint v;
+  jint w;
+  jint u;
+  jint i;
+  jint j;
+  int ok;
+
+  memset(tree, 0, sizeof(dominator_tree));
+  tree->node_count = n;
+  adjacency(graph, 0, &succ_offsets, &succ);
+  adjacency(graph, 1, &pred_offsets, &pred);
+  semi = calloc(n, sizeof(jint));
+  parent = malloc(n * sizeof(jint));
+  ancestor = malloc(n * sizeof(jint));
+  label = malloc(n * sizeof(jint));
+  bucket = malloc(n * sizeof(jint));
+  next = malloc(n * sizeof(jint));
+  stack = malloc(n * sizeof(jint));
+  pos = malloc(n * sizeof(jint));
+  tree->idom = malloc(n * sizeof(jint));
+  tree->order = malloc(n * sizeof(jint));
+  tree->retained = calloc(n, sizeof(jlong));
+  ok = succ && pred && semi && parent && ancestor && label && bucket && next && stack && pos &&
+    tree->idom && tree->order && tree->retained;
+  if (!ok)
+    goto done;
+
+  for (i = 0; i < n; ++i)
+  {
+    ancestor[i] = -1;
+    label[i] = i;
+    bucket[i] = -1;
+    tree->idom[i] = -1;
+  }
+
+  /* depth-first numbering from the super root, preorder numbers start at 1 */
+  top = 0;
+  stack[top] = root;
+  pos[top++] = succ_offsets[root];
+  semi[root] = ++count;
+  tree->order[0] = root;
+  parent[root] = -1;
+  while (top > 0)
+  {
+    v = stack[top - 1];
+    if (pos[top - 1] == succ_offsets[v + 1])
+    {
+      top--;
+      continue;
+    }
+    w = succ[pos[top - 1]++];
+    if (semi[w])
+      continue;
+    semi[w] = ++count;
+    tree->order[count - 1] = w;
+    parent[w] = v;
+    stack[top] = w;
+    pos[top++] = succ_offsets[w];
+  }
+  tree->reached = count;
+
+  for (i = count - 1; i > 0; --i)
+  {
+    w = tree->order[i];
+    for (j = pred_offsets[w]; j < pred_offsets[w + 1]; ++j)
+    {
+      v = pred[j];
+      if (!semi[v])
+        continue;
+      u = eval_node(v, ancestor, label, semi, stack);
+      if (semi[u] < semi[w])
+        semi[w] = semi[u];
+    }
+    v = tree->order[semi[w] - 1];
+    next[w] = bucket[v];
+    bucket[v] = w;
+    ancestor[w] = parent[w];
+
+    for (v = bucket[parent[w]]; v >= 0; v = next[v])
+    {
+      u = eval_node(v, ancestor, label, semi, stack);
+      tree->idom[v] = semi[u] < semi[v] ? u : parent[w];
+    }
+    bucket[parent[w]] = -1;
+  }
+  for (i = 1; i < count; ++i)
+  {
+    w = tree->order[i];
+    if (tree->idom[w] != tree->order[semi[w] - 1])
+      tree->idom[w] = tree->idom[tree->idom[w]];
+  }
+  tree->idom[root] = root;
+
+  /* a dominator comes before the nodes it dominates in preorder */
+  for (i = 0; i < count; ++i)
+  {
+    w = tree->order[i];
+    if (w != root)
+      tree->retained[w] = graph->sizes[w];
+  }
+  for (i = count - 1; i > 0; --i)
+  {
+    w = tree->order[i];
+    tree->retained[tree->idom[w]] += tree->retained[w];
+  }
+
+done:
+  free(pos);
+  free(stack);
+  free(next);
+  free(bucket);
+  free(label);
+  free(ancestor);
+  free(parent);
+  free(semi);
+  free(pred);
+  free(pred_offsets);
+  free(succ);
+  free(succ_offsets);
+
+  return ok;
+}
+
+static void free_dominators(dominator_tree *tree)
+{
+  free(tree->idom);
+  free(tree->order);
+  free(tree->retained);
+}
+
+/* Retained size of each group of objects, `group' has the group of each
+   object or -1. Objects dominated by another object of the same group
+   are already counted by it, only the outermost ones are added. 0 if
+   out of memory. */
+static int group_retained(heap_graph *graph, dominator_tree *tree, const jint *group, jint group_count, jlong *result)
+{
+  jint n = tree->node_count;
+  jint root = graph->object_count;
+  jint *offsets;
+  jint *children;
+  jint *active;
+  jint *stack;
+  jint *pos;
+  jint top;
+  jint v;
+  jint g;
+  jint i;
+  int ok;
+
+  /* children in the dominator tree */
+  offsets = calloc(n + 1, sizeof(jint));
+  children = malloc(n * sizeof(jint));
+  active = calloc(group_count ? group_count : 1, sizeof(jint));
+  stack = malloc(n * sizeof(jint));
+  pos = malloc(n * sizeof(jint));
+  ok = offsets && children && active && stack && pos;
+  if (!ok)
+    goto done;
+
+  for (i = 1; i < tree->reached; ++i)
+    offsets[tree->idom[tree->order[i]] + 1]++;
+  for (i = 0; i < n; ++i)
+    offsets[i + 1] += offsets[i];
+  for (i = 1; i < tree->reached; ++i)
+  {
+    v = tree->order[i];
+    children[offsets[tree->idom[v]]++] = v;
+  }
+  for (i = n; i > 0; --i)
+    offsets[i] = offsets[i - 1];
+  offsets[0] = 0;
+
+  memset(result, 0, group_count * sizeof(jlong));
+
+  top = 0;
+  stack[top] = root;
+  pos[top++] = offsets[root];
+  while (top > 0)
+  {
+    v = stack[top - 1];
+    if (pos[top - 1] < offsets[v + 1])
+    {
+      v = children[pos[top - 1]++];
+      g = group[v];
+      if (g >= 0 && active[g]++ == 0)
+        result[g] += tree->retained[v];
+      stack[top] = v;
+      pos[top++] = offsets[v];
+    }
+    else
+    {
+      top--;
+      g = v == root ? -1 : group[v];
+      if (g >= 0)
+        active[g]--;
+    }
+  }
+
+done:
+  free(pos);
+  free(stack);
+  free(active);
+  free(children);
+  free(offsets);
+
+  return ok;
+}
+
+static const char *reference_kind_name(jint kind)
+{
+  switch (kind)
+  {
+  case JVMTI_HEAP_REFERENCE_CLASS: return "class";
+  case JVMTI_HEAP_REFERENCE_FIELD: return "field";
+  case JVMTI_HEAP_REFERENCE_ARRAY_ELEMENT: return "array_element";
+  case JVMTI_HEAP_REFERENCE_CLASS_LOADER: return "class_loader";
+  case JVMTI_HEAP_REFERENCE_SIGNERS: return "signers";
+  case JVMTI_HEAP_REFERENCE_PROTECTION_DOMAIN: return "protection_domain";
+  case JVMTI_HEAP_REFERENCE_INTERFACE: return "interface";
+  case JVMTI_HEAP_REFERENCE_STATIC_FIELD: return "static_field";
+  case JVMTI_HEAP_REFERENCE_CONSTANT_POOL: return "constant_pool";
+  case JVMTI_HEAP_REFERENCE_SUPERCLASS: return "superclass";
+  case JVMTI_HEAP_REFERENCE_JNI_GLOBAL: return "jni_global";
+  case JVMTI_HEAP_REFERENCE_SYSTEM_CLASS: return "system_class";
+  case JVMTI_HEAP_REFERENCE_MONITOR: return "monitor";
+  case JVMTI_HEAP_REFERENCE_STACK_LOCAL: return "stack_local";
+  case JVMTI_HEAP_REFERENCE_JNI_LOCAL: return "jni_local";
+  case JVMTI_HEAP_REFERENCE_THREAD: return "thread";
+  case JVMTI_HEAP_REFERENCE_OTHER: return "other";
+  }
+  return "unknown";
+}
+
+static void add_interfaces(JNIEnv *jni, jclass class, jclass **list, jint *count, jint *capacity)
+{
+  jclass *interfaces;
+  jint interface_count;
+  jint i;
+  jint j;
+
+  if ((*current_jvmti())->GetImplementedInterfaces(current_jvmti(), class, &interface_count, &interfaces) != JVMTI_ERROR_NONE)
+    return;
+  for (i = 0; i < interface_count; ++i)
+  {
+    for (j = 0; j < *count; ++j)
+      if ((*jni)->IsSameObject(jni, (*list)[j], interfaces[i]))
+        break;
+    if (j < *count)
+    {
+      (*jni)->DeleteLocalRef(jni, interfaces[i]);
+      continue;
+    }
+    if (*count == *capacity)
+    {
+      *capacity = *capacity ? *capacity * 2 : 16;
+      *list = realloc(*list, *capacity * sizeof(jclass));
+    }
+    (*list)[(*count)++] = interfaces[i];
+    add_interfaces(jni, interfaces[i], list, count, capacity);
+  }
+  free_jvmti_refs(current_jvmti(), interfaces, (void *)-1);
+}
+
+static jint field_count(jclass class)
+{
+  jfieldID *fields;
+  jint count = 0;
+
+  if ((*current_jvmti())->GetClassFields(current_jvmti(), class, &count, &fields) != JVMTI_ERROR_NONE)
+    return 0;
+  free_jvmti_refs(current_jvmti(), fields, (void *)-1);
+  return count;
+}
+
+/* Name of the field at `index' of `class' as numbered by heap
+   references. The fields of all the interfaces implemented come first,
+   then the fields of each class from java.lang.Object down to `class'.
+   For an interface, only its own fields follow those of its
+   superinterfaces. The result must be freed, NULL if not found. */
+static char *reference_field_name(JNIEnv *jni, jclass class, jint index)
+{
+  jvmtiEnv *jvmti = current_jvmti();
+  jclass *chain = NULL;
+  jint chain_count = 0;
+  jint chain_capacity = 0;
+  jclass *interfaces = NULL;
+  jint interface_count = 0;
+  jint interface_capacity = 0;
+  jboolean is_interface = JNI_FALSE;
+  jfieldID *fields;
+  jint count;
+  char *field_name;
+  char *name = NULL;
+  jclass super;
+  jint i;
+
+  (*jvmti)->IsInterface(jvmti, class, &is_interface);
+
+  /* the class and its superclasses, `class' first */
+  super = (*jni)->NewLocalRef(jni, class);
+  while (super)
+  {
+    if (chain_count == chain_capacity)
+    {
+      chain_capacity = chain_capacity ? chain_capacity * 2 : 8;
+      chain = realloc(chain, chain_capacity * sizeof(jclass));
+    }
+    chain[chain_count++] = super;
+    super = is_interface ? NULL : (*jni)->GetSuperclass(jni, super);
+  }
+
+  for (i = 0; i < chain_count; ++i)
+    add_interfaces(jni, chain[i], &interfaces, &interface_count, &interface_capacity);
+  for (i = 0; i < interface_count; ++i)
+  {
+    index -= field_count(interfaces[i]);
+    (*jni)->DeleteLocalRef(jni, interfaces[i]);
+  }
+  free(interfaces);
+
+  for (i = chain_count - 1; i >= 0 && index >= 0 && !name; --i)
+  {
+    if ((*jvmti)->GetClassFields(jvmti, chain[i], &count, &fields) != JVMTI_ERROR_NONE)
+      break;
+    if (index < count)
+    {
+      if ((*jvmti)->GetFieldName(jvmti, chain[i], fields[index], &field_name, NULL, NULL) == JVMTI_ERROR_NONE)
+      {
+        name = strdup(field_name);
+        free_jvmti_refs(jvmti, field_name, (void *)-1);
+      }
+    }
+    index -= count;
+    free_jvmti_refs(jvmti, fields, (void *)-1);
+  }
+
+  for (i = 0; i < chain_count; ++i)
+    (*jni)->DeleteLocalRef(jni, chain[i]);
+  free(chain);
+
+  return name;
+}
+
+static void push_class_name(lua_State *L, jclass class)
+{
+  char *sig;
+  char *name;
+
+  if (class && (*current_jvmti())->GetClassSignature(current_jvmti(), class, &sig, NULL) == JVMTI_ERROR_NONE)
+  {
+    name = lj_class_display_name(sig);
+    lua_pushstring(L, name);
+    free(name);
+    free_jvmti_refs(current_jvmti(), sig, (void *)-1);
+  }
+  else
+  {
+    lua_pushnil(L);
+  }
+}
+
+static void push_root(lua_State *L, graph_root *root)
+{
+  lj_method_info *info;
+  jvmtiError err;
+
+  lua_createtable(L, 0, 4);
+  lua_pushstring(L, reference_kind_name(root->kind));
+  lua_setfield(L, -2, "kind");
+  if (root->kind != JVMTI_HEAP_REFERENCE_STACK_LOCAL && root->kind != JVMTI_HEAP_REFERENCE_JNI_LOCAL)
+    return;
+
+  lua_pushnumber(L, (lua_Number)root->thread_id);
+  lua_setfield(L, -2, "thread_id");
+  lua_pushinteger(L, root->depth);
+  lua_setfield(L, -2, "depth");
+  info = root->method ? lj_method_info_acquire(current_jni(), root->method, &err) : NULL;
+  if (info)
+  {
+    lua_pushfstring(L, "%s.%s", info->class_name, info->name);
+    lua_setfield(L, -2, "method");
+    lj_method_info_release(info);
+  }
+}
+
+static const char *graph_status_name(graph_status status)
+{
+  switch (status)
+  {
+  case GRAPH_COMPLETE: return NULL;
+  case GRAPH_MAX_OBJECTS: return "max_objects";
+  case GRAPH_MAX_EDGES: return "max_edges";
+  case GRAPH_TIMEOUT: return "timeout";
+  case GRAPH_OUT_OF_MEMORY: return "out_of_memory";
+  }
+  return NULL;
+}
+
+/* Push the path ending at `target' found by shortest_path(). 0 if out
+   of memory, nothing is pushed then. */
+static int push_path(lua_State *L, heap_graph *graph, jint target, jint *via)
+{
+  JNIEnv *jni = current_jni();
+  jint *path;
+  jint *path_via;
+  jint length = 0;
+  jlong *tags;
+  jobject *obj_output = NULL;
+  jlong *tag_output = NULL;
+  jint output_count = 0;
+  jobject *objects;
+  graph_edge *edge;
+  jclass class;
+  char *name;
+  jint v;
+  jint i;
+  jint j;
+
+  for (v = target; via[v] >= 0; v = graph->edges[via[v]].from)
+    length++;
+  length++;
+  path = malloc(length * sizeof(jint));
+  path_via = malloc(length * sizeof(jint));
+  tags = malloc(length * sizeof(jlong));
+  objects = calloc(length, sizeof(jobject));
+  if (!path || !path_via || !tags || !objects)
+  {
+    free(objects);
+    free(tags);
+    free(path_via);
+    free(path);
+    return 0;
+  }
+  v = target;
+  for (i = length - 1; i >= 0; --i)
+  {
+    path[i] = v;
+    path_via[i] = via[v];
+    if (via[v] >= 0)
+      v = graph->edges[via[v]].from;
+  }
+
+  /* the objects on the path */
+  for (i = 0; i < length; ++i)
+    tags[i] = object_tag(graph, path[i]);
+  if ((*current_jvmti())->GetObjectsWithTags(current_jvmti(), length, tags, &output_count,
+                                             &obj_output, &tag_output) == JVMTI_ERROR_NONE)
+  {
+    for (j = 0; j < output_count; ++j)
+    {
+      for (i = 0; i < length; ++i)
+        if (tags[i] == tag_output[j] && !objects[i])
+          break;
+      if (i < length)
+        objects[i] = (*jni)->NewGlobalRef(jni, obj_output[j]);
+      (*jni)->DeleteLocalRef(jni, obj_output[j]);
+    }
+    free_jvmti_refs(current_jvmti(), obj_output, tag_output, (void *)-1);
+  }
+  free(tags);
+
+  lua_createtable(L, length, 2);
+  push_root(L, &graph->roots[-path_via[0] - 2]);
+  lua_setfield(L, -2, "root");
+  if (graph_status_name(graph->status))
+  {
+    lua_pushstring(L, graph_status_name(graph->status));
+    lua_setfield(L, -2, "truncated");
+  }
+
+  for (i = 0; i < length; ++i)
+  {
+    lua_createtable(L, 0, 4);
+    if (objects[i])
+    {
+      class = (*jni)->GetObjectClass(jni, objects[i]);
+      push_class_name(L, class);
+      lua_setfield(L, -2, "class");
+      (*jni)->DeleteLocalRef(jni, class);
+      new_jobject(L, objects[i]);
+      lua_setfield(L, -2, "object");
+    }
+    if (i > 0)
+    {
+      edge = &graph->edges[path_via[i]];
+      lua_pushstring(L, reference_kind_name(edge->kind));
+      lua_setfield(L, -2, "kind");
+      if (edge->kind == JVMTI_HEAP_REFERENCE_FIELD || edge->kind == JVMTI_HEAP_REFERENCE_STATIC_FIELD)
+      {
+        /* a static field belongs to the referrer, which is a class */
+        class = NULL;
+        name = NULL;
+        if (objects[i - 1])
+          class = edge->kind == JVMTI_HEAP_REFERENCE_STATIC_FIELD ?
+            (*jni)->NewLocalRef(jni, objects[i - 1]) : (*jni)->GetObjectClass(jni, objects[i - 1]);
+        if (class)
+        {
+          name = reference_field_name(jni, class, edge->index);
+          (*jni)->DeleteLocalRef(jni, class);
+        }
+        if (name)
+        {
+          lua_pushstring(L, name);
+          lua_setfield(L, -2, "field");
+          free(name);
+        }
+      }
+      if (edge->index >= 0)
+      {
+        lua_pushinteger(L, edge->index);
+        lua_setfield(L, -2, "index");
+      }
+    }
+    lua_rawseti(L, -2, i + 1);
+  }
+
+  free(objects);
+  free(path_via);
+  free(path);
+
+  return 1;
+}
+
+static void check_graph_args(lua_State *L, int idx, graph_limits *limits)
+{
+  limits->max_objects = (jint)luaL_optinteger(L, idx, GRAPH_DEFAULT_MAX_OBJECTS);
+  limits->timeout = luaL_optnumber(L, idx + 1, GRAPH_DEFAULT_TIMEOUT);
+  limits->jni_globals = lua_toboolean(L, idx + 2);
+  limits->max_edges = (jint)luaL_optinteger(L, idx + 3, GRAPH_DEFAULT_MAX_EDGES);
+  luaL_argcheck(L, limits->max_objects > 0, idx, "must be positive");
+  luaL_argcheck(L, limits->max_edges > 0, idx + 3, "must be positive");
+}
+
+/* lj_why_alive(obj, max_objects, timeout, jni_globals, max_edges) finds
+   the shortest chain of references from a GC root to `obj'. Returns
+     {{object=, class=}, {object=, class=, kind=, field=, index=}, ...,
+      root={kind=, thread_id=, depth=, method=}, truncated=}
+   where each element after the first is referenced by the one before
+   and the first is referenced by the root. `truncated' is set if the
+   graph was incomplete. Returns nil and the reason if there is no path.
+
+   JNI global references are not roots unless `jni_globals' is set,
+   the debugger holds its objects with them. */
+static int lj_why_alive(lua_State *L)
+{
+  jobject obj;
+  heap_graph graph;
+  graph_limits limits;
+  jlong base;
+  jint target;
+  jint *via;
+  int found = 0;
+
+  obj = *(jobject *)luaL_checkudata(L, 1, "jobject");
+  check_graph_args(L, 2, &limits);
+  lua_settop(L, 0);
+
+  base = lj_tag_range_acquire("heap_graph");
+  if (!base)
+    return luaL_error(L, "All object tags are in use");
+  lj_err = build_graph(&graph, base, &obj, 1, &target, &limits);
+  lj_check_jvmti_error(L);
+
+  via = malloc((graph.object_count ? graph.object_count : 1) * sizeof(jint));
+  if (via && target >= 0)
+    found = shortest_path(&graph, target, via);
+  if (!via || found < 0 || (found && !push_path(L, &graph, target, via)))
+  {
+    free(via);
+    free_graph(&graph);
+    return luaL_error(L, "Out of memory searching the heap graph");
+  }
+  if (!found)
+  {
+    lua_pushnil(L);
+    if (graph.status == GRAPH_COMPLETE)
+      lua_pushliteral(L, "Not reachable from the roots");
+    else
+      lua_pushfstring(L, "Not reached, the graph is incomplete (%s)", graph_status_name(graph.status));
+  }
+  free(via);
+  free_graph(&graph);
+
+  return found ? 1 : 2;
+}
+
+typedef struct {
+  jint class_number;
+  jint count;
+  jlong shallow;
+  jlong retained;
+} class_retained;
+
+static int compare_retained(const void *a, const void *b)
+{
+  const class_retained *c1 = a;
+  const class_retained *c2 = b;
+  if (c1->retained != c2->retained)
+    return c1->retained > c2->retained ? -1 : 1;
+  return c1->class_number - c2->class_number;
+}
+
+/* lj_retained_sizes(top, max_objects, timeout, jni_globals, max_edges)
+   returns the `top' classes (all if 0) by retained size:
+     {{name=, count=, shallow=, retained=}, ...,
+      total_bytes=, object_count=, truncated=}
+   The retained size of a class is the sum of the retained sizes of its
+   instances that aren't dominated by another instance of the class. */
+static int lj_retained_sizes(lua_State *L)
+{
+  heap_graph graph;
+  graph_limits limits;
+  dominator_tree tree;
+  class_retained *classes;
+  jlong *retained;
+  jlong total_bytes = 0;
+  jlong base;
+  int top;
+  int ok;
+  jint count = 0;
+  jint c;
+  jint v;
+  jint i;
+
+  top = luaL_optinteger(L, 1, GRAPH_DEFAULT_TOP);
+  check_graph_args(L, 2, &limits);
+  lua_settop(L, 0);
+
+  base = lj_tag_range_acquire("heap_graph");
+  if (!base)
+    return luaL_error(L, "All object tags are in use");
+  lj_err = build_graph(&graph, base, NULL, 0, NULL, &limits);
+  lj_check_jvmti_error(L);
+
+  ok = compute_dominators(&graph, &tree);
+  retained = malloc((graph.class_count ? graph.class_count : 1) * sizeof(jlong));
+  classes = calloc(graph.class_count ? graph.class_count : 1, sizeof(class_retained));
+  ok = ok && retained && classes && group_retained(&graph, &tree, graph.class_of, graph.class_count, retained);
+  if (!ok)
+  {
+    free(classes);
+    free(retained);
+    free_dominators(&tree);
+    free_graph(&graph);
+    return luaL_error(L, "Out of memory computing retained sizes");
+  }
+
+  for (c = 0; c < graph.class_count; ++c)
+  {
+    classes[c].class_number = c;
+    classes[c].retained = retained[c];
+  }
+  for (i = 1; i < tree.reached; ++i)
+  {
+    v = tree.order[i];
+    total_bytes += graph.sizes[v];
+    c = graph.class_of[v];
+    if (c >= 0)
+    {
+      classes[c].count++;
+      classes[c].shallow += graph.sizes[v];
+    }
+  }
+  qsort(classes, graph.class_count, sizeof(class_retained), compare_retained);
+  while (count < graph.class_count && classes[count].count > 0)
+    count++;
+  if (top <= 0 || top > count)
+    top = count;
+
+  lua_createtable(L, top, 3);
+  for (i = 0; i < top; ++i)
+  {
+    lua_createtable(L, 0, 4);
+    push_class_name(L, graph.classes[classes[i].class_number]);
+    lua_setfield(L, -2, "name");
+    lua_pushinteger(L, classes[i].count);
+    lua_setfield(L, -2, "count");
+    lua_pushnumber(L, (lua_Number)classes[i].shallow);
+    lua_setfield(L, -2, "shallow");
+    lua_pushnumber(L, (lua_Number)classes[i].retained);
+    lua_setfield(L, -2, "retained");
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_pushnumber(L, (lua_Number)total_bytes);
+  lua_setfield(L, -2, "total_bytes");
+  lua_pushinteger(L, tree.reached - 1);
+  lua_setfield(L, -2, "object_count");
+  if (graph_status_name(graph.status))
+  {
+    lua_pushstring(L, graph_status_name(graph.status));
+    lua_setfield(L, -2, "truncated");
+  }
+
+  free(classes);
+  free(retained);
+  free_dominators(&tree);
+  free_graph(&graph);
+
+  return 1;
+}
+
+/* lj_retained_size(objects, max_objects, timeout, jni_globals,
+   max_edges) returns the retained and shallow size of an object or a
+   table of objects, and the reason if the graph was incomplete. Objects
+   that are only reachable through the debugger have no retained size. */
+static int lj_retained_size(lua_State *L)
+{
+  heap_graph graph;
+  graph_limits limits;
+  dominator_tree tree;
+  jobject *objects;
+  jint *numbers;
+  jint *group;
+  jlong retained = 0;
+  jlong shallow = 0;
+  jlong base;
+  jint count;
+  jint i;
+  int ok;
+
+  check_graph_args(L, 2, &limits);
+  if (lua_istable(L, 1))
+  {
+    count = (jint)lua_rawlen(L, 1);
+    for (i = 0; i < count; ++i)
+    {
+      lua_rawgeti(L, 1, i + 1);
+      luaL_checkudata(L, -1, "jobject");
+      lua_pop(L, 1);
+    }
+  }
+  else
+  {
+    count = 1;
+    luaL_checkudata(L, 1, "jobject");
+  }
+
+  objects = malloc((count ? count : 1) * sizeof(jobject));
+  numbers = malloc((count ? count : 1) * sizeof(jint));
+  if (!objects || !numbers)
+  {
+    free(numbers);
+    free(objects);
+    return luaL_error(L, "Out of memory computing retained sizes");
+  }
+  if (lua_istable(L, 1))
+  {
+    for (i = 0; i < count; ++i)
+    {
+      lua_rawgeti(L, 1, i + 1);
+      objects[i] = *(jobject *)lua_touserdata(L, -1);
+      lua_pop(L, 1);
+    }
+  }
+  else
+  {
+    objects[0] = *(jobject *)lua_touserdata(L, 1);
+  }
+  lua_settop(L, 0);
+
+  base = lj_tag_range_acquire("heap_graph");
+  if (!base)
+  {
+    free(numbers);
+    free(objects);
+    return luaL_error(L, "All object tags are in use");
+  }
+  lj_err = build_graph(&graph, base, objects, count, numbers, &limits);
+  free(objects);
+  if (lj_err != JVMTI_ERROR_NONE)
+    free(numbers);
+  lj_check_jvmti_error(L);
+
+  ok = compute_dominators(&graph, &tree);
+  group = malloc((graph.object_count ? graph.object_count : 1) * sizeof(jint));
+  if (ok && group)
+  {
+    for (i = 0; i < graph.object_count; ++i)
+      group[i] = -1;
+    for (i = 0; i < count; ++i)
+      if (numbers[i] >= 0)
+        group[numbers[i]] = 0;
+    ok = group_retained(&graph, &tree, group, 1, &retained);
+  }
+  if (!ok || !group)
+  {
+    free(group);
+    free(numbers);
+    free_dominators(&tree);
+    free_graph(&graph);
+    return luaL_error(L, "Out of memory computing retained sizes");
+  }
+  for (i = 0; i < graph.object_count; ++i)
+    if (group[i] == 0)
+      shallow += graph.sizes[i];
+
+  lua_pushnumber(L, (lua_Number)retained);
+  lua_pushnumber(L, (lua_Number)shallow);
+  if (graph_status_name(graph.status))
+    lua_pushstring(L, graph_status_name(graph.status));
+  else
+    lua_pushnil(L);
+
+  free(group);
+  free(numbers);
+  free_dominators(&tree);
+  free_graph(&graph);
+
+  return 3;
+}
+
+void lj_heap_graph_register(lua_State *L)
+{
+  lua_register(L, "lj_why_alive",                  lj_why_alive);
+  lua_register(L, "lj_retained_sizes",             lj_retained_sizes);
+  lua_register(L, "lj_retained_size",              lj_retained_size);
+}
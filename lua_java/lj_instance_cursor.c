@@ -0,0 +1,327 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "myjni.h"
+#include "jni_util.h"
+#include "lua_interface.h"
+#include "lua_java.h"
+#include "java_bridge.h"
+#include "lj_internal.h"
+#include "lj_tag.h"
+
+/* Cursors over the instances of a class.
+
+   Opening a cursor numbers the instances by giving each a tag from the
+   cursor's tag range, base + index, in a single pass over the heap. No
+   references are created until a page is fetched, the tags move with
+   the objects so the numbering doesn't change with GC. Instances
+   collected in the meantime are nil in a page.
+
+   Instances already tagged by someone else keep their tag, the cursor
+   remembers it to find them.
+
+   Each fetched object gets its own global reference, as with
+   lj_get_class_instances(), so objects stay valid after the cursor is
+   closed or collected. Closing deletes the tags. */
+
+#define INSTANCE_CURSOR "lj_instance_cursor"
+
+/* instances numbered with a tag from someone else, by number */
+typedef struct {
+  jint *numbers;
+  jlong *tags;
+  jint count;
+  jint capacity;
+} other_tags;
+
+typedef struct {
+  jclass class;                 /* global reference */
+  jlong base;                   /* first tag, 0 once closed */
+  jint count;
+  other_tags others;
+} instance_cursor;
+
+typedef struct {
+  jlong base;                   /* 0 to only count */
+  jint count;
+  other_tags others;
+  int out_of_memory;            /* the iteration was aborted */
+} numbering;
+
+static jint heap_iter_number_item(jlong class_tag, jlong size, jlong *tag_ptr, jint length, void *user_data)
+{
+  numbering *num = user_data;
+  other_tags *others = &num->others;
+  jint capacity;
+  jint *numbers;
+  jlong *tags;
+
+  if (num->base && !*tag_ptr)
+  {
+    *tag_ptr = num->base + num->count;
+  }
+  else if (num->base)
+  {
+    if (others->count == others->capacity)
+    {
+      capacity = others->capacity ? others->capacity * 2 : 64;
+      numbers = realloc(others->numbers, capacity * sizeof(jint));
+      if (numbers)
+        others->numbers = numbers;
+      tags = numbers ? realloc(others->tags, capacity * sizeof(jlong)) : NULL;
+      if (!tags)
+      {
+        num->out_of_memory = 1;
+        return JVMTI_VISIT_ABORT;
+      }
+      others->tags = tags;
+      others->capacity = capacity;
+    }
+    others->numbers[others->count] = num->count;
+    others->tags[others->count++] = *tag_ptr;
+  }
+  num->count++;
+  return 0;
+}
+
+static void free_other_tags(other_tags *others)
+{
+  free(others->numbers);
+  free(others->tags);
+  memset(others, 0, sizeof(other_tags));
+}
+
+/* Tag of the instance numbered `number' (0-based) */
+static jlong instance_tag(instance_cursor *cursor, jint number)
+{
+  jint lo = 0;
+  jint hi = cursor->others.count;
+  jint mid;
+
+  /* numbers are in increasing order */
+  while (lo < hi)
+  {
+    mid = (lo + hi) / 2;
+    if (cursor->others.numbers[mid] < number)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo < cursor->others.count && cursor->others.numbers[lo] == number)
+    return cursor->others.tags[lo];
+  return cursor->base + number;
+}
+
+static jvmtiError number_instances(jclass class, numbering *num)
+{
+  jvmtiHeapCallbacks callbacks;
+
+  memset(&callbacks, 0, sizeof(jvmtiHeapCallbacks));
+  callbacks.heap_iteration_callback = &heap_iter_number_item;
+
+  return (*current_jvmti())->IterateThroughHeap(current_jvmti(), 0, class, &callbacks, num);
+}
+
+/* lj_count_instances(class) returns the number of instances of `class'
+   without tagging or referencing them */
+static int lj_count_instances(lua_State *L)
+{
+  jclass class;
+  numbering num;
+
+  class = *(jclass *)luaL_checkudata(L, 1, "jobject");
+  lua_pop(L, 1);
+
+  memset(&num, 0, sizeof(numbering));
+  lj_err = number_instances(class, &num);
+  lj_check_jvmti_error(L);
+
+  lua_pushinteger(L, num.count);
+
+  return 1;
+}
+
+static void close_cursor(instance_cursor *cursor)
+{
+  JNIEnv *jni = current_jni();
+
+  if (!cursor->base)
+    return;
+
+  lj_tag_range_release(cursor->base, cursor->class, 1);
+  cursor->base = 0;
+  free_other_tags(&cursor->others);
+  (*jni)->DeleteGlobalRef(jni, cursor->class);
+  cursor->class = NULL;
+}
+
+static instance_cursor *check_cursor(lua_State *L, int idx)
+{
+  instance_cursor *cursor = luaL_checkudata(L, idx, INSTANCE_CURSOR);
+  if (!cursor->base)
+    luaL_error(L, "Cursor is closed");
+  return cursor;
+}
+
+/* lj_open_instance_cursor(class) numbers the instances of `class' and
+   returns a cursor over them */
+static int lj_open_instance_cursor(lua_State *L)
+{
+  JNIEnv *jni = current_jni();
+  jclass class;
+  instance_cursor *cursor;
+  numbering num;
+
+  class = *(jclass *)luaL_checkudata(L, 1, "jobject");
+  lua_pop(L, 1);
+
+  memset(&num, 0, sizeof(numbering));
+  num.base = lj_tag_range_acquire("instance_cursor");
+  if (!num.base)
+    return luaL_error(L, "All object tags are in use");
+
+  lj_err = number_instances(class, &num);
+  if (lj_err == JVMTI_ERROR_NONE && num.out_of_memory)
+    lj_err = JVMTI_ERROR_OUT_OF_MEMORY;
+  if (lj_err != JVMTI_ERROR_NONE)
+  {
+    lj_tag_range_release(num.base, class, 1);
+    free_other_tags(&num.others);
+  }
+  lj_check_jvmti_error(L);
+
+  cursor = lua_newuserdata(L, sizeof(instance_cursor));
+  memset(cursor, 0, sizeof(instance_cursor));
+  cursor->class = (*jni)->NewGlobalRef(jni, class);
+  cursor->base = num.base;
+  cursor->count = num.count;
+  cursor->others = num.others;
+  luaL_setmetatable(L, INSTANCE_CURSOR);
+
+  return 1;
+}
+
+/* cursor:fetch(from, count) returns a table of the instances numbered
+   `from' to `from + count - 1' as raw jobjects, with the count in `n' */
+static int instance_cursor_fetch(lua_State *L)
+{
+  JNIEnv *jni = current_jni();
+  instance_cursor *cursor = check_cursor(L, 1);
+  lua_Integer from = luaL_checkinteger(L, 2);
+  lua_Integer count = luaL_optinteger(L, 3, cursor->count - from + 1);
+  jlong *tags;
+  jobject *obj_output = NULL;
+  jlong *tag_output = NULL;
+  jint output_count = 0;
+  char *placed;
+  jint number;
+  int i;
+  int j;
+
+  luaL_argcheck(L, from >= 1, 2, "out of range");
+  if (count > cursor->count - from + 1)
+    count = cursor->count - from + 1;
+  if (count < 0)
+    count = 0;
+  lua_settop(L, 0);
+
+  lua_createtable(L, (int)count, 1);
+  lua_pushinteger(L, count);
+  lua_setfield(L, -2, "n");
+  if (count == 0)
+    return 1;
+
+  tags = malloc(count * sizeof(jlong));
+  if (!tags)
+    return luaL_error(L, "Out of memory");
+  for (i = 0; i < count; ++i)
+    tags[i] = instance_tag(cursor, (jint)(from - 1 + i));
+  lj_err = (*current_jvmti())->GetObjectsWithTags(current_jvmti(), (jint)count, tags,
+                                                  &output_count, &obj_output, &tag_output);
+  if (lj_err != JVMTI_ERROR_NONE)
+    free(tags);
+  lj_check_jvmti_error(L);
+
+  /* objects are returned in any order, place them by tag */
+  placed = calloc(count, 1);
+  if (!placed)
+  {
+    for (i = 0; i < output_count; ++i)
+      (*jni)->DeleteLocalRef(jni, obj_output[i]);
+    if (obj_output)
+      free_jvmti_refs(current_jvmti(), obj_output, tag_output, (void *)-1);
+    free(tags);
+    return luaL_error(L, "Out of memory");
+  }
+  for (i = 0; i < output_count; ++i)
+  {
+    number = -1;
+    if (tag_output[i] >= cursor->base && tag_output[i] < cursor->base + cursor->count)
+    {
+      number = (jint)(tag_output[i] - cursor->base);
+    }
+    else
+    {
+      for (j = 0; j < count; ++j)
+      {
+        if (tags[j] == tag_output[i] && !placed[j] &&
+            (*jni)->IsInstanceOf(jni, obj_output[i], cursor->class))
+        {
+          number = (jint)(from - 1 + j);
+          break;
+        }
+      }
+    }
+    if (number < 0)
+    {
+      (*jni)->DeleteLocalRef(jni, obj_output[i]);
+      continue;
+    }
+    placed[number - from + 1] = 1;
+    new_jobject(L, (*jni)->NewGlobalRef(jni, obj_output[i]));
+    (*jni)->DeleteLocalRef(jni, obj_output[i]);
+    lua_rawseti(L, -2, (int)(number - from + 2));
+  }
+  free(placed);
+  free(tags);
+
+  if (obj_output)
+    free_jvmti_refs(current_jvmti(), obj_output, tag_output, (void *)-1);
+
+  return 1;
+}
+
+static int instance_cursor_close(lua_State *L)
+{
+  instance_cursor *cursor = luaL_checkudata(L, 1, INSTANCE_CURSOR);
+  close_cursor(cursor);
+  return 0;
+}
+
+static int instance_cursor_len(lua_State *L)
+{
+  instance_cursor *cursor = luaL_checkudata(L, 1, INSTANCE_CURSOR);
+  lua_pushinteger(L, cursor->count);
+  return 1;
+}
+
+void lj_instance_cursor_register(lua_State *L)
+{
+  if (luaL_newmetatable(L, INSTANCE_CURSOR))
+  {
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, instance_cursor_len);
+    lua_setfield(L, -2, "__len");
+    lua_pushcfunction(L, instance_cursor_close);
+    lua_setfield(L, -2, "__gc");
+    lua_pushcfunction(L, instance_cursor_fetch);
+    lua_setfield(L, -2, "fetch");
+    lua_pushcfunction(L, instance_cursor_close);
+    lua_setfield(L, -2, "close");
+  }
+  lua_pop(L, 1);
+
+  lua_register(L, "lj_count_instances",            lj_count_instances);
+  lua_register(L, "lj_open_instance_cursor",       lj_open_instance_cursor);
+}
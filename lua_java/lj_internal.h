@@ -2,6 +2,8 @@
 #define LJ_INTERNAL_H_
 
 #include "lua_java.h"
+#include "java_bridge.h"
+#include "lj_atomic.h"
 
 jobject get_current_java_thread();
 jvmtiEnv *current_jvmti();
@@ -10,7 +12,11 @@ JNIEnv *current_jni();
 void lj_check_jvmti_error_internal(lua_State *, const char *, int, const char *);
 #define lj_check_jvmti_error(L) lj_check_jvmti_error_internal(L, __FILE__, __LINE__, __FUNCTION__)
 
-extern jvmtiError lj_err;
+/* Fill in the type and modifiers of `field_id' if not known yet */
+jvmtiError lj_resolve_field_id(lj_field_id *field_id);
+
+/* per-thread so event callbacks on different threads don't clobber it */
+extern LJ_THREAD_LOCAL jvmtiError lj_err;
 
 #define EV_ENABLET(EVTYPE, EVTHR) \
   event_change(current_jvmti(), JVMTI_ENABLE, JVMTI_EVENT_##EVTYPE, (EVTHR))
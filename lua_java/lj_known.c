@@ -0,0 +1,182 @@
+#include <string.h>
+
+#include "myjni.h"
+#include "jni_util.h"
+#include "lua_interface.h"
+#include "lua_java.h"
+#include "java_bridge.h"
+#include "lj_internal.h"
+#include "lj_known.h"
+
+/* Cache of well-known classes and method IDs. The IDs are exposed to
+   Lua in the `lj_known' table, eg. lj_known.Class_getName. */
+
+lj_known_ids lj_known;
+
+static const struct {
+  const char *lua_name;
+  const char *class_name;
+  jclass *class;
+} known_classes[] = {
+  {"Object",    "java/lang/Object",    &lj_known.Object},
+  {"Class",     "java/lang/Class",     &lj_known.Class},
+  {"Thread",    "java/lang/Thread",    &lj_known.Thread},
+  {"String",    "java/lang/String",    &lj_known.String},
+  {"Boolean",   "java/lang/Boolean",   &lj_known.Boolean},
+  {"Byte",      "java/lang/Byte",      &lj_known.Byte},
+  {"Character", "java/lang/Character", &lj_known.Character},
+  {"Short",     "java/lang/Short",     &lj_known.Short},
+  {"Integer",   "java/lang/Integer",   &lj_known.Integer},
+  {"Long",      "java/lang/Long",      &lj_known.Long},
+  {"Float",     "java/lang/Float",     &lj_known.Float},
+  {"Double",    "java/lang/Double",    &lj_known.Double},
+};
+
+static const struct {
+  const char *lua_name;
+  jclass *class;
+  const char *name;
+  const char *sig;
+  int is_static;
+  jmethodID *method_id;
+} known_methods[] = {
+  {"Object_getClass",        &lj_known.Object, "getClass",         "()Ljava/lang/Class;",    0, &lj_known.Object_getClass},
+  {"Object_toString",        &lj_known.Object, "toString",         "()Ljava/lang/String;",   0, &lj_known.Object_toString},
+  {"Object_hashCode",        &lj_known.Object, "hashCode",         "()I",                    0, &lj_known.Object_hashCode},
+  {"Class_getName",          &lj_known.Class,  "getName",          "()Ljava/lang/String;",   0, &lj_known.Class_getName},
+  {"Class_getSuperclass",    &lj_known.Class,  "getSuperclass",    "()Ljava/lang/Class;",    0, &lj_known.Class_getSuperclass},
+  {"Class_getInterfaces",    &lj_known.Class,  "getInterfaces",    "()[Ljava/lang/Class;",   0, &lj_known.Class_getInterfaces},
+  {"Class_isAssignableFrom", &lj_known.Class,  "isAssignableFrom", "(Ljava/lang/Class;)Z",   0, &lj_known.Class_isAssignableFrom},
+  {"Class_isArray",          &lj_known.Class,  "isArray",          "()Z",                    0, &lj_known.Class_isArray},
+  {"Thread_currentThread",   &lj_known.Thread, "currentThread",    "()Ljava/lang/Thread;",   1, &lj_known.Thread_currentThread},
+  {"Thread_getName",         &lj_known.Thread, "getName",          "()Ljava/lang/String;",   0, &lj_known.Thread_getName},
+
+  {"Boolean_valueOf",      &lj_known.Boolean,   "valueOf",      "(Z)Ljava/lang/Boolean;",   1, &lj_known.Boolean_valueOf},
+  {"Boolean_booleanValue", &lj_known.Boolean,   "booleanValue", "()Z",                      0, &lj_known.Boolean_booleanValue},
+  {"Byte_valueOf",         &lj_known.Byte,      "valueOf",      "(B)Ljava/lang/Byte;",      1, &lj_known.Byte_valueOf},
+  {"Byte_byteValue",       &lj_known.Byte,      "byteValue",    "()B",                      0, &lj_known.Byte_byteValue},
+  {"Character_valueOf",    &lj_known.Character, "valueOf",      "(C)Ljava/lang/Character;", 1, &lj_known.Character_valueOf},
+  {"Character_charValue",  &lj_known.Character, "charValue",    "()C",                      0, &lj_known.Character_charValue},
+  {"Short_valueOf",        &lj_known.Short,     "valueOf",      "(S)Ljava/lang/Short;",     1, &lj_known.Short_valueOf},
+  {"Short_shortValue",     &lj_known.Short,     "shortValue",   "()S",                      0, &lj_known.Short_shortValue},
+  {"Integer_valueOf",      &lj_known.Integer,   "valueOf",      "(I)Ljava/lang/Integer;",   1, &lj_known.Integer_valueOf},
+  {"Integer_intValue",     &lj_known.Integer,   "intValue",     "()I",                      0, &lj_known.Integer_intValue},
+  {"Long_valueOf",         &lj_known.Long,      "valueOf",      "(J)Ljava/lang/Long;",      1, &lj_known.Long_valueOf},
+  {"Long_longValue",       &lj_known.Long,      "longValue",    "()J",                      0, &lj_known.Long_longValue},
+  {"Float_valueOf",        &lj_known.Float,     "valueOf",      "(F)Ljava/lang/Float;",     1, &lj_known.Float_valueOf},
+  {"Float_floatValue",     &lj_known.Float,     "floatValue",   "()F",                      0, &lj_known.Float_floatValue},
+  {"Double_valueOf",       &lj_known.Double,    "valueOf",      "(D)Ljava/lang/Double;",    1, &lj_known.Double_valueOf},
+  {"Double_doubleValue",   &lj_known.Double,    "doubleValue",  "()D",                      0, &lj_known.Double_doubleValue},
+};
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+/* All of these are in java.lang and loaded by the bootstrap loader,
+   so a failure here means something is very wrong */
+void lj_known_init(JNIEnv *jni)
+{
+  jclass class;
+  size_t i;
+
+  if (lj_known.Object)
+    return;
+
+  for (i = 0; i < COUNT(known_classes); ++i)
+  {
+    class = (*jni)->FindClass(jni, known_classes[i].class_name);
+    EXCEPTION_CHECK(jni);
+    assert(class);
+    *known_classes[i].class = (*jni)->NewGlobalRef(jni, class);
+    (*jni)->DeleteLocalRef(jni, class);
+  }
+
+  for (i = 0; i < COUNT(known_methods); ++i)
+  {
+    if (known_methods[i].is_static)
+      *known_methods[i].method_id = (*jni)->GetStaticMethodID(jni, *known_methods[i].class,
+                                                             known_methods[i].name,
+                                                             known_methods[i].sig);
+    else
+      *known_methods[i].method_id = (*jni)->GetMethodID(jni, *known_methods[i].class,
+                                                       known_methods[i].name,
+                                                       known_methods[i].sig);
+    EXCEPTION_CHECK(jni);
+    assert(*known_methods[i].method_id);
+  }
+}
+
+/* lj_get_object_class(object) returns the class of `object' and its
+   name, in one call for wrapping objects */
+static int lj_get_object_class(lua_State *L)
+{
+  JNIEnv *jni = current_jni();
+  jobject object;
+  jclass class;
+  jstring name;
+
+  object = *(jobject *)luaL_checkudata(L, 1, "jobject");
+  lua_pop(L, 1);
+
+  class = (*jni)->GetObjectClass(jni, object);
+  EXCEPTION_CHECK(jni);
+  if (class == NULL)
+  {
+    lua_pushnil(L);
+    return 1;
+  }
+
+  name = (jstring)(*jni)->CallObjectMethod(jni, class, lj_known.Class_getName);
+  EXCEPTION_CHECK(jni);
+
+  new_jobject(L, class);
+  if (name)
+  {
+    new_string(L, jni, name);
+    (*jni)->DeleteLocalRef(jni, name);
+  }
+  else
+  {
+    lua_pushnil(L);
+  }
+
+  return 2;
+}
+
+/* lj_is_instance_of(object, class) */
+static int lj_is_instance_of(lua_State *L)
+{
+  JNIEnv *jni = current_jni();
+  jobject object;
+  jclass class;
+
+  object = *(jobject *)luaL_checkudata(L, 1, "jobject");
+  class = *(jclass *)luaL_checkudata(L, 2, "jobject");
+  lua_pop(L, 2);
+
+  lua_pushboolean(L, (*jni)->IsInstanceOf(jni, object, class));
+
+  return 1;
+}
+
+void lj_known_register(lua_State *L)
+{
+  size_t i;
+
+  lj_known_init(current_jni());
+
+  lua_newtable(L);
+  for (i = 0; i < COUNT(known_classes); ++i)
+  {
+    new_jobject(L, *known_classes[i].class);
+    lua_setfield(L, -2, known_classes[i].lua_name);
+  }
+  for (i = 0; i < COUNT(known_methods); ++i)
+  {
+    new_jmethod_id(L, *known_methods[i].method_id);
+    lua_setfield(L, -2, known_methods[i].lua_name);
+  }
+  lua_setglobal(L, "lj_known");
+
+  lua_register(L, "lj_get_object_class",           lj_get_object_class);
+  lua_register(L, "lj_is_instance_of",             lj_is_instance_of);
+}
@@ -0,0 +1,56 @@
+#ifndef LJ_KNOWN_H_
+#define LJ_KNOWN_H_
+
+#include "lua_java.h"
+
+/* Well-known classes (as global references) and method IDs, looked up
+   once at startup by lj_known_init(). */
+typedef struct {
+  jclass Object;
+  jclass Class;
+  jclass Thread;
+  jclass String;
+  jclass Boolean;
+  jclass Byte;
+  jclass Character;
+  jclass Short;
+  jclass Integer;
+  jclass Long;
+  jclass Float;
+  jclass Double;
+
+  jmethodID Object_getClass;
+  jmethodID Object_toString;
+  jmethodID Object_hashCode;
+  jmethodID Class_getName;
+  jmethodID Class_getSuperclass;
+  jmethodID Class_getInterfaces;
+  jmethodID Class_isAssignableFrom;
+  jmethodID Class_isArray;
+  jmethodID Thread_currentThread;
+  jmethodID Thread_getName;
+
+  /* boxing and unboxing */
+  jmethodID Boolean_valueOf;
+  jmethodID Boolean_booleanValue;
+  jmethodID Byte_valueOf;
+  jmethodID Byte_byteValue;
+  jmethodID Character_valueOf;
+  jmethodID Character_charValue;
+  jmethodID Short_valueOf;
+  jmethodID Short_shortValue;
+  jmethodID Integer_valueOf;
+  jmethodID Integer_intValue;
+  jmethodID Long_valueOf;
+  jmethodID Long_longValue;
+  jmethodID Float_valueOf;
+  jmethodID Float_floatValue;
+  jmethodID Double_valueOf;
+  jmethodID Double_doubleValue;
+} lj_known_ids;
+
+extern lj_known_ids lj_known;
+
+void lj_known_init(JNIEnv *jni);
+
+#endif /* LJ_KNOWN_H_ */
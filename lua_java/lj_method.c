@@ -8,6 +8,7 @@
 #include "lua_java.h"
 #include "java_bridge.h"
 #include "lj_internal.h"
+#include "lj_method_cache.h"
 
 /* Lua wrappers for method operations */
 
@@ -52,107 +53,118 @@ static int lj_get_method_id(lua_State *L)
   return 1;
 }
 
-static int lj_get_local_variable_table(lua_State *L)
+static void push_local_variable_table(lua_State *L, const lj_method_info *info)
 {
-  jmethodID method_id;
-  jvmtiLocalVariableEntry *vars = NULL;
-  jint count;
   int i;
 
-  method_id = *(jmethodID *)luaL_checkudata(L, 1, "jmethod_id");
-  lua_pop(L, 1);
-
-  lj_err = (*current_jvmti())->GetLocalVariableTable(current_jvmti(), method_id, &count, &vars);
-  if (lj_err == JVMTI_ERROR_ABSENT_INFORMATION ||
-	  lj_err == JVMTI_ERROR_NATIVE_METHOD)
+  if (!info->vars)
   {
     lua_pushnil(L);
-    return 1;
+    return;
   }
-  lj_check_jvmti_error(L);
 
   lua_newtable(L);
 
-  for (i = 0; i < count; ++i)
+  for (i = 0; i < info->var_count; ++i)
   {
     /* create the var entry */
     lua_newtable(L);
 
-    lua_pushstring(L, vars[i].name);
+    lua_pushstring(L, info->vars[i].name);
     lua_setfield(L, -2, "name");
 
-    lua_pushstring(L, vars[i].signature);
+    lua_pushstring(L, info->vars[i].sig);
     lua_setfield(L, -2, "sig");
 
-    lua_pushinteger(L, vars[i].start_location);
+    lua_pushinteger(L, info->vars[i].start_location);
     lua_setfield(L, -2, "start_location");
 
-    lua_pushinteger(L, vars[i].slot);
+    lua_pushinteger(L, info->vars[i].length);
+    lua_setfield(L, -2, "length");
+
+    lua_pushinteger(L, info->vars[i].slot);
     lua_setfield(L, -2, "slot");
 
     /* add it to the return table */
-    lua_setfield(L, -2, vars[i].name);
+    lua_setfield(L, -2, info->vars[i].name);
   }
+}
 
-  if (count)
-	free_jvmti_refs(current_jvmti(), vars, (void *)-1);
+static void push_line_number_table(lua_State *L, const lj_method_info *info)
+{
+  int i;
 
-  return 1;
+  if (!info->lines)
+  {
+    lua_pushnil(L);
+    return;
+  }
+
+  lua_newtable(L);
+  for (i = 0; i < info->line_count; ++i)
+  {
+    lua_newtable(L);
+    lua_pushinteger(L, info->lines[i].location);
+    lua_setfield(L, -2, "location");
+    lua_pushinteger(L, info->lines[i].line_num);
+    lua_setfield(L, -2, "line_num");
+    lua_rawseti(L, -2, i+1);
+  }
 }
 
-static int lj_get_line_number_table(lua_State *L)
+static lj_method_info *check_method_info(lua_State *L, int idx)
 {
   jmethodID method_id;
-  jint line_count;
-  jvmtiLineNumberEntry *lines = NULL;
-  int i;
+  lj_method_info *info;
 
-  method_id = *(jmethodID *)luaL_checkudata(L, 1, "jmethod_id");
+  method_id = *(jmethodID *)luaL_checkudata(L, idx, "jmethod_id");
+  info = lj_method_info_acquire(current_jni(), method_id, &lj_err);
+  lj_check_jvmti_error(L);
+
+  return info;
+}
+
+static int lj_get_local_variable_table(lua_State *L)
+{
+  lj_method_info *info;
+
+  info = check_method_info(L, 1);
   lua_pop(L, 1);
 
-  lj_err = (*current_jvmti())->GetLineNumberTable(current_jvmti(), method_id, &line_count, &lines);
-  if (lj_err == JVMTI_ERROR_NATIVE_METHOD ||
-      lj_err == JVMTI_ERROR_ABSENT_INFORMATION) {
-    lua_pushnil(L);
-  } else {
-    lua_newtable(L);
-    for (i = 0; i < line_count; ++i)
-    {
-      lua_newtable(L);
-      lua_pushinteger(L, lines[i].start_location);
-      lua_setfield(L, -2, "location");
-      lua_pushinteger(L, lines[i].line_number);
-      lua_setfield(L, -2, "line_num");
-      lua_rawseti(L, -2, i+1);
-    }
-    lj_check_jvmti_error(L);
+  push_local_variable_table(L, info);
+  lj_method_info_release(info);
 
-	free_jvmti_refs(current_jvmti(), lines, (void *)-1);
-  }
+  return 1;
+}
+
+static int lj_get_line_number_table(lua_State *L)
+{
+  lj_method_info *info;
+
+  info = check_method_info(L, 1);
+  lua_pop(L, 1);
+
+  push_line_number_table(L, info);
+  lj_method_info_release(info);
 
   return 1;
 }
 
 static int lj_get_method_name(lua_State *L)
 {
-  jmethodID method_id;
-  char *method_name = NULL;
-  char *sig = NULL;
+  lj_method_info *info;
 
-  method_id = *(jmethodID *)luaL_checkudata(L, 1, "jmethod_id");
+  info = check_method_info(L, 1);
   lua_pop(L, 1);
 
-  lj_err = (*current_jvmti())->GetMethodName(current_jvmti(), method_id, &method_name, &sig, NULL);
-  lj_check_jvmti_error(L);
-
   lua_newtable(L);
 
-  lua_pushstring(L, method_name);
+  lua_pushstring(L, info->name);
   lua_setfield(L, -2, "name");
-  lua_pushstring(L, sig);
+  lua_pushstring(L, info->sig);
   lua_setfield(L, -2, "sig");
 
-  free_jvmti_refs(current_jvmti(), method_name, sig, (void *)-1);
+  lj_method_info_release(info);
 
   return 1;
 }
@@ -189,13 +201,8 @@ static int lj_get_method_modifiers(lua_State *L)
   return 1;
 }
 
-static int lj_get_method_modifiers_table(lua_State *L)
+static void push_modifiers_table(lua_State *L, lua_Integer modifiers)
 {
-  lua_Integer modifiers;
-
-  modifiers = luaL_checkinteger(L, 1);
-  lua_pop(L, 1);
-
   lua_newtable(L);
 
   /* http://docs.oracle.com/javase/specs/jvms/se7/html/jvms-4.html#jvms-4.6 */
@@ -225,12 +232,169 @@ static int lj_get_method_modifiers_table(lua_State *L)
   lua_setfield(L, -2, "strict");
   lua_pushboolean(L, modifiers & JVM_ACC_SYNTHETIC);
   lua_setfield(L, -2, "synthetic");
+}
+
+static int lj_get_method_modifiers_table(lua_State *L)
+{
+  lua_Integer modifiers;
+
+  modifiers = luaL_checkinteger(L, 1);
+  lua_pop(L, 1);
+
+  push_modifiers_table(L, modifiers);
+
+  return 1;
+}
+
+/* Read-only views of method info tables. The view is an empty table so
+   every assignment reaches __newindex, reads go to the table in the
+   __index field of its metatable. */
+
+static void push_proxied(lua_State *L, int idx)
+{
+  lua_getmetatable(L, idx);
+  lua_getfield(L, -1, "__index");
+  lua_remove(L, -2);
+}
+
+static int readonly_newindex(lua_State *L)
+{
+  return luaL_error(L, "Method info is shared and can't be modified");
+}
+
+static int readonly_len(lua_State *L)
+{
+  push_proxied(L, 1);
+  lua_pushinteger(L, lua_rawlen(L, -1));
+  return 1;
+}
+
+static int readonly_next(lua_State *L)
+{
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_settop(L, 2);
+  if (lua_next(L, 1))
+    return 2;
+  lua_pushnil(L);
+  return 1;
+}
+
+static int readonly_pairs(lua_State *L)
+{
+  lua_pushcfunction(L, readonly_next);
+  push_proxied(L, 1);
+  lua_pushnil(L);
+  return 3;
+}
+
+static int readonly_inext(lua_State *L)
+{
+  lua_Integer i = luaL_checkinteger(L, 2) + 1;
+  lua_pushinteger(L, i);
+  lua_rawgeti(L, 1, i);
+  return lua_isnil(L, -1) ? 1 : 2;
+}
+
+static int readonly_ipairs(lua_State *L)
+{
+  lua_pushcfunction(L, readonly_inext);
+  push_proxied(L, 1);
+  lua_pushinteger(L, 0);
+  return 3;
+}
+
+/* replace the table on the top of the stack with a read-only view */
+static void set_readonly(lua_State *L)
+{
+  lua_newtable(L);
+  lua_createtable(L, 0, 5);
+  lua_pushvalue(L, -3);
+  lua_setfield(L, -2, "__index");
+  lua_pushcfunction(L, readonly_newindex);
+  lua_setfield(L, -2, "__newindex");
+  lua_pushcfunction(L, readonly_len);
+  lua_setfield(L, -2, "__len");
+  lua_pushcfunction(L, readonly_pairs);
+  lua_setfield(L, -2, "__pairs");
+  lua_pushcfunction(L, readonly_ipairs);
+  lua_setfield(L, -2, "__ipairs");
+  lua_setmetatable(L, -2);
+  lua_remove(L, -2);
+}
+
+/* lj_get_method_info(method_id) returns a read-only table with all the
+   metadata of the method. The table is built from the method cache and
+   shared by all callers while it's in use, the per-state cache has
+   weak values so tables no one refers to are collected. */
+static int lj_get_method_info(lua_State *L)
+{
+  jmethodID method_id;
+  lj_method_info *info;
+
+  info = check_method_info(L, 1);
+  method_id = info->method_id;
+  lua_pop(L, 1);
+
+  lua_getfield(L, LUA_REGISTRYINDEX, "yellow_tree_method_info");
+  lua_pushlightuserdata(L, method_id);
+  lua_rawget(L, -2);
+  if (lua_istable(L, -1))
+  {
+    lua_getfield(L, -1, "serial");
+    if ((uint32_t)lua_tointeger(L, -1) == info->serial)
+    {
+      lj_method_info_release(info);
+      lua_pop(L, 1);
+      lua_remove(L, -2);
+      return 1;
+    }
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+
+  lua_newtable(L);
+  lua_pushinteger(L, info->serial);
+  lua_setfield(L, -2, "serial");
+  lua_pushstring(L, info->name);
+  lua_setfield(L, -2, "name");
+  lua_pushstring(L, info->sig);
+  lua_setfield(L, -2, "sig");
+  lua_pushstring(L, info->args);
+  lua_setfield(L, -2, "args");
+  lua_pushstring(L, info->ret);
+  lua_setfield(L, -2, "ret");
+  push_modifiers_table(L, info->modifiers);
+  set_readonly(L);
+  lua_setfield(L, -2, "modifiers");
+  push_line_number_table(L, info);
+  if (lua_istable(L, -1))
+    set_readonly(L);
+  lua_setfield(L, -2, "line_number_table");
+  push_local_variable_table(L, info);
+  if (lua_istable(L, -1))
+    set_readonly(L);
+  lua_setfield(L, -2, "local_variable_table");
+  set_readonly(L);
+  lj_method_info_release(info);
+
+  /* cache it */
+  lua_pushlightuserdata(L, method_id);
+  lua_pushvalue(L, -2);
+  lua_rawset(L, -4);
+  lua_remove(L, -2);
 
   return 1;
 }
 
 void lj_method_register(lua_State *L)
 {
+  lua_newtable(L);
+  lua_createtable(L, 0, 1);
+  lua_pushliteral(L, "v");
+  lua_setfield(L, -2, "__mode");
+  lua_setmetatable(L, -2);
+  lua_setfield(L, LUA_REGISTRYINDEX, "yellow_tree_method_info");
+
   lua_register(L, "lj_get_method_id",              lj_get_method_id);
   lua_register(L, "lj_get_local_variable_table",   lj_get_local_variable_table);
   lua_register(L, "lj_get_line_number_table",      lj_get_line_number_table);
@@ -238,4 +402,5 @@ void lj_method_register(lua_State *L)
   lua_register(L, "lj_get_method_declaring_class", lj_get_method_declaring_class);
   lua_register(L, "lj_get_method_modifiers",       lj_get_method_modifiers);
   lua_register(L, "lj_get_method_modifiers_table", lj_get_method_modifiers_table);
+  lua_register(L, "lj_get_method_info",            lj_get_method_info);
 }
@@ -0,0 +1,356 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "myjni.h"
+#include "jni_util.h"
+#include "lua_interface.h"
+#include "lua_java.h"
+#include "java_bridge.h"
+#include "lj_internal.h"
+#include "lj_method_cache.h"
+
+/* Cache of method metadata keyed by jmethodID. Entries are filled
+   lazily, on first use, and shared by all Lua states.
+
+   An entry is dropped when it's found to be out of date:
+    - the declaring class has been unloaded (the weak reference to it
+      is cleared), or
+    - lj_method_cache_invalidate() was called since it was filled,
+      which bumps `method_cache_generation'.
+
+   Redefined classes get new line and local variable tables for the
+   same method IDs. The agent doesn't redefine classes itself (it
+   doesn't have the capability), anything redefining classes through
+   another environment must call lj_clear_method_cache(). Watching for
+   redefinition with ClassFileLoadHook would slow every class load for
+   the whole session.
+
+   All access to the table is done while holding `method_cache_lock'.
+   Entries in use are reference counted, the last user frees a dropped
+   entry. */
+
+#define METHOD_CACHE_TABLE_SIZE 1024 /* must be a power of 2 */
+
+static lj_method_info *method_cache_table[METHOD_CACHE_TABLE_SIZE];
+static jrawMonitorID method_cache_lock;
+static volatile uint32_t method_cache_generation;
+static volatile uint32_t method_cache_serial;
+
+static unsigned int method_cache_hash(jmethodID method_id)
+{
+  uintptr_t h = (uintptr_t)method_id;
+  h ^= h >> 4;
+  h ^= h >> 16;
+  return (unsigned int)(h & (METHOD_CACHE_TABLE_SIZE - 1));
+}
+
+static void lock_method_cache()
+{
+  jvmtiError err = (*current_jvmti())->RawMonitorEnter(current_jvmti(), method_cache_lock);
+  assert(err == JVMTI_ERROR_NONE);
+  (void)err;
+}
+
+static void unlock_method_cache()
+{
+  jvmtiError err = (*current_jvmti())->RawMonitorExit(current_jvmti(), method_cache_lock);
+  assert(err == JVMTI_ERROR_NONE);
+  (void)err;
+}
+
+static void free_method_info(JNIEnv *jni, lj_method_info *info)
+{
+  int i;
+
+  for (i = 0; i < info->var_count; ++i)
+  {
+    free(info->vars[i].name);
+    free(info->vars[i].sig);
+  }
+  free(info->vars);
+  free(info->lines);
+  free(info->name);
+  free(info->sig);
+  free(info->args);
+  free(info->ret);
+  free(info->arg_codes);
+  free(info->class_name);
+  free(info->source_file);
+  if (info->class)
+    (*jni)->DeleteWeakGlobalRef(jni, info->class);
+  free(info);
+}
+
+/* must be called with method_cache_lock held */
+static void unlink_method_info(JNIEnv *jni, lj_method_info *info)
+{
+  lj_method_info **p = &method_cache_table[method_cache_hash(info->method_id)];
+  while (*p != info)
+    p = &(*p)->next;
+  *p = info->next;
+  info->next = NULL;
+  info->stale = 1;
+  if (info->refcount == 0)
+    free_method_info(jni, info);
+}
+
+/* must be called with method_cache_lock held */
+static lj_method_info *find_method_info(JNIEnv *jni, jmethodID method_id)
+{
+  lj_method_info *info = method_cache_table[method_cache_hash(method_id)];
+  while (info && info->method_id != method_id)
+    info = info->next;
+  if (info && (info->generation != lj_atomic_load_acquire(&method_cache_generation) ||
+               (*jni)->IsSameObject(jni, info->class, NULL)))
+  {
+    unlink_method_info(jni, info);
+    info = NULL;
+  }
+  return info;
+}
+
+/* Reduce each descriptor in `args' to a type code */
+static void parse_arg_codes(lj_method_info *info)
+{
+  const char *p = info->args;
+  int count = 0;
+
+  info->arg_codes = malloc(strlen(info->args) + 1);
+  while (*p)
+  {
+    if (*p == '[' || *p == 'L')
+    {
+      while (*p == '[')
+        p++;
+      if (*p == 'L')
+        p = strchr(p, ';');
+      info->arg_codes[count++] = 'L';
+    }
+    else
+    {
+      info->arg_codes[count++] = *p;
+    }
+    p++;
+  }
+  info->arg_codes[count] = 0;
+  info->arg_count = count;
+}
+
+static int compare_line_entry(const void *a, const void *b)
+{
+  const lj_line_entry *l1 = a;
+  const lj_line_entry *l2 = b;
+  if (l1->location != l2->location)
+    return l1->location < l2->location ? -1 : 1;
+  return 0;
+}
+
+/* Fill a new entry from JVMTI, called without the lock */
+static lj_method_info *fill_method_info(JNIEnv *jni, jmethodID method_id, jvmtiError *err)
+{
+  jvmtiEnv *jvmti = current_jvmti();
+  lj_method_info *info;
+  char *name = NULL;
+  char *sig = NULL;
+  char *ret;
+  char *p;
+  jclass class;
+  jvmtiLineNumberEntry *lines = NULL;
+  jvmtiLocalVariableEntry *vars = NULL;
+  jint count;
+  int i;
+
+  info = calloc(1, sizeof(lj_method_info));
+  info->method_id = method_id;
+  info->generation = lj_atomic_load_acquire(&method_cache_generation);
+  info->serial = lj_atomic_fetch_add(&method_cache_serial, 1) + 1;
+
+  *err = (*jvmti)->GetMethodName(jvmti, method_id, &name, &sig, NULL);
+  if (*err != JVMTI_ERROR_NONE)
+    goto error;
+  info->name = strdup(name);
+  info->sig = strdup(sig);
+  free_jvmti_refs(jvmti, name, sig, (void *)-1);
+
+  /* split (args)ret */
+  ret = strchr(info->sig, ')');
+  assert(ret);
+  info->args = malloc(ret - info->sig);
+  memcpy(info->args, info->sig + 1, ret - info->sig - 1);
+  info->args[ret - info->sig - 1] = 0;
+  info->ret = strdup(ret + 1);
+  parse_arg_codes(info);
+  info->ret_code = (info->ret[0] == '[') ? 'L' : info->ret[0];
+  info->is_constructor = !strcmp(info->name, "<init>");
+
+  *err = (*jvmti)->GetMethodModifiers(jvmti, method_id, &info->modifiers);
+  if (*err != JVMTI_ERROR_NONE)
+    goto error;
+
+  *err = (*jvmti)->GetMethodDeclaringClass(jvmti, method_id, &class);
+  if (*err != JVMTI_ERROR_NONE)
+    goto error;
+  info->class = (*jni)->NewWeakGlobalRef(jni, class);
+
+  *err = (*jvmti)->GetClassSignature(jvmti, class, &sig, NULL);
+  if (*err != JVMTI_ERROR_NONE)
+  {
+    (*jni)->DeleteLocalRef(jni, class);
+    goto error;
+  }
+  /* Ljava/lang/Object; -> java.lang.Object */
+  info->class_name = strdup(sig[0] == 'L' ? sig + 1 : sig);
+  for (p = info->class_name; *p; ++p)
+  {
+    if (*p == '/')
+      *p = '.';
+    else if (*p == ';' && !p[1])
+      *p = 0;
+  }
+  free_jvmti_refs(jvmti, sig, (void *)-1);
+
+  if ((*jvmti)->GetSourceFileName(jvmti, class, &name) == JVMTI_ERROR_NONE)
+  {
+    info->source_file = strdup(name);
+    free_jvmti_refs(jvmti, name, (void *)-1);
+  }
+  (*jni)->DeleteLocalRef(jni, class);
+
+  if ((*jvmti)->GetLineNumberTable(jvmti, method_id, &count, &lines) == JVMTI_ERROR_NONE)
+  {
+    info->line_count = count;
+    info->lines = malloc(sizeof(lj_line_entry) * (count ? count : 1));
+    for (i = 0; i < count; ++i)
+    {
+      info->lines[i].location = lines[i].start_location;
+      info->lines[i].line_num = lines[i].line_number;
+    }
+    qsort(info->lines, count, sizeof(lj_line_entry), compare_line_entry);
+    free_jvmti_refs(jvmti, lines, (void *)-1);
+  }
+
+  if ((*jvmti)->GetLocalVariableTable(jvmti, method_id, &count, &vars) == JVMTI_ERROR_NONE)
+  {
+    info->var_count = count;
+    info->vars = malloc(sizeof(lj_local_var) * (count ? count : 1));
+    for (i = 0; i < count; ++i)
+    {
+      info->vars[i].name = strdup(vars[i].name);
+      info->vars[i].sig = strdup(vars[i].signature);
+      info->vars[i].start_location = vars[i].start_location;
+      info->vars[i].length = vars[i].length;
+      info->vars[i].slot = vars[i].slot;
+      free_jvmti_refs(jvmti, vars[i].name, vars[i].signature, vars[i].generic_signature, (void *)-1);
+    }
+    if (count)
+      free_jvmti_refs(jvmti, vars, (void *)-1);
+  }
+
+  *err = JVMTI_ERROR_NONE;
+  return info;
+
+error:
+  free_method_info(jni, info);
+  return NULL;
+}
+
+lj_method_info *lj_method_info_acquire(JNIEnv *jni, jmethodID method_id, jvmtiError *err)
+{
+  lj_method_info *info;
+  lj_method_info *existing;
+  unsigned int h = method_cache_hash(method_id);
+
+  *err = JVMTI_ERROR_NONE;
+
+  lock_method_cache();
+  info = find_method_info(jni, method_id);
+  if (info)
+    info->refcount++;
+  unlock_method_cache();
+  if (info)
+    return info;
+
+  /* fill without the lock, JVMTI may block */
+  info = fill_method_info(jni, method_id, err);
+  if (!info)
+    return NULL;
+
+  lock_method_cache();
+  /* another thread may have filled it in the meantime */
+  existing = find_method_info(jni, method_id);
+  if (existing)
+  {
+    existing->refcount++;
+  }
+  else
+  {
+    info->refcount++;
+    info->next = method_cache_table[h];
+    method_cache_table[h] = info;
+  }
+  unlock_method_cache();
+
+  if (existing)
+  {
+    free_method_info(jni, info);
+    info = existing;
+  }
+
+  return info;
+}
+
+void lj_method_info_release(lj_method_info *info)
+{
+  lock_method_cache();
+  info->refcount--;
+  if (info->refcount == 0 && info->stale)
+    free_method_info(current_jni(), info);
+  unlock_method_cache();
+}
+
+jint lj_method_info_line_number(const lj_method_info *info, jlocation location)
+{
+  int lo = 0;
+  int hi = info->line_count - 1;
+  int mid;
+
+  if (!info->lines || info->line_count == 0 || location < info->lines[0].location)
+    return -1;
+
+  /* last entry starting at or before `location' */
+  while (lo < hi)
+  {
+    mid = (lo + hi + 1) / 2;
+    if (info->lines[mid].location <= location)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+
+  return info->lines[lo].line_num;
+}
+
+void lj_method_cache_invalidate()
+{
+  lj_atomic_fetch_add(&method_cache_generation, 1);
+}
+
+/* lj_clear_method_cache() */
+static int lj_clear_method_cache(lua_State *L)
+{
+  lj_method_cache_invalidate();
+  return 0;
+}
+
+void lj_method_cache_register(lua_State *L)
+{
+  /* created once, this is also called for worker states */
+  if (!method_cache_lock)
+  {
+    lj_err = (*current_jvmti())->CreateRawMonitor(current_jvmti(), "yellow_tree_method_cache_lock", &method_cache_lock);
+    lj_check_jvmti_error(L);
+  }
+
+  lua_register(L, "lj_clear_method_cache",         lj_clear_method_cache);
+}
@@ -0,0 +1,67 @@
+#ifndef LJ_METHOD_CACHE_H_
+#define LJ_METHOD_CACHE_H_
+
+#include "lua_java.h"
+#include "lj_atomic.h"
+
+typedef struct {
+  jlocation location;
+  jint line_num;
+} lj_line_entry;
+
+typedef struct {
+  char *name;
+  char *sig;
+  jlocation start_location;
+  jint length;
+  jint slot;
+} lj_local_var;
+
+/* Metadata of a method. Filled once from JVMTI and not modified until
+   it is freed, so it can be read without holding any lock. */
+typedef struct lj_method_info {
+  jmethodID method_id;
+  char *name;
+  char *sig;
+  char *args;                   /* argument descriptors, without () */
+  char *ret;                    /* return descriptor */
+  jint modifiers;
+  char *class_name;             /* declaring class, eg. java.lang.Object */
+  char *source_file;            /* NULL if not available */
+  /* call plan: one type code per argument and for the return value,
+     objects and arrays are 'L' */
+  int arg_count;
+  char *arg_codes;
+  char ret_code;
+  int is_constructor;
+  /* sorted by location, NULL if not available */
+  jint line_count;
+  lj_line_entry *lines;
+  /* NULL if not available */
+  jint var_count;
+  lj_local_var *vars;
+  /* unique for each fill, so copies can check they are current */
+  uint32_t serial;
+
+  /* private to lj_method_cache.c */
+  jweak class;
+  uint32_t generation;
+  int refcount;
+  int stale;
+  struct lj_method_info *next;
+} lj_method_info;
+
+/* Get the cached metadata of `method_id', filling the cache if needed.
+   The result must be given back with lj_method_info_release(). NULL
+   and the error in `err' if the method can't be inspected. */
+lj_method_info *lj_method_info_acquire(JNIEnv *jni, jmethodID method_id, jvmtiError *err);
+void lj_method_info_release(lj_method_info *info);
+
+/* Line number of `location', -1 if not available */
+jint lj_method_info_line_number(const lj_method_info *info, jlocation location);
+
+/* Drop all cached metadata. Must be called after redefining or
+   retransforming classes. */
+void lj_method_cache_invalidate();
+
+#endif /* LJ_METHOD_CACHE_H_ */
@@ -0,0 +1,494 @@
+#include <stdlib.h>
+#include <string.h>
+#include <classfile_constants.h>
+
+#include "myjni.h"
+#include "jni_util.h"
+#include "lua_interface.h"
+#include "lua_java.h"
+#include "java_bridge.h"
+#include "lj_internal.h"
+#include "lj_context.h"
+#include "lj_known.h"
+#include "lj_heap.h"
+
+/* Object snapshots: all instance fields of an object read in one call.
+
+   The instance fields of each class, including inherited ones, are
+   enumerated once and kept in `layout_table'. A layout is found by the
+   identity hash of the class and holds a weak reference to it, layouts
+   of unloaded classes are dropped when found. Layouts are not modified
+   once added so they can be used without holding `layout_lock'. */
+
+#define LAYOUT_TABLE_SIZE 256 /* must be a power of 2 */
+
+#define DEFAULT_MAX_FIELDS 64
+#define DEFAULT_MAX_STRING 128
+#define DEFAULT_MAX_ELEMENTS 16
+#define MAX_DEPTH 32            /* each level uses C stack and ~3 Lua slots */
+
+typedef struct {
+  char *name;
+  char type;                    /* signature type, 'L' for objects and arrays */
+  jfieldID field_id;
+} layout_field;
+
+typedef struct class_layout {
+  jweak class;
+  jint hash;
+  char *name;                   /* as returned by Class.getName() */
+  char element_type;            /* arrays only, as `type' above */
+  int field_count;
+  layout_field *fields;         /* superclass fields first */
+  struct class_layout *next;
+} class_layout;
+
+typedef struct {
+  int max_fields;
+  int max_string;
+  int max_elements;
+} snapshot_limits;
+
+static class_layout *layout_table[LAYOUT_TABLE_SIZE];
+static jrawMonitorID layout_lock;
+
+static void lock_layouts()
+{
+  jvmtiError err = (*current_jvmti())->RawMonitorEnter(current_jvmti(), layout_lock);
+  assert(err == JVMTI_ERROR_NONE);
+  (void)err;
+}
+
+static void unlock_layouts()
+{
+  jvmtiError err = (*current_jvmti())->RawMonitorExit(current_jvmti(), layout_lock);
+  assert(err == JVMTI_ERROR_NONE);
+  (void)err;
+}
+
+static void free_layout(JNIEnv *jni, class_layout *layout)
+{
+  int i;
+  for (i = 0; i < layout->field_count; ++i)
+    free(layout->fields[i].name);
+  free(layout->fields);
+  free(layout->name);
+  if (layout->class)
+    (*jni)->DeleteWeakGlobalRef(jni, layout->class);
+  free(layout);
+}
+
+static jvmtiError add_class_fields(JNIEnv *jni, jclass class, class_layout *layout)
+{
+  jvmtiEnv *jvmti = current_jvmti();
+  jvmtiError err;
+  jclass super;
+  jint count;
+  jfieldID *fields = NULL;
+  layout_field *grown;
+  jint modifiers;
+  char *name;
+  char *sig;
+  int i;
+
+  /* superclass fields first */
+  super = (*jni)->GetSuperclass(jni, class);
+  if (super)
+  {
+    err = add_class_fields(jni, super, layout);
+    (*jni)->DeleteLocalRef(jni, super);
+    if (err != JVMTI_ERROR_NONE)
+      return err;
+  }
+
+  err = (*jvmti)->GetClassFields(jvmti, class, &count, &fields);
+  if (err != JVMTI_ERROR_NONE)
+    return err;
+
+  grown = realloc(layout->fields, sizeof(layout_field) * (layout->field_count + count + 1));
+  if (!grown)
+  {
+    if (fields)
+      free_jvmti_refs(jvmti, fields, (void *)-1);
+    return JVMTI_ERROR_OUT_OF_MEMORY;
+  }
+  layout->fields = grown;
+  for (i = 0; i < count; ++i)
+  {
+    if ((*jvmti)->GetFieldModifiers(jvmti, class, fields[i], &modifiers) != JVMTI_ERROR_NONE ||
+        (modifiers & JVM_ACC_STATIC))
+      continue;
+    if ((*jvmti)->GetFieldName(jvmti, class, fields[i], &name, &sig, NULL) != JVMTI_ERROR_NONE)
+      continue;
+    layout->fields[layout->field_count].name = strdup(name);
+    layout->fields[layout->field_count].type = (sig[0] == '[') ? 'L' : sig[0];
+    layout->fields[layout->field_count].field_id = fields[i];
+    layout->field_count++;
+    free_jvmti_refs(jvmti, name, sig, (void *)-1);
+  }
+
+  if (fields)
+    free_jvmti_refs(jvmti, fields, (void *)-1);
+
+  return JVMTI_ERROR_NONE;
+}
+
+static class_layout *build_layout(JNIEnv *jni, jclass class, jint hash, jvmtiError *err)
+{
+  jvmtiEnv *jvmti = current_jvmti();
+  class_layout *layout;
+  char *sig;
+
+  *err = (*jvmti)->GetClassSignature(jvmti, class, &sig, NULL);
+  if (*err != JVMTI_ERROR_NONE)
+    return NULL;
+
+  layout = calloc(1, sizeof(class_layout));
+  if (layout)
+    layout->name = lj_class_display_name(sig);
+  if (!layout || !layout->name)
+  {
+    free(layout);
+    free_jvmti_refs(jvmti, sig, (void *)-1);
+    *err = JVMTI_ERROR_OUT_OF_MEMORY;
+    return NULL;
+  }
+  layout->hash = hash;
+  if (sig[0] == '[')
+  {
+    layout->element_type = (sig[1] == '[') ? 'L' : sig[1];
+  }
+  else
+  {
+    *err = add_class_fields(jni, class, layout);
+    if (*err != JVMTI_ERROR_NONE)
+    {
+      free_jvmti_refs(jvmti, sig, (void *)-1);
+      free_layout(jni, layout);
+      return NULL;
+    }
+  }
+  free_jvmti_refs(jvmti, sig, (void *)-1);
+  layout->class = (*jni)->NewWeakGlobalRef(jni, class);
+
+  return layout;
+}
+
+/* must be called with layout_lock held */
+static class_layout *find_layout(JNIEnv *jni, jclass class, jint hash)
+{
+  class_layout **p = &layout_table[hash & (LAYOUT_TABLE_SIZE - 1)];
+  class_layout *layout;
+
+  while (*p)
+  {
+    layout = *p;
+    if ((*jni)->IsSameObject(jni, layout->class, NULL))
+    {
+      /* class unloaded */
+      *p = layout->next;
+      free_layout(jni, layout);
+      continue;
+    }
+    if (layout->hash == hash && (*jni)->IsSameObject(jni, layout->class, class))
+      return layout;
+    p = &layout->next;
+  }
+  return NULL;
+}
+
+static class_layout *get_layout(JNIEnv *jni, jclass class, jvmtiError *err)
+{
+  class_layout *layout;
+  class_layout *existing;
+  jint hash;
+
+  *err = (*current_jvmti())->GetObjectHashCode(current_jvmti(), class, &hash);
+  if (*err != JVMTI_ERROR_NONE)
+    return NULL;
+
+  lock_layouts();
+  layout = find_layout(jni, class, hash);
+  unlock_layouts();
+  if (layout)
+    return layout;
+
+  /* build without the lock, JVMTI may block */
+  layout = build_layout(jni, class, hash, err);
+  if (!layout)
+    return NULL;
+
+  lock_layouts();
+  existing = find_layout(jni, class, hash);
+  if (!existing)
+  {
+    layout->next = layout_table[hash & (LAYOUT_TABLE_SIZE - 1)];
+    layout_table[hash & (LAYOUT_TABLE_SIZE - 1)] = layout;
+  }
+  unlock_layouts();
+
+  if (existing)
+  {
+    free_layout(jni, layout);
+    layout = existing;
+  }
+
+  return layout;
+}
+
+static void push_string(lua_State *L, JNIEnv *jni, jstring string, const snapshot_limits *limits)
+{
+  jsize length = (*jni)->GetStringLength(jni, string);
+  jsize utf_length;
+  char *buf;
+  lj_arena_mark mark;
+
+  if (length <= limits->max_string)
+  {
+    new_string(L, jni, string);
+    return;
+  }
+
+  /* truncated copy, a UTF-8 char is at most 3 bytes in modified UTF-8 */
+  mark = lj_arena_get_mark();
+  buf = lj_arena_alloc((size_t)limits->max_string * 3 + 4);
+  if (!buf)
+  {
+    lj_arena_release(mark);
+    (void)luaL_error(L, "Out of memory");
+  }
+  (*jni)->GetStringUTFRegion(jni, string, 0, limits->max_string, buf);
+  EXCEPTION_CLEAR(jni);
+  utf_length = strlen(buf);
+  memcpy(buf + utf_length, "...", 4);
+  lua_pushstring(L, buf);
+  lj_arena_release(mark);
+}
+
+static void push_snapshot(lua_State *L, JNIEnv *jni, jobject object, int depth,
+                          const snapshot_limits *limits);
+
+/* push the value of a reference: a string or a snapshot */
+static void push_reference(lua_State *L, JNIEnv *jni, jobject object, int depth,
+                           const snapshot_limits *limits)
+{
+  if (object == NULL)
+  {
+    lua_pushnil(L);
+    return;
+  }
+  if ((*jni)->IsInstanceOf(jni, object, lj_known.String))
+  {
+    push_string(L, jni, object, limits);
+    (*jni)->DeleteLocalRef(jni, object);
+    return;
+  }
+  push_snapshot(L, jni, object, depth, limits);
+}
+
+static void push_field_value(lua_State *L, JNIEnv *jni, jobject object, const layout_field *field,
+                             int depth, const snapshot_limits *limits)
+{
+  switch (field->type)
+  {
+  case 'L':
+    push_reference(L, jni, (*jni)->GetObjectField(jni, object, field->field_id), depth, limits);
+    break;
+  case 'Z':
+    lua_pushboolean(L, (*jni)->GetBooleanField(jni, object, field->field_id));
+    break;
+  case 'B':
+    lua_pushinteger(L, (*jni)->GetByteField(jni, object, field->field_id));
+    break;
+  case 'C':
+    lua_pushinteger(L, (*jni)->GetCharField(jni, object, field->field_id));
+    break;
+  case 'S':
+    lua_pushinteger(L, (*jni)->GetShortField(jni, object, field->field_id));
+    break;
+  case 'I':
+    lua_pushinteger(L, (*jni)->GetIntField(jni, object, field->field_id));
+    break;
+  case 'J':
+    lua_pushinteger(L, (*jni)->GetLongField(jni, object, field->field_id));
+    break;
+  case 'F':
+    lua_pushnumber(L, (*jni)->GetFloatField(jni, object, field->field_id));
+    break;
+  case 'D':
+    lua_pushnumber(L, (*jni)->GetDoubleField(jni, object, field->field_id));
+    break;
+  default:
+    lua_pushnil(L);
+  }
+}
+
+#define PUSH_ELEMENTS(JTYPE, NAME, PUSH)                                \
+  {                                                                     \
+    JTYPE *buf = lj_arena_alloc(sizeof(JTYPE) * count);                 \
+    if (!buf)                                                           \
+    {                                                                   \
+      lj_arena_release(mark);                                           \
+      (void)luaL_error(L, "Out of memory");                             \
+    }                                                                   \
+    (*jni)->Get##NAME##ArrayRegion(jni, array, 0, count, buf);          \
+    for (i = 0; i < count; ++i)                                         \
+    {                                                                   \
+      PUSH(L, buf[i]);                                                  \
+      lua_rawseti(L, -2, i + 1);                                        \
+    }                                                                   \
+  }
+
+static void push_elements(lua_State *L, JNIEnv *jni, jarray array, char type, jsize length,
+                          int depth, const snapshot_limits *limits)
+{
+  lj_arena_mark mark = lj_arena_get_mark();
+  jsize count = length < limits->max_elements ? length : limits->max_elements;
+  jsize i;
+
+  luaL_checkstack(L, 4, "snapshot too deep");
+  lua_createtable(L, count, 0);
+  switch (type)
+  {
+  case 'L':
+    for (i = 0; i < count; ++i)
+    {
+      push_reference(L, jni, (*jni)->GetObjectArrayElement(jni, array, i), depth, limits);
+      lua_rawseti(L, -2, i + 1);
+    }
+    break;
+  case 'Z': PUSH_ELEMENTS(jboolean, Boolean, lua_pushboolean); break;
+  case 'B': PUSH_ELEMENTS(jbyte, Byte, lua_pushinteger); break;
+  case 'C': PUSH_ELEMENTS(jchar, Char, lua_pushinteger); break;
+  case 'S': PUSH_ELEMENTS(jshort, Short, lua_pushinteger); break;
+  case 'I': PUSH_ELEMENTS(jint, Int, lua_pushinteger); break;
+  case 'J': PUSH_ELEMENTS(jlong, Long, lua_pushinteger); break;
+  case 'F': PUSH_ELEMENTS(jfloat, Float, lua_pushnumber); break;
+  case 'D': PUSH_ELEMENTS(jdouble, Double, lua_pushnumber); break;
+  }
+  /* elements can be nil, `n' is the count */
+  lua_pushinteger(L, count);
+  lua_setfield(L, -2, "n");
+  lj_arena_release(mark);
+}
+
+/* Push a snapshot of `object':
+     {class=<name>, hash=<identity hash>, object_raw=<jobject>,
+      fields={{name=, value=}, ...}}       -- objects, if depth >= 0
+      length=<n>, elements={n=, ...}}      -- arrays, if depth >= 0
+   Referenced objects are snapshots with depth - 1, with only class,
+   hash and object_raw when the depth is exhausted. Strings are Lua
+   strings. */
+static void push_snapshot(lua_State *L, JNIEnv *jni, jobject object, int depth,
+                          const snapshot_limits *limits)
+{
+  class_layout *layout;
+  jclass class;
+  jvmtiError err;
+  jint hash = 0;
+  jsize length;
+  int count;
+  int i;
+
+  luaL_checkstack(L, 4, "snapshot too deep");
+  class = (*jni)->GetObjectClass(jni, object);
+  layout = get_layout(jni, class, &err);
+  (*jni)->DeleteLocalRef(jni, class);
+
+  lua_createtable(L, 0, 6);
+  new_jobject(L, object);
+  lua_setfield(L, -2, "object_raw");
+  if ((*current_jvmti())->GetObjectHashCode(current_jvmti(), object, &hash) == JVMTI_ERROR_NONE)
+  {
+    lua_pushinteger(L, hash);
+    lua_setfield(L, -2, "hash");
+  }
+  if (!layout)
+    return;
+  lua_pushstring(L, layout->name);
+  lua_setfield(L, -2, "class");
+
+  if (layout->element_type)
+  {
+    length = (*jni)->GetArrayLength(jni, object);
+    lua_pushinteger(L, length);
+    lua_setfield(L, -2, "length");
+    if (depth >= 0)
+    {
+      push_elements(L, jni, object, layout->element_type, length, depth - 1, limits);
+      lua_setfield(L, -2, "elements");
+    }
+    return;
+  }
+
+  if (depth < 0)
+    return;
+
+  count = layout->field_count < limits->max_fields ? layout->field_count : limits->max_fields;
+  lua_createtable(L, count, 0);
+  for (i = 0; i < count; ++i)
+  {
+    lua_createtable(L, 0, 2);
+    lua_pushstring(L, layout->fields[i].name);
+    lua_setfield(L, -2, "name");
+    push_field_value(L, jni, object, &layout->fields[i], depth - 1, limits);
+    lua_setfield(L, -2, "value");
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_setfield(L, -2, "fields");
+  if (count < layout->field_count)
+  {
+    lua_pushinteger(L, layout->field_count - count);
+    lua_setfield(L, -2, "more_fields");
+  }
+  EXCEPTION_CLEAR(jni);
+}
+
+static int opt_limit(lua_State *L, int idx, const char *name, int def)
+{
+  int value = def;
+  if (lua_istable(L, idx))
+  {
+    lua_getfield(L, idx, name);
+    if (lua_isnumber(L, -1))
+      value = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+  }
+  luaL_argcheck(L, value >= 0, idx, "limits must not be negative");
+  return value;
+}
+
+/* lj_snapshot_object(object, depth, limits) where limits is an
+   optional table of max_fields, max_string and max_elements. Depth 0
+   reads the fields of `object' only, at most MAX_DEPTH. */
+static int lj_snapshot_object(lua_State *L)
+{
+  JNIEnv *jni = current_jni();
+  jobject object;
+  int depth;
+  snapshot_limits limits;
+
+  object = *(jobject *)luaL_checkudata(L, 1, "jobject");
+  depth = luaL_optinteger(L, 2, 0);
+  luaL_argcheck(L, depth <= MAX_DEPTH, 2, "depth too large");
+  limits.max_fields = opt_limit(L, 3, "max_fields", DEFAULT_MAX_FIELDS);
+  limits.max_string = opt_limit(L, 3, "max_string", DEFAULT_MAX_STRING);
+  limits.max_elements = opt_limit(L, 3, "max_elements", DEFAULT_MAX_ELEMENTS);
+  lua_settop(L, 0);
+
+  push_snapshot(L, jni, object, depth, &limits);
+
+  return 1;
+}
+
+void lj_snapshot_register(lua_State *L)
+{
+  /* created once, this is also called for worker states */
+  if (!layout_lock)
+  {
+    lj_err = (*current_jvmti())->CreateRawMonitor(current_jvmti(), "yellow_tree_layout_lock", &layout_lock);
+    lj_check_jvmti_error(L);
+  }
+
+  lua_register(L, "lj_snapshot_object",            lj_snapshot_object);
+}
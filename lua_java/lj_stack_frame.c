@@ -1,6 +1,9 @@
+#include <stdlib.h>
+
 #include "lua_java.h"
 #include "java_bridge.h"
 #include "lj_internal.h"
+#include "lj_method_cache.h"
 
 static int lj_get_frame_count(lua_State *L)
 {
@@ -44,8 +47,164 @@ static int lj_get_stack_frame(lua_State *L)
   return 1;
 }
 
+/* lj_get_stack_trace(thread, start, max) returns an array of raw
+   frames starting at depth `start' (default 1). All frames are returned
+   if `max' isn't given. */
+static int lj_get_stack_trace(lua_State *L)
+{
+  jvmtiFrameInfo *fi;
+  jint count = 0;
+  jobject thread;
+  int start;
+  int max;
+  int i;
+
+  thread = *(jobject *)luaL_checkudata(L, 1, "jobject");
+  start = luaL_optinteger(L, 2, 1);
+  max = luaL_optinteger(L, 3, -1);
+  lua_settop(L, 0);
+
+  if (max < 0)
+  {
+    lj_err = (*current_jvmti())->GetFrameCount(current_jvmti(), thread, &max);
+    lj_check_jvmti_error(L);
+    max -= start - 1;
+  }
+  if (start < 1 || max <= 0)
+  {
+    lua_newtable(L);
+    return 1;
+  }
+
+  fi = malloc(max * sizeof(jvmtiFrameInfo));
+  if (!fi)
+    return luaL_error(L, "Out of memory");
+
+  lj_err = (*current_jvmti())->GetStackTrace(current_jvmti(), thread, start - 1, max, fi, &count);
+  if (lj_err == JVMTI_ERROR_ILLEGAL_ARGUMENT)
+  {
+    /* start is past the end of the stack */
+    lj_err = JVMTI_ERROR_NONE;
+    count = 0;
+  }
+  if (lj_err != JVMTI_ERROR_NONE)
+    free(fi);
+  lj_check_jvmti_error(L);
+
+  lua_createtable(L, count, 0);
+  for (i = 0; i < count; ++i)
+  {
+    lua_createtable(L, 0, 3);
+    lua_pushinteger(L, fi[i].location);
+    lua_setfield(L, -2, "location");
+    new_jmethod_id(L, fi[i].method);
+    lua_setfield(L, -2, "method_id_raw");
+    lua_pushinteger(L, start + i);
+    lua_setfield(L, -2, "depth");
+    lua_rawseti(L, -2, i + 1);
+  }
+  free(fi);
+
+  return 1;
+}
+
+/* Push the value of a local variable, returns 0 if it isn't available */
+static int push_local(lua_State *L, jthread thread, jint depth, const lj_local_var *var)
+{
+  jvmtiEnv *jvmti = current_jvmti();
+  jvmtiError err;
+  jint val_i;
+  jlong val_j;
+  jfloat val_f;
+  jdouble val_d;
+  jobject val_l;
+
+  switch (var->sig[0])
+  {
+  case 'Z':
+  case 'B':
+  case 'C':
+  case 'S':
+  case 'I':
+    err = (*jvmti)->GetLocalInt(jvmti, thread, depth, var->slot, &val_i);
+    if (err != JVMTI_ERROR_NONE)
+      return 0;
+    if (var->sig[0] == 'Z')
+      lua_pushboolean(L, val_i);
+    else
+      lua_pushinteger(L, val_i);
+    return 1;
+  case 'J':
+    err = (*jvmti)->GetLocalLong(jvmti, thread, depth, var->slot, &val_j);
+    if (err != JVMTI_ERROR_NONE)
+      return 0;
+    lua_pushinteger(L, val_j);
+    return 1;
+  case 'F':
+    err = (*jvmti)->GetLocalFloat(jvmti, thread, depth, var->slot, &val_f);
+    if (err != JVMTI_ERROR_NONE)
+      return 0;
+    lua_pushnumber(L, val_f);
+    return 1;
+  case 'D':
+    err = (*jvmti)->GetLocalDouble(jvmti, thread, depth, var->slot, &val_d);
+    if (err != JVMTI_ERROR_NONE)
+      return 0;
+    lua_pushnumber(L, val_d);
+    return 1;
+  case 'L':
+  case '[':
+    err = (*jvmti)->GetLocalObject(jvmti, thread, depth, var->slot, &val_l);
+    if (err != JVMTI_ERROR_NONE || val_l == NULL)
+      return 0;
+    new_jobject(L, val_l);
+    return 1;
+  }
+  return 0;
+}
+
+/* lj_get_frame_locals(thread, depth) returns a table of the local
+   variables in scope at the current location of the frame, by name.
+   Objects are raw jobjects, null and unavailable values are absent. */
+static int lj_get_frame_locals(lua_State *L)
+{
+  jobject thread;
+  int frame_num;
+  jmethodID method_id;
+  jlocation location;
+  lj_method_info *info;
+  const lj_local_var *var;
+  int i;
+
+  thread = *(jobject *)luaL_checkudata(L, 1, "jobject");
+  frame_num = luaL_checkinteger(L, 2);
+  lua_pop(L, 2);
+
+  lj_err = (*current_jvmti())->GetFrameLocation(current_jvmti(), thread, frame_num - 1, &method_id, &location);
+  lj_check_jvmti_error(L);
+
+  info = lj_method_info_acquire(current_jni(), method_id, &lj_err);
+  lj_check_jvmti_error(L);
+
+  lua_createtable(L, 0, info->var_count);
+  for (i = 0; i < info->var_count; ++i)
+  {
+    var = &info->vars[i];
+    if (location < var->start_location || location > var->start_location + var->length)
+      continue;
+    if (push_local(L, thread, frame_num - 1, var))
+      lua_setfield(L, -2, var->name);
+  }
+
+  lj_method_info_release(info);
+
+  return 1;
+}
+
 void lj_stack_frame_register(lua_State *L)
 {
   lua_register(L, "lj_get_frame_count",            lj_get_frame_count);
   lua_register(L, "lj_get_stack_frame",            lj_get_stack_frame);
+  lua_register(L, "lj_get_stack_trace",            lj_get_stack_trace);
+  lua_register(L, "lj_get_frame_locals",           lj_get_frame_locals);
 }
@@ -0,0 +1,312 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "myjni.h"
+#include "jni_util.h"
+#include "lua_interface.h"
+#include "lua_java.h"
+#include "java_bridge.h"
+#include "lj_internal.h"
+
+/* Key/value store shared by the debugger's Lua state and the worker
+   states. Values are nil, booleans, numbers or strings. All access is
+   done while holding `store_lock'. */
+
+#define STORE_TABLE_SIZE 64 /* must be a power of 2 */
+
+typedef struct store_entry {
+  char *key;
+  int type;                     /* LUA_TBOOLEAN, LUA_TNUMBER or LUA_TSTRING */
+  lua_Number number;            /* number or boolean */
+  char *string;
+  size_t string_len;
+  struct store_entry *next;
+} store_entry;
+
+static store_entry *store_table[STORE_TABLE_SIZE];
+static jrawMonitorID store_lock;
+
+static unsigned int store_hash(const char *key)
+{
+  unsigned int h = 5381;
+  while (*key)
+    h = h * 33 + (unsigned char)*key++;
+  return h & (STORE_TABLE_SIZE - 1);
+}
+
+static void lock_store()
+{
+  jvmtiError err = (*current_jvmti())->RawMonitorEnter(current_jvmti(), store_lock);
+  assert(err == JVMTI_ERROR_NONE);
+  (void)err;
+}
+
+static void unlock_store()
+{
+  jvmtiError err = (*current_jvmti())->RawMonitorExit(current_jvmti(), store_lock);
+  assert(err == JVMTI_ERROR_NONE);
+  (void)err;
+}
+
+/* must be called with store_lock held */
+static store_entry **find_entry(const char *key)
+{
+  store_entry **p = &store_table[store_hash(key)];
+  while (*p && strcmp((*p)->key, key))
+    p = &(*p)->next;
+  return p;
+}
+
+static void free_entry(store_entry *entry)
+{
+  free(entry->key);
+  free(entry->string);
+  free(entry);
+}
+
+/* lj_store_get(key) */
+static int lj_store_get(lua_State *L)
+{
+  const char *key;
+  store_entry *entry;
+  char *string = NULL;
+  size_t string_len = 0;
+  lua_Number number = 0;
+  int type = LUA_TNIL;
+
+  key = luaL_checkstring(L, 1);
+
+  lock_store();
+  entry = *find_entry(key);
+  if (entry)
+  {
+    type = entry->type;
+    number = entry->number;
+    if (type == LUA_TSTRING)
+    {
+      /* copy so Lua can't raise an error while the lock is held */
+      string_len = entry->string_len;
+      string = malloc(string_len + 1);
+      if (string)
+        memcpy(string, entry->string, string_len + 1);
+    }
+  }
+  unlock_store();
+  lua_pop(L, 1);
+
+  switch (type)
+  {
+  case LUA_TBOOLEAN:
+    lua_pushboolean(L, (int)number);
+    break;
+  case LUA_TNUMBER:
+    lua_pushnumber(L, number);
+    break;
+  case LUA_TSTRING:
+    if (!string)
+      return luaL_error(L, "Out of memory");
+    lua_pushlstring(L, string, string_len);
+    free(string);
+    break;
+  default:
+    lua_pushnil(L);
+  }
+
+  return 1;
+}
+
+/* lj_store_set(key, value), a nil value removes the key */
+static int lj_store_set(lua_State *L)
+{
+  const char *key;
+  store_entry *entry;
+  store_entry **p;
+  const char *string;
+  size_t string_len = 0;
+  int type;
+
+  key = luaL_checkstring(L, 1);
+  type = lua_type(L, 2);
+  if (type != LUA_TNIL && type != LUA_TBOOLEAN && type != LUA_TNUMBER && type != LUA_TSTRING)
+    return luaL_error(L, "Only nil, booleans, numbers and strings can be stored");
+
+  /* build the entry before taking the lock */
+  entry = NULL;
+  if (type != LUA_TNIL)
+  {
+    entry = calloc(1, sizeof(store_entry));
+    if (!entry)
+      return luaL_error(L, "Out of memory");
+    entry->key = strdup(key);
+    entry->type = type;
+    if (type == LUA_TBOOLEAN)
+    {
+      entry->number = lua_toboolean(L, 2);
+    }
+    else if (type == LUA_TNUMBER)
+    {
+      entry->number = lua_tonumber(L, 2);
+    }
+    else
+    {
+      string = lua_tolstring(L, 2, &string_len);
+      entry->string = malloc(string_len + 1);
+      if (entry->string)
+        memcpy(entry->string, string, string_len + 1);
+      entry->string_len = string_len;
+    }
+    if (!entry->key || (type == LUA_TSTRING && !entry->string))
+    {
+      free_entry(entry);
+      return luaL_error(L, "Out of memory");
+    }
+  }
+  lua_pop(L, 2);
+
+  lock_store();
+  p = find_entry(key);
+  if (*p)
+  {
+    store_entry *old = *p;
+    *p = old->next;
+    free_entry(old);
+  }
+  if (entry)
+  {
+    entry->next = store_table[store_hash(entry->key)];
+    store_table[store_hash(entry->key)] = entry;
+  }
+  unlock_store();
+
+  return 0;
+}
+
+/* lj_store_add(key, delta) atomically adds to a number (starting at 0)
+   and returns the new value */
+static int lj_store_add(lua_State *L)
+{
+  const char *key;
+  lua_Number delta;
+  lua_Number result;
+  store_entry *entry;
+  store_entry *new_entry;
+
+  key = luaL_checkstring(L, 1);
+  delta = luaL_checknumber(L, 2);
+
+  new_entry = calloc(1, sizeof(store_entry));
+  if (!new_entry)
+    return luaL_error(L, "Out of memory");
+  new_entry->key = strdup(key);
+  new_entry->type = LUA_TNUMBER;
+  if (!new_entry->key)
+  {
+    free_entry(new_entry);
+    return luaL_error(L, "Out of memory");
+  }
+
+  lock_store();
+  entry = *find_entry(key);
+  if (entry && entry->type != LUA_TNUMBER)
+  {
+    unlock_store();
+    free_entry(new_entry);
+    return luaL_error(L, "Value of '%s' is not a number", key);
+  }
+  if (!entry)
+  {
+    entry = new_entry;
+    entry->next = store_table[store_hash(key)];
+    store_table[store_hash(key)] = entry;
+    new_entry = NULL;
+  }
+  entry->number += delta;
+  result = entry->number;
+  unlock_store();
+
+  if (new_entry)
+    free_entry(new_entry);
+
+  lua_pop(L, 2);
+  lua_pushnumber(L, result);
+
+  return 1;
+}
+
+/* lj_store_keys(prefix) returns an array of the keys starting with `prefix' */
+static int lj_store_keys(lua_State *L)
+{
+  const char *prefix;
+  size_t prefix_len;
+  store_entry *entry;
+  char **keys = NULL;
+  char **grown;
+  int count = 0;
+  int capacity = 0;
+  int failed = 0;
+  int i;
+
+  prefix = luaL_optlstring(L, 1, "", &prefix_len);
+
+  lock_store();
+  for (i = 0; i < STORE_TABLE_SIZE && !failed; ++i)
+  {
+    for (entry = store_table[i]; entry && !failed; entry = entry->next)
+    {
+      if (strncmp(entry->key, prefix, prefix_len))
+        continue;
+      if (count == capacity)
+      {
+        grown = realloc(keys, (capacity ? capacity * 2 : 16) * sizeof(char *));
+        if (!grown)
+        {
+          failed = 1;
+          break;
+        }
+        keys = grown;
+        capacity = capacity ? capacity * 2 : 16;
+      }
+      keys[count] = strdup(entry->key);
+      if (keys[count])
+        count++;
+      else
+        failed = 1;
+    }
+  }
+  unlock_store();
+  lua_settop(L, 0);
+
+  if (failed)
+  {
+    for (i = 0; i < count; ++i)
+      free(keys[i]);
+    free(keys);
+    return luaL_error(L, "Out of memory");
+  }
+
+  lua_newtable(L);
+  for (i = 0; i < count; ++i)
+  {
+    lua_pushstring(L, keys[i]);
+    lua_rawseti(L, -2, i + 1);
+    free(keys[i]);
+  }
+  free(keys);
+
+  return 1;
+}
+
+void lj_store_register(lua_State *L)
+{
+  /* created once, this is also called for worker states */
+  if (!store_lock)
+  {
+    lj_err = (*current_jvmti())->CreateRawMonitor(current_jvmti(), "yellow_tree_store_lock", &store_lock);
+    lj_check_jvmti_error(L);
+  }
+
+  lua_register(L, "lj_store_get",                  lj_store_get);
+  lua_register(L, "lj_store_set",                  lj_store_set);
+  lua_register(L, "lj_store_add",                  lj_store_add);
+  lua_register(L, "lj_store_keys",                 lj_store_keys);
+}
@@ -0,0 +1,401 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "myjni.h"
+#include "jni_util.h"
+#include "lua_interface.h"
+#include "lua_java.h"
+#include "java_bridge.h"
+#include "lj_internal.h"
+#include "lj_tag.h"
+
+/* Allocation of object tag ranges. Range `i' covers the tags
+   (i + 1) << LJ_TAG_RANGE_BITS up to the next range, tags below the
+   first range are not handed out.
+
+   Range 0 holds the object IDs, an object with an ID is tagged with
+   the first tag of the range + ID - 1. The ID table keeps a weak reference
+   to each object and is also indexed by identity hash code, which finds
+   objects whose tag is held by another range or was cleared. Everything
+   here is accessed while holding `tag_lock'. */
+
+#define OBJECT_ID_RANGE 0
+#define OBJECT_ID_BASE ((jlong)(OBJECT_ID_RANGE + 1) << LJ_TAG_RANGE_BITS)
+
+typedef struct {
+  jweak ref;                    /* NULL once disposed or collected */
+  jint hash;
+  jlong next;                   /* next ID in the same bucket, 0 at the end */
+} object_id_entry;
+
+static const char *tag_range_owner[LJ_TAG_MAX_RANGES];
+static jrawMonitorID tag_lock;
+
+static object_id_entry *ids;    /* ids[id - 1] */
+static jlong id_count;
+static jlong id_capacity;
+static jlong *id_buckets;       /* first ID with each hash, 0 if none */
+static jint bucket_count;
+
+static void lock_tags()
+{
+  jvmtiError err = (*current_jvmti())->RawMonitorEnter(current_jvmti(), tag_lock);
+  assert(err == JVMTI_ERROR_NONE);
+  (void)err;
+}
+
+static void unlock_tags()
+{
+  jvmtiError err = (*current_jvmti())->RawMonitorExit(current_jvmti(), tag_lock);
+  assert(err == JVMTI_ERROR_NONE);
+  (void)err;
+}
+
+jlong lj_tag_range_acquire(const char *owner)
+{
+  jlong base = 0;
+  int i;
+
+  lock_tags();
+  for (i = 0; i < LJ_TAG_MAX_RANGES; ++i)
+  {
+    if (!tag_range_owner[i])
+    {
+      tag_range_owner[i] = owner;
+      base = (jlong)(i + 1) << LJ_TAG_RANGE_BITS;
+      break;
+    }
+  }
+  unlock_tags();
+
+  return base;
+}
+
+void lj_tag_range_release(jlong base, jclass class, int clear)
+{
+  int i = (int)(base >> LJ_TAG_RANGE_BITS) - 1;
+
+  assert(i > OBJECT_ID_RANGE && i < LJ_TAG_MAX_RANGES);
+  if (clear)
+    lj_tag_clear(class, base, base + ((jlong)1 << LJ_TAG_RANGE_BITS) - 1);
+
+  lock_tags();
+  assert(tag_range_owner[i]);
+  tag_range_owner[i] = NULL;
+  unlock_tags();
+}
+
+typedef struct {
+  jlong first;
+  jlong last;
+} tag_span;
+
+static jint heap_iter_clear_tag(jlong class_tag, jlong size, jlong *tag_ptr, jint length, void *user_data)
+{
+  tag_span *span = user_data;
+  if (*tag_ptr >= span->first && *tag_ptr <= span->last)
+    *tag_ptr = 0;
+  return 0;
+}
+
+jvmtiError lj_tag_clear(jclass class, jlong first, jlong last)
+{
+  jvmtiHeapCallbacks callbacks;
+  tag_span span;
+
+  span.first = first;
+  span.last = last;
+  memset(&callbacks, 0, sizeof(jvmtiHeapCallbacks));
+  callbacks.heap_iteration_callback = &heap_iter_clear_tag;
+
+  /* only tagged objects are visited */
+  return (*current_jvmti())->IterateThroughHeap(current_jvmti(), JVMTI_HEAP_FILTER_UNTAGGED, class,
+                                                &callbacks, &span);
+}
+
+static jlong *bucket_of(jint hash)
+{
+  return &id_buckets[(jint)((uint32_t)hash * 0x9e3779b9U >> 8) & (bucket_count - 1)];
+}
+
+/* Rebuild the buckets with `count' buckets, leaving out released IDs.
+   0 if out of memory, the old buckets are kept and stay usable. */
+static int rehash_ids(jint count)
+{
+  jlong *buckets;
+  jlong id;
+
+  buckets = calloc(count, sizeof(jlong));
+  if (!buckets)
+    return 0;
+  free(id_buckets);
+  id_buckets = buckets;
+  bucket_count = count;
+  for (id = id_count; id > 0; --id)
+  {
+    if (!ids[id - 1].ref)
+      continue;
+    ids[id - 1].next = *bucket_of(ids[id - 1].hash);
+    *bucket_of(ids[id - 1].hash) = id;
+  }
+  return 1;
+}
+
+jlong lj_object_id(JNIEnv *jni, jobject obj)
+{
+  jvmtiEnv *jvmti = current_jvmti();
+  object_id_entry *entry;
+  jlong tag = 0;
+  object_id_entry *grown;
+  jlong capacity;
+  jint hash;
+  jlong id;
+
+  if (!obj ||
+      (*jvmti)->GetTag(jvmti, obj, &tag) != JVMTI_ERROR_NONE ||
+      (*jvmti)->GetObjectHashCode(jvmti, obj, &hash) != JVMTI_ERROR_NONE)
+    return 0;
+
+  lock_tags();
+
+  /* the tag is kept until the ID is released */
+  id = tag - OBJECT_ID_BASE + 1;
+  if (tag >= OBJECT_ID_BASE && id <= id_count && ids[id - 1].ref)
+  {
+    unlock_tags();
+    return id;
+  }
+
+  /* objects whose tag is owned by a range */
+  for (id = bucket_count ? *bucket_of(hash) : 0; id; id = ids[id - 1].next)
+  {
+    entry = &ids[id - 1];
+    if (entry->ref && entry->hash == hash && (*jni)->IsSameObject(jni, entry->ref, obj))
+      break;
+  }
+
+  if (!id)
+  {
+    if (id_count == id_capacity)
+    {
+      capacity = id_capacity ? id_capacity * 2 : 1024;
+      grown = realloc(ids, capacity * sizeof(object_id_entry));
+      if (!grown)
+      {
+        unlock_tags();
+        return 0;
+      }
+      ids = grown;
+      id_capacity = capacity;
+    }
+    /* without new buckets the chains just get longer */
+    if (id_count + 1 > (jlong)bucket_count * 2 &&
+        !rehash_ids(bucket_count ? bucket_count * 4 : 1024) && !bucket_count)
+    {
+      unlock_tags();
+      return 0;
+    }
+    id = ++id_count;
+    entry = &ids[id - 1];
+    entry->ref = (*jni)->NewWeakGlobalRef(jni, obj);
+    entry->hash = hash;
+    entry->next = *bucket_of(hash);
+    *bucket_of(hash) = id;
+  }
+
+  if (!tag)
+    (*jvmti)->SetTag(jvmti, obj, OBJECT_ID_BASE + id - 1);
+
+  unlock_tags();
+
+  return id;
+}
+
+jobject lj_object_by_id(JNIEnv *jni, jlong id)
+{
+  jobject obj = NULL;
+
+  lock_tags();
+  if (id > 0 && id <= id_count && ids[id - 1].ref)
+    obj = (*jni)->NewLocalRef(jni, ids[id - 1].ref);
+  unlock_tags();
+
+  return obj;
+}
+
+/* must be called with tag_lock held */
+static void release_id(JNIEnv *jni, jlong id)
+{
+  jobject obj;
+  jlong tag = 0;
+
+  obj = (*jni)->NewLocalRef(jni, ids[id - 1].ref);
+  if (obj)
+  {
+    (*current_jvmti())->GetTag(current_jvmti(), obj, &tag);
+    if (tag == OBJECT_ID_BASE + id - 1)
+      (*current_jvmti())->SetTag(current_jvmti(), obj, 0);
+    (*jni)->DeleteLocalRef(jni, obj);
+  }
+  (*jni)->DeleteWeakGlobalRef(jni, ids[id - 1].ref);
+  ids[id - 1].ref = NULL;
+}
+
+/* lj_object_id(object) returns the ID of `object' */
+static int lj_object_id_lua(lua_State *L)
+{
+  jobject obj;
+  jlong id;
+
+  obj = *(jobject *)luaL_checkudata(L, 1, "jobject");
+  lua_pop(L, 1);
+
+  id = lj_object_id(current_jni(), obj);
+  if (!id)
+    return luaL_error(L, "Can't get the ID of the object");
+  lua_pushinteger(L, (lua_Integer)id);
+
+  return 1;
+}
+
+/* lj_object_by_id(id) returns the object or nil if it was collected */
+static int lj_object_by_id_lua(lua_State *L)
+{
+  JNIEnv *jni = current_jni();
+  jlong id = (jlong)luaL_checkinteger(L, 1);
+  jobject obj;
+
+  lua_pop(L, 1);
+  obj = lj_object_by_id(jni, id);
+  if (obj)
+  {
+    new_jobject(L, (*jni)->NewGlobalRef(jni, obj));
+    (*jni)->DeleteLocalRef(jni, obj);
+  }
+  else
+  {
+    lua_pushnil(L);
+  }
+
+  return 1;
+}
+
+/* lj_dispose_object_id(id) releases an ID, the object gets a new one
+   if it's used again */
+static int lj_dispose_object_id(lua_State *L)
+{
+  JNIEnv *jni = current_jni();
+  jlong id = (jlong)luaL_checkinteger(L, 1);
+
+  lua_pop(L, 1);
+  lock_tags();
+  if (id > 0 && id <= id_count && ids[id - 1].ref)
+    release_id(jni, id);
+  unlock_tags();
+
+  return 0;
+}
+
+/* lj_tag_ranges() returns the ranges in use as {{index=, base=, owner=}, ...} */
+static int lj_tag_ranges(lua_State *L)
+{
+  int count = 0;
+  int i;
+
+  lua_newtable(L);
+  lock_tags();
+  for (i = 0; i < LJ_TAG_MAX_RANGES; ++i)
+  {
+    if (!tag_range_owner[i])
+      continue;
+    lua_createtable(L, 0, 3);
+    lua_pushinteger(L, i);
+    lua_setfield(L, -2, "index");
+    lua_pushnumber(L, (lua_Number)((jlong)(i + 1) << LJ_TAG_RANGE_BITS));
+    lua_setfield(L, -2, "base");
+    lua_pushstring(L, tag_range_owner[i]);
+    lua_setfield(L, -2, "owner");
+    lua_rawseti(L, -2, ++count);
+  }
+  unlock_tags();
+
+  return 1;
+}
+
+typedef struct {
+  char in_use[LJ_TAG_MAX_RANGES];
+  jint cleared;
+} tag_sweep;
+
+static jint heap_iter_sweep_tag(jlong class_tag, jlong size, jlong *tag_ptr, jint length, void *user_data)
+{
+  tag_sweep *sweep = user_data;
+  jlong range = (*tag_ptr >> LJ_TAG_RANGE_BITS) - 1;
+
+  if (range < 0 || range >= LJ_TAG_MAX_RANGES || !sweep->in_use[range])
+  {
+    *tag_ptr = 0;
+    sweep->cleared++;
+  }
+  return 0;
+}
+
+/* lj_tag_sweep() releases the IDs of collected objects and clears, in
+   one pass over the heap, any tag outside of the ranges in use. Returns
+   the number of IDs released and tags cleared. */
+static int lj_tag_sweep(lua_State *L)
+{
+  JNIEnv *jni = current_jni();
+  jvmtiHeapCallbacks callbacks;
+  tag_sweep sweep;
+  jint released = 0;
+  jlong id;
+  int i;
+
+  memset(&sweep, 0, sizeof(tag_sweep));
+  memset(&callbacks, 0, sizeof(jvmtiHeapCallbacks));
+  callbacks.heap_iteration_callback = &heap_iter_sweep_tag;
+
+  /* held through the pass so no range is handed out meanwhile */
+  lock_tags();
+  for (id = 1; id <= id_count; ++id)
+  {
+    if (ids[id - 1].ref && (*jni)->IsSameObject(jni, ids[id - 1].ref, NULL))
+    {
+      release_id(jni, id);
+      released++;
+    }
+  }
+  if (released)
+    rehash_ids(bucket_count);
+
+  for (i = 0; i < LJ_TAG_MAX_RANGES; ++i)
+    sweep.in_use[i] = tag_range_owner[i] != NULL;
+  lj_err = (*current_jvmti())->IterateThroughHeap(current_jvmti(), JVMTI_HEAP_FILTER_UNTAGGED, NULL,
+                                                  &callbacks, &sweep);
+  unlock_tags();
+  lj_check_jvmti_error(L);
+
+  lua_pushinteger(L, released);
+  lua_pushinteger(L, sweep.cleared);
+
+  return 2;
+}
+
+void lj_tag_register(lua_State *L)
+{
+  /* created once, this is also called for worker states */
+  if (!tag_lock)
+  {
+    lj_err = (*current_jvmti())->CreateRawMonitor(current_jvmti(), "yellow_tree_tag_lock", &tag_lock);
+    lj_check_jvmti_error(L);
+    tag_range_owner[OBJECT_ID_RANGE] = "object_ids";
+  }
+
+  lua_register(L, "lj_object_id",                  lj_object_id_lua);
+  lua_register(L, "lj_object_by_id",               lj_object_by_id_lua);
+  lua_register(L, "lj_dispose_object_id",          lj_dispose_object_id);
+  lua_register(L, "lj_tag_ranges",                 lj_tag_ranges);
+  lua_register(L, "lj_tag_sweep",                  lj_tag_sweep);
+}
@@ -0,0 +1,37 @@
+#ifndef LJ_TAG_H_
+#define LJ_TAG_H_
+
+#include "lua_java.h"
+
+/* Object tags are shared by everything using the JVMTI environment, so
+   the tag space is handed out in ranges of 2^LJ_TAG_RANGE_BITS tags.
+   A range is owned by one user until it's released, tags outside of
+   the owner's range must not be modified. An object that already has
+   a tag from someone else keeps it.
+
+   The first range is reserved for object IDs. */
+#define LJ_TAG_RANGE_BITS 32
+#define LJ_TAG_MAX_RANGES 256
+
+/* First tag of a free range, 0 if all ranges are in use. `owner' is a
+   static string naming the user, for diagnostics. */
+jlong lj_tag_range_acquire(const char *owner);
+
+/* Free a range. If `clear' is set, the tags of all objects in the range
+   (and instances of `class' if not NULL) are cleared first. Otherwise
+   the caller must have cleared them. */
+void lj_tag_range_release(jlong base, jclass class, int clear);
+
+/* Clear the tags from `first' to `last' inclusive on all objects (of
+   `class' if not NULL) */
+jvmtiError lj_tag_clear(jclass class, jlong first, jlong last);
+
+/* Stable ID of `obj', assigned on first use. Like JDWP object IDs they
+   are never reused and don't keep the object alive. 0 on failure. */
+jlong lj_object_id(JNIEnv *jni, jobject obj);
+
+/* Local reference to the object with `id', NULL if it was collected or
+   the ID is unknown */
+jobject lj_object_by_id(JNIEnv *jni, jlong id);
+
+#endif /* LJ_TAG_H_ */
@@ -0,0 +1,277 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "myjni.h"
+#include "jni_util.h"
+#include "lua_interface.h"
+#include "lua_java.h"
+#include "java_bridge.h"
+#include "lj_internal.h"
+#include "lj_method_cache.h"
+
+/* Thread dump of all threads, built from a single GetAllStackTraces
+   call and formatted here. Method names come from the method cache so
+   frames of the same method are only inspected once.
+
+   Threads with identical stacks (same state, methods and locations) can
+   be grouped, listing the stack once with the names of the threads. */
+
+#define THREAD_DUMP_MAX_FRAMES 256
+
+typedef struct {
+  jvmtiStackInfo *stack;
+  char *name;
+  jint priority;
+  jboolean is_daemon;
+  int group_size;               /* set on the first thread of a group */
+} dump_thread;
+
+static const char *thread_state_name(jint state)
+{
+  switch (state & JVMTI_JAVA_LANG_THREAD_STATE_MASK)
+  {
+  case JVMTI_JAVA_LANG_THREAD_STATE_NEW:
+    return "NEW";
+  case JVMTI_JAVA_LANG_THREAD_STATE_TERMINATED:
+    return "TERMINATED";
+  case JVMTI_JAVA_LANG_THREAD_STATE_RUNNABLE:
+    return "RUNNABLE";
+  case JVMTI_JAVA_LANG_THREAD_STATE_BLOCKED:
+    return "BLOCKED";
+  case JVMTI_JAVA_LANG_THREAD_STATE_WAITING:
+    return "WAITING";
+  case JVMTI_JAVA_LANG_THREAD_STATE_TIMED_WAITING:
+    return "TIMED_WAITING";
+  }
+  return "UNKNOWN";
+}
+
+/* order by stack so identical stacks are adjacent */
+static int compare_stack(const void *a, const void *b)
+{
+  const jvmtiStackInfo *s1 = ((const dump_thread *)a)->stack;
+  const jvmtiStackInfo *s2 = ((const dump_thread *)b)->stack;
+  jint state1 = s1->state & JVMTI_JAVA_LANG_THREAD_STATE_MASK;
+  jint state2 = s2->state & JVMTI_JAVA_LANG_THREAD_STATE_MASK;
+  int i;
+
+  if (s1->frame_count != s2->frame_count)
+    return s1->frame_count < s2->frame_count ? -1 : 1;
+  if (state1 != state2)
+    return state1 < state2 ? -1 : 1;
+  for (i = 0; i < s1->frame_count; ++i)
+  {
+    if (s1->frame_buffer[i].method != s2->frame_buffer[i].method)
+      return (uintptr_t)s1->frame_buffer[i].method < (uintptr_t)s2->frame_buffer[i].method ? -1 : 1;
+    if (s1->frame_buffer[i].location != s2->frame_buffer[i].location)
+      return s1->frame_buffer[i].location < s2->frame_buffer[i].location ? -1 : 1;
+  }
+  return 0;
+}
+
+/* largest groups first, then by name */
+static int compare_group(const void *a, const void *b)
+{
+  const dump_thread *t1 = *(dump_thread *const *)a;
+  const dump_thread *t2 = *(dump_thread *const *)b;
+  if (t1->group_size != t2->group_size)
+    return t1->group_size > t2->group_size ? -1 : 1;
+  return strcmp(t1->name, t2->name);
+}
+
+static void add_frame(luaL_Buffer *b, JNIEnv *jni, const jvmtiFrameInfo *frame)
+{
+  lj_method_info *info;
+  jvmtiError err;
+  jint line_num;
+  char line[32];
+
+  info = lj_method_info_acquire(jni, frame->method, &err);
+  if (!info)
+  {
+    luaL_addstring(b, "\tat <unknown method>\n");
+    return;
+  }
+
+  luaL_addstring(b, "\tat ");
+  luaL_addstring(b, info->class_name);
+  luaL_addchar(b, '.');
+  luaL_addstring(b, info->name);
+  luaL_addchar(b, '(');
+  if (frame->location == -1)
+  {
+    luaL_addstring(b, "Native Method");
+  }
+  else
+  {
+    luaL_addstring(b, info->source_file ? info->source_file : "Unknown Source");
+    line_num = lj_method_info_line_number(info, frame->location);
+    if (line_num >= 0)
+    {
+      snprintf(line, sizeof(line), ":%d", (int)line_num);
+      luaL_addstring(b, line);
+    }
+  }
+  luaL_addstring(b, ")\n");
+
+  lj_method_info_release(info);
+}
+
+static void add_thread_header(luaL_Buffer *b, const dump_thread *thread)
+{
+  char buf[64];
+
+  luaL_addchar(b, '"');
+  luaL_addstring(b, thread->name);
+  luaL_addchar(b, '"');
+  if (thread->is_daemon)
+    luaL_addstring(b, " daemon");
+  snprintf(buf, sizeof(buf), " prio=%d ", (int)thread->priority);
+  luaL_addstring(b, buf);
+  luaL_addstring(b, thread_state_name(thread->stack->state));
+  luaL_addchar(b, '\n');
+}
+
+static void add_group_header(luaL_Buffer *b, const dump_thread *threads)
+{
+  char buf[64];
+  int i;
+
+  snprintf(buf, sizeof(buf), "%d threads ", threads[0].group_size);
+  luaL_addstring(b, buf);
+  luaL_addstring(b, thread_state_name(threads[0].stack->state));
+  luaL_addstring(b, ":");
+  for (i = 0; i < threads[0].group_size; ++i)
+  {
+    luaL_addstring(b, i ? ", \"" : " \"");
+    luaL_addstring(b, threads[i].name);
+    luaL_addchar(b, '"');
+  }
+  luaL_addchar(b, '\n');
+}
+
+/* Sort `threads' so identical stacks are adjacent and set `group_size'
+   on the first thread of each group. Returns the number of groups, their
+   first threads are put in `groups', largest group first. */
+static int group_threads(dump_thread *threads, int count, dump_thread **groups)
+{
+  int group_count = 0;
+  int i;
+  int j;
+
+  qsort(threads, count, sizeof(dump_thread), compare_stack);
+  for (i = 0; i < count; i = j)
+  {
+    for (j = i + 1; j < count && !compare_stack(&threads[i], &threads[j]); ++j)
+      ;
+    threads[i].group_size = j - i;
+    groups[group_count++] = &threads[i];
+  }
+
+  qsort(groups, group_count, sizeof(dump_thread *), compare_group);
+
+  return group_count;
+}
+
+/* lj_thread_dump(max_frames, group) returns a thread dump of all
+   threads as a string */
+static int lj_thread_dump(lua_State *L)
+{
+  JNIEnv *jni = current_jni();
+  jvmtiEnv *jvmti = current_jvmti();
+  jvmtiStackInfo *stacks;
+  jvmtiThreadInfo info;
+  dump_thread *threads;
+  dump_thread **groups;
+  int group_count;
+  jint count;
+  int max_frames;
+  int group;
+  int out_of_memory = 0;
+  int i;
+  int j;
+  luaL_Buffer b;
+
+  max_frames = luaL_optinteger(L, 1, THREAD_DUMP_MAX_FRAMES);
+  group = lua_toboolean(L, 2);
+  lua_settop(L, 0);
+
+  lj_err = (*jvmti)->GetAllStackTraces(jvmti, max_frames, &stacks, &count);
+  lj_check_jvmti_error(L);
+
+  threads = calloc(count ? count : 1, sizeof(dump_thread));
+  groups = malloc((count ? count : 1) * sizeof(dump_thread *));
+  if (!threads || !groups)
+  {
+    for (i = 0; i < count; ++i)
+      (*jni)->DeleteLocalRef(jni, stacks[i].thread);
+    free(threads);
+    free(groups);
+    free_jvmti_refs(jvmti, stacks, (void *)-1);
+    return luaL_error(L, "Out of memory");
+  }
+  for (i = 0; i < count; ++i)
+  {
+    threads[i].stack = &stacks[i];
+    if ((*jvmti)->GetThreadInfo(jvmti, stacks[i].thread, &info) == JVMTI_ERROR_NONE)
+    {
+      threads[i].name = strdup(info.name);
+      threads[i].priority = info.priority;
+      threads[i].is_daemon = info.is_daemon;
+      (*jni)->DeleteLocalRef(jni, info.thread_group);
+      (*jni)->DeleteLocalRef(jni, info.context_class_loader);
+      free_jvmti_refs(jvmti, info.name, (void *)-1);
+    }
+    else
+    {
+      threads[i].name = strdup("<unknown>");
+    }
+    if (!threads[i].name)
+      out_of_memory = 1;
+    (*jni)->DeleteLocalRef(jni, stacks[i].thread);
+    threads[i].group_size = 1;
+    groups[i] = &threads[i];
+  }
+  if (out_of_memory)
+  {
+    for (i = 0; i < count; ++i)
+      free(threads[i].name);
+    free(threads);
+    free(groups);
+    free_jvmti_refs(jvmti, stacks, (void *)-1);
+    return luaL_error(L, "Out of memory");
+  }
+
+  group_count = count;
+  if (group)
+    group_count = group_threads(threads, count, groups);
+
+  luaL_buffinit(L, &b);
+  for (i = 0; i < group_count; ++i)
+  {
+    dump_thread *thread = groups[i];
+    if (thread->group_size > 1)
+      add_group_header(&b, thread);
+    else
+      add_thread_header(&b, thread);
+    for (j = 0; j < thread->stack->frame_count; ++j)
+      add_frame(&b, jni, &thread->stack->frame_buffer[j]);
+    luaL_addchar(&b, '\n');
+  }
+
+  for (i = 0; i < count; ++i)
+    free(threads[i].name);
+  free(threads);
+  free(groups);
+  free_jvmti_refs(jvmti, stacks, (void *)-1);
+
+  luaL_pushresult(&b);
+
+  return 1;
+}
+
+void lj_thread_dump_register(lua_State *L)
+{
+  lua_register(L, "lj_thread_dump",                lj_thread_dump);
+}
@@ -0,0 +1,352 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "myjni.h"
+#include "jni_util.h"
+#include "lua_interface.h"
+#include "lua_java.h"
+#include "java_bridge.h"
+#include "lj_internal.h"
+#include "lj_atomic.h"
+#include "lj_trace.h"
+
+/* Trace log for tracepoints (breakpoints that don't stop).
+
+   Each application thread that hits a tracepoint gets its own ring of
+   preallocated records. The thread is the only producer and writes
+   without locking, publishing a record by advancing `head'. The ring
+   is drained by lj_drain_trace_log() which is the only consumer and
+   advances `tail'. When the ring is full new records are counted in
+   `dropped' and discarded, the application thread never waits.
+
+   Rings are linked into a list when created. When the thread ends its
+   ring is marked `ended' and freed once it has been drained. Only the
+   holder of `trace_drain_lock' unlinks rings, new rings are pushed on
+   the head of the list without it. */
+
+#define TRACE_RING_SIZE 256 /* must be a power of 2 */
+#define TRACE_THREAD_NAME_LEN 64
+
+typedef struct {
+  char type;                    /* operand type, 0 if not available */
+  char is_null;
+  union {
+    jlong j;
+    jdouble d;
+    jint hash;                  /* objects are recorded by identity hash */
+    char s[LJ_TRACE_STR_LEN];
+  } u;
+} trace_value;
+
+typedef struct {
+  jint bp_id;
+  jmethodID method_id;
+  jlocation location;
+  jlong time;
+  int value_count;
+  trace_value values[LJ_TRACE_MAX_VALUES];
+} trace_record;
+
+typedef struct trace_ring {
+  volatile uint32_t head;
+  volatile uint32_t tail;
+  volatile uint32_t dropped;
+  int ended;                    /* changed with trace_drain_lock held */
+  char thread_name[TRACE_THREAD_NAME_LEN];
+  struct trace_ring *next;
+  trace_record records[TRACE_RING_SIZE];
+} trace_ring;
+
+static trace_ring *volatile trace_rings;
+static LJ_THREAD_LOCAL trace_ring *thread_ring;
+/* serializes consumers */
+static jrawMonitorID trace_drain_lock;
+/* records dropped by rings that were freed before being drained */
+static uint32_t ended_dropped;
+
+/* A record copied out of a ring so it can be pushed without holding
+   trace_drain_lock */
+typedef struct {
+  trace_record record;
+  char thread_name[TRACE_THREAD_NAME_LEN];
+} drained_record;
+
+static trace_ring *get_thread_ring(JNIEnv *jni, jthread thread)
+{
+  jvmtiThreadInfo info;
+  trace_ring *ring = thread_ring;
+
+  if (ring)
+    return ring;
+
+  ring = calloc(1, sizeof(trace_ring));
+  if (!ring)
+    return NULL;
+
+  if ((*current_jvmti())->GetThreadInfo(current_jvmti(), thread, &info) == JVMTI_ERROR_NONE)
+  {
+    strncpy(ring->thread_name, info.name, TRACE_THREAD_NAME_LEN - 1);
+    (*jni)->DeleteLocalRef(jni, info.thread_group);
+    (*jni)->DeleteLocalRef(jni, info.context_class_loader);
+    free_jvmti_refs(current_jvmti(), info.name, (void *)-1);
+  }
+
+  do
+  {
+    ring->next = lj_atomic_load_ptr((void *volatile *)&trace_rings);
+  } while (!lj_atomic_cas_ptr((void *volatile *)&trace_rings, ring->next, ring));
+
+  thread_ring = ring;
+  return ring;
+}
+
+/* Remove `ring' from the list and free it. Must be called with
+   trace_drain_lock held. */
+static void free_ring(trace_ring *ring)
+{
+  trace_ring *prev;
+
+  ended_dropped += lj_atomic_exchange(&ring->dropped, 0);
+  /* rings pushed since `ring' was the head are in front of it */
+  if (!lj_atomic_cas_ptr((void *volatile *)&trace_rings, ring, ring->next))
+  {
+    prev = lj_atomic_load_ptr((void *volatile *)&trace_rings);
+    while (prev->next != ring)
+      prev = prev->next;
+    prev->next = ring->next;
+  }
+  free(ring);
+}
+
+void lj_trace_thread_end()
+{
+  trace_ring *ring = thread_ring;
+
+  if (!ring)
+    return;
+  thread_ring = NULL;
+
+  if ((*current_jvmti())->RawMonitorEnter(current_jvmti(), trace_drain_lock) != JVMTI_ERROR_NONE)
+    return;
+  /* records not drained yet are kept until the next drain */
+  if (ring->tail == ring->head)
+    free_ring(ring);
+  else
+    ring->ended = 1;
+  (*current_jvmti())->RawMonitorExit(current_jvmti(), trace_drain_lock);
+}
+
+static void capture_value(JNIEnv *jni, jthread thread, const lj_operand *operand, trace_value *value)
+{
+  lj_operand_value val;
+
+  value->type = 0;
+  if (!lj_operand_read(jni, thread, operand, &val))
+    return;
+
+  value->type = operand->type;
+  value->is_null = 0;
+  switch (operand->type)
+  {
+  case 'Z': case 'B': case 'C': case 'S': case 'I': case 'J':
+    value->u.j = val.ival;
+    break;
+  case 'F': case 'D':
+    value->u.d = val.dval;
+    break;
+  case 'T':
+    if (val.str)
+    {
+      strncpy(value->u.s, val.str, LJ_TRACE_STR_LEN - 1);
+      value->u.s[LJ_TRACE_STR_LEN - 1] = 0;
+    }
+    else
+    {
+      value->is_null = 1;
+    }
+    break;
+  default:
+    if (val.object == NULL ||
+        (*current_jvmti())->GetObjectHashCode(current_jvmti(), val.object, &value->u.hash) != JVMTI_ERROR_NONE)
+      value->is_null = 1;
+    break;
+  }
+
+  lj_operand_release(jni, &val);
+}
+
+void lj_trace_record(lj_breakpoint *bp, JNIEnv *jni, jthread thread, jlocation location)
+{
+  trace_ring *ring;
+  trace_record *record;
+  uint32_t head;
+  int i;
+
+  ring = get_thread_ring(jni, thread);
+  if (!ring)
+    return;
+
+  /* only this thread writes `head' */
+  head = ring->head;
+  if (head - lj_atomic_load_acquire(&ring->tail) >= TRACE_RING_SIZE)
+  {
+    lj_atomic_fetch_add(&ring->dropped, 1);
+    return;
+  }
+
+  record = &ring->records[head & (TRACE_RING_SIZE - 1)];
+  record->bp_id = bp->id;
+  record->method_id = bp->method_id;
+  record->location = location;
+  if ((*current_jvmti())->GetTime(current_jvmti(), &record->time) != JVMTI_ERROR_NONE)
+    record->time = 0;
+  record->value_count = bp->capture_count;
+  for (i = 0; i < bp->capture_count; ++i)
+    capture_value(jni, thread, &bp->captures[i], &record->values[i]);
+
+  lj_atomic_store_release(&ring->head, head + 1);
+}
+
+static void push_trace_value(lua_State *L, const trace_value *value)
+{
+  char buf[32];
+
+  if (value->type == 0)
+  {
+    lua_pushliteral(L, "<unavailable>");
+    return;
+  }
+  if (value->is_null)
+  {
+    lua_pushnil(L);
+    return;
+  }
+
+  switch (value->type)
+  {
+  case 'Z':
+    lua_pushboolean(L, (int)value->u.j);
+    break;
+  case 'B': case 'C': case 'S': case 'I': case 'J':
+    lua_pushinteger(L, value->u.j);
+    break;
+  case 'F': case 'D':
+    lua_pushnumber(L, value->u.d);
+    break;
+  case 'T':
+    lua_pushstring(L, value->u.s);
+    break;
+  default:
+    snprintf(buf, sizeof(buf), "object@%x", (unsigned int)value->u.hash);
+    lua_pushstring(L, buf);
+    break;
+  }
+}
+
+static void push_trace_record(lua_State *L, const char *thread_name, const trace_record *record)
+{
+  int i;
+
+  lua_newtable(L);
+  lua_pushinteger(L, record->bp_id);
+  lua_setfield(L, -2, "id");
+  new_jmethod_id(L, record->method_id);
+  lua_setfield(L, -2, "method_id_raw");
+  lua_pushinteger(L, record->location);
+  lua_setfield(L, -2, "location");
+  lua_pushnumber(L, (lua_Number)record->time);
+  lua_setfield(L, -2, "time");
+  lua_pushstring(L, thread_name);
+  lua_setfield(L, -2, "thread");
+
+  /* values can be nil, `n' is the count */
+  lua_newtable(L);
+  for (i = 0; i < record->value_count; ++i)
+  {
+    push_trace_value(L, &record->values[i]);
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_pushinteger(L, record->value_count);
+  lua_setfield(L, -2, "n");
+  lua_setfield(L, -2, "values");
+}
+
+/* lj_drain_trace_log() returns a table of records for all threads and
+   the number of records dropped since the last drain.
+
+   Records are copied into a userdata while holding trace_drain_lock
+   and pushed after releasing it. Records published after the buffer
+   is sized are left for the next drain. */
+static int lj_drain_trace_log(lua_State *L)
+{
+  trace_ring *ring;
+  trace_ring *next;
+  drained_record *drained;
+  uint32_t head;
+  uint32_t tail;
+  lua_Integer dropped;
+  int capacity = 0;
+  int count = 0;
+  int i;
+
+  lj_err = (*current_jvmti())->RawMonitorEnter(current_jvmti(), trace_drain_lock);
+  lj_check_jvmti_error(L);
+  ring = lj_atomic_load_ptr((void *volatile *)&trace_rings);
+  for (; ring; ring = ring->next)
+    capacity += lj_atomic_load_acquire(&ring->head) - ring->tail;
+  lj_err = (*current_jvmti())->RawMonitorExit(current_jvmti(), trace_drain_lock);
+  lj_check_jvmti_error(L);
+
+  /* a drain in between only leaves fewer records to copy */
+  drained = lua_newuserdata(L, (capacity ? capacity : 1) * sizeof(drained_record));
+
+  lj_err = (*current_jvmti())->RawMonitorEnter(current_jvmti(), trace_drain_lock);
+  lj_check_jvmti_error(L);
+  ring = lj_atomic_load_ptr((void *volatile *)&trace_rings);
+  for (; ring; ring = next)
+  {
+    next = ring->next;
+    /* only the consumer writes `tail' */
+    tail = ring->tail;
+    head = lj_atomic_load_acquire(&ring->head);
+    for (; tail != head && count < capacity; ++tail, ++count)
+    {
+      drained[count].record = ring->records[tail & (TRACE_RING_SIZE - 1)];
+      memcpy(drained[count].thread_name, ring->thread_name, TRACE_THREAD_NAME_LEN);
+    }
+    lj_atomic_store_release(&ring->tail, tail);
+    if (ring->ended && tail == head)
+      free_ring(ring);
+  }
+
+  dropped = ended_dropped;
+  ended_dropped = 0;
+  ring = lj_atomic_load_ptr((void *volatile *)&trace_rings);
+  for (; ring; ring = ring->next)
+    dropped += lj_atomic_exchange(&ring->dropped, 0);
+  lj_err = (*current_jvmti())->RawMonitorExit(current_jvmti(), trace_drain_lock);
+  lj_check_jvmti_error(L);
+
+  lua_createtable(L, count, 0);
+  for (i = 0; i < count; ++i)
+  {
+    push_trace_record(L, drained[i].thread_name, &drained[i].record);
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_pushinteger(L, dropped);
+  lua_remove(L, -3);
+
+  return 2;
+}
+
+void lj_trace_register(lua_State *L)
+{
+  /* created once, this is also called for worker states */
+  if (!trace_drain_lock)
+  {
+    lj_err = (*current_jvmti())->CreateRawMonitor(current_jvmti(), "yellow_tree_trace_drain_lock", &trace_drain_lock);
+    lj_check_jvmti_error(L);
+  }
+
+  lua_register(L, "lj_drain_trace_log",            lj_drain_trace_log);
+}
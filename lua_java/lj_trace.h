@@ -0,0 +1,19 @@
+#ifndef LJ_TRACE_H_
+#define LJ_TRACE_H_
+
+#include "lua_java.h"
+#include "lj_breakpoint.h"
+
+#define LJ_TRACE_MAX_VALUES 8
+/* strings are truncated to fit in a record */
+#define LJ_TRACE_STR_LEN 40
+
+/* Record a hit of tracepoint `bp' in the calling thread's trace ring.
+   Never blocks, the record is dropped if the ring is full. */
+void lj_trace_record(lj_breakpoint *bp, JNIEnv *jni, jthread thread, jlocation location);
+
+/* Give up the calling thread's trace ring, called when the thread
+   ends. The ring is freed once its records are drained. */
+void lj_trace_thread_end();
+
+#endif /* LJ_TRACE_H_ */
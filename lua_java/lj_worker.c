@@ -0,0 +1,143 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "myjni.h"
+#include "jni_util.h"
+#include "lua_interface.h"
+#include "lua_java.h"
+#include "java_bridge.h"
+#include "lj_internal.h"
+#include "lj_atomic.h"
+#include "lj_context.h"
+#include "lj_worker.h"
+
+/* Worker Lua states.
+
+   Breakpoint actions run in a Lua state owned by the thread that hit
+   the breakpoint instead of the debugger's state, so they don't wait
+   for `debug_lock' and can run on many threads at once. Each worker
+   state has the lj_* functions and java_bridge loaded. State shared
+   with the debugger is kept in C: the breakpoint table and the store
+   (lj_store.c).
+
+   Compiled actions are cached in the worker registry by breakpoint id.
+   An action can't change for a given id, the cache is emptied when
+   breakpoints are cleared so it doesn't keep actions of cleared ones.
+
+   A worker state is closed when its thread ends, see
+   lj_worker_thread_end(). */
+
+#define WORKER_ACTIONS_KEY "yellow_tree_worker_actions"
+
+static LJ_THREAD_LOCAL lua_State *worker_L;
+/* set if creating the worker failed so it isn't retried on every event */
+static LJ_THREAD_LOCAL int worker_failed;
+/* lj_breakpoint_generation() when the action cache was emptied */
+static LJ_THREAD_LOCAL uint32_t worker_generation;
+
+static lua_State *get_worker_state()
+{
+  lua_State *L;
+
+  if (worker_L || worker_failed)
+    return worker_L;
+
+  L = luaL_newstate();
+  if (!L)
+  {
+    worker_failed = 1;
+    return NULL;
+  }
+  luaL_openlibs(L);
+  lj_open(L);
+
+  lua_pushcfunction(L, lua_print_traceback);
+  if (luaL_loadstring(L, "require('java_bridge/java_bridge') require('debuglib/shared')") ||
+      lua_pcall(L, 0, 0, -2))
+  {
+    fprintf(stderr, "Failed to initialize worker state\n");
+    lua_close(L);
+    worker_failed = 1;
+    return NULL;
+  }
+  lua_settop(L, 0);
+
+  lua_newtable(L);
+  lua_setfield(L, LUA_REGISTRYINDEX, WORKER_ACTIONS_KEY);
+  worker_generation = lj_breakpoint_generation();
+
+  worker_L = L;
+  return L;
+}
+
+/* push the compiled action of `bp', nil if it doesn't compile */
+static void push_action(lua_State *L, lj_breakpoint *bp)
+{
+  uint32_t generation = lj_breakpoint_generation();
+
+  if (generation != worker_generation)
+  {
+    lua_newtable(L);
+    lua_setfield(L, LUA_REGISTRYINDEX, WORKER_ACTIONS_KEY);
+    worker_generation = generation;
+  }
+
+  lua_getfield(L, LUA_REGISTRYINDEX, WORKER_ACTIONS_KEY);
+  lua_rawgeti(L, -1, bp->id);
+  if (lua_isnil(L, -1))
+  {
+    lua_pop(L, 1);
+    if (luaL_loadbuffer(L, bp->action, strlen(bp->action), "=breakpoint action"))
+    {
+      fprintf(stderr, "Error compiling breakpoint action: %s\n", lua_tostring(L, -1));
+      lua_pop(L, 2);
+      lua_pushnil(L);
+      return;
+    }
+    lua_pushvalue(L, -1);
+    lua_rawseti(L, -3, bp->id);
+  }
+  lua_remove(L, -2);
+}
+
+int lj_worker_run_action(lj_breakpoint *bp, JNIEnv *jni, jthread thread,
+                         jmethodID method_id, jlocation location)
+{
+  lua_State *L;
+  lj_arena_mark mark;
+  int base;
+  int stop = 1;
+
+  L = get_worker_state();
+  if (!L)
+    return 1;
+
+  /* the action can hit other breakpoints on this thread. An error in
+     the action can skip releasing arena memory, it's released here */
+  mark = lj_arena_get_mark();
+  base = lua_gettop(L);
+  lua_pushcfunction(L, lua_print_traceback);
+  push_action(L, bp);
+  if (!lua_isnil(L, -1))
+  {
+    new_jobject(L, thread);
+    new_jmethod_id(L, method_id);
+    lua_pushinteger(L, location);
+    if (lua_pcall(L, 3, 1, base + 1) == 0)
+      stop = lua_toboolean(L, -1);
+  }
+  lua_settop(L, base);
+  lj_arena_release(mark);
+
+  return stop;
+}
+
+void lj_worker_thread_end()
+{
+  if (worker_L)
+  {
+    lua_close(worker_L);
+    worker_L = NULL;
+  }
+  worker_failed = 0;
+}
@@ -0,0 +1,18 @@
+#ifndef LJ_WORKER_H_
+#define LJ_WORKER_H_
+
+#include "lua_java.h"
+#include "lj_breakpoint.h"
+
+/* Run the action of breakpoint `bp' in the calling thread's worker
+   state. Returns non-zero if the breakpoint should be handled by the
+   debugger: the action returned true, raised an error, or there is no
+   worker state. */
+int lj_worker_run_action(lj_breakpoint *bp, JNIEnv *jni, jthread thread,
+                         jmethodID method_id, jlocation location);
+
+/* Close the calling thread's worker state, if any. Called when the
+   thread ends. */
+void lj_worker_thread_end();
+
+#endif /* LJ_WORKER_H_ */
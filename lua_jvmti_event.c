@@ -12,12 +12,14 @@
 #include "lua_interface.h"
 #include "java_bridge.h"
 #include "lj_internal.h"
+#include "lj_breakpoint.h"
+#include "lj_trace.h"
+#include "lj_worker.h"
+#include "lj_context.h"
 
 /* from lua_java.c */
 extern lua_State *lj_L;
 
-extern jthread lj_current_thread;
-
 /* function references for callback functions */
 static struct {
   int cb_breakpoint_ref;
@@ -30,8 +32,41 @@ static struct {
   int cb_field_modification_ref;
 } lj_jvmti_callbacks;
 
+/* Lua threads used to run event callbacks. A thread is taken from the
+   pool for the duration of a callback and returned with an empty
+   stack. Pooled threads are anchored in the registry so they are not
+   collected. */
+
+#define EVENT_THREAD_POOL_SIZE 64
+
+typedef struct {
+  lua_State *L;
+  int ref;                      /* registry reference anchoring L */
+  lj_context_saved saved;       /* context of an enclosing event */
+} event_thread;
+
+static struct {
+  jrawMonitorID lock;
+  int count;
+  event_thread threads[EVENT_THREAD_POOL_SIZE];
+  /* statistics */
+  jlong created;
+  jlong reused;
+} event_thread_pool;
+
+/* Per-thread state created by events on application threads is freed
+   when the thread ends. ThreadEnd is always enabled. */
+static void JNICALL cb_thread_end(jvmtiEnv *jvmti, JNIEnv *jni, jthread thread)
+{
+  lj_worker_thread_end();
+  lj_trace_thread_end();
+  lj_context_thread_end();
+}
+
 void lj_init_jvmti_event()
 {
+  jvmtiEventCallbacks *evCbs;
+
   /* clear callback refs */
   lj_jvmti_callbacks.cb_breakpoint_ref = LUA_NOREF;
   lj_jvmti_callbacks.cb_method_entry_ref = LUA_NOREF;
@@ -43,6 +78,17 @@ void lj_init_jvmti_event()
 
   lj_jvmti_callbacks.cb_field_access_ref = LUA_NOREF;
   lj_jvmti_callbacks.cb_field_modification_ref = LUA_NOREF;
+
+  lj_err = (*current_jvmti())->CreateRawMonitor(current_jvmti(), "yellow_tree_event_thread_pool",
+                                                &event_thread_pool.lock);
+  assert(lj_err == JVMTI_ERROR_NONE);
+
+  evCbs = get_jvmti_callbacks();
+  evCbs->ThreadEnd = cb_thread_end;
+  lj_err = (*current_jvmti())->SetEventCallbacks(current_jvmti(), evCbs, sizeof(jvmtiEventCallbacks));
+  assert(lj_err == JVMTI_ERROR_NONE);
+  lj_err = EV_ENABLET(THREAD_END, NULL);
+  assert(lj_err == JVMTI_ERROR_NONE);
 }
 
 static void disable_events_before_callback_handling(lua_State *L)
@@ -69,113 +115,210 @@ static void enable_events_after_callback_handling(lua_State *L)
   }
 }
 
+static void lock_event_thread_pool()
+{
+  jvmtiError err = (*current_jvmti())->RawMonitorEnter(current_jvmti(), event_thread_pool.lock);
+  assert(err == JVMTI_ERROR_NONE);
+  (void)err;
+}
+
+static void unlock_event_thread_pool()
+{
+  jvmtiError err = (*current_jvmti())->RawMonitorExit(current_jvmti(), event_thread_pool.lock);
+  assert(err == JVMTI_ERROR_NONE);
+  (void)err;
+}
+
+static void acquire_event_thread(event_thread *et)
+{
+  lock_event_thread_pool();
+  if (event_thread_pool.count > 0)
+  {
+    *et = event_thread_pool.threads[--event_thread_pool.count];
+    event_thread_pool.reused++;
+    unlock_event_thread_pool();
+    return;
+  }
+  event_thread_pool.created++;
+  unlock_event_thread_pool();
+
+  et->L = lua_newthread(lj_L);
+  et->ref = luaL_ref(lj_L, LUA_REGISTRYINDEX); /* pops the thread */
+}
+
+static void release_event_thread(event_thread *et)
+{
+  int pooled = 0;
+
+  lua_settop(et->L, 0);
+  /* a thread that died with an error cannot be reused */
+  if (lua_status(et->L) == LUA_OK)
+  {
+    lock_event_thread_pool();
+    if (event_thread_pool.count < EVENT_THREAD_POOL_SIZE)
+    {
+      event_thread_pool.threads[event_thread_pool.count++] = *et;
+      pooled = 1;
+    }
+    unlock_event_thread_pool();
+  }
+
+  if (!pooled)
+    luaL_unref(lj_L, LUA_REGISTRYINDEX, et->ref);
+}
+
+/* Common start of all callbacks. Leaves the traceback function, the
+   callback function and the thread object on the stack of the event
+   thread. Callback specific arguments are then pushed by the caller. */
+static lua_State *begin_callback(event_thread *et, JNIEnv *jni, jthread thread,
+                                 jvmtiEvent event, int ref)
+{
+  acquire_event_thread(et);
+
+  lj_context_begin_event(&et->saved, jni, thread, event);
+
+  disable_events_before_callback_handling(lj_L);
+
+  lua_pushcfunction(et->L, lua_print_traceback);
+  lua_rawgeti(et->L, LUA_REGISTRYINDEX, ref);
+  new_jobject(et->L, thread);
+
+  return et->L;
+}
+
+/* Call the callback with `nargs' arguments (including the thread) and
+   give back the event thread */
+static void end_callback(event_thread *et, int nargs)
+{
+  lua_pcall(et->L, nargs, 0, -(nargs + 2));
+  release_event_thread(et);
+
+  enable_events_after_callback_handling(lj_L);
+
+  lj_context_end_event(&et->saved);
+}
+
+/* lj_get_event_thread_stats() returns the number of Lua threads
+   created for callbacks and the number of callbacks that reused one */
+int lj_get_event_thread_stats(lua_State *L)
+{
+  jlong created;
+  jlong reused;
+  int pooled;
+
+  lock_event_thread_pool();
+  created = event_thread_pool.created;
+  reused = event_thread_pool.reused;
+  pooled = event_thread_pool.count;
+  unlock_event_thread_pool();
+
+  lua_newtable(L);
+  lua_pushinteger(L, created);
+  lua_setfield(L, -2, "created");
+  lua_pushinteger(L, reused);
+  lua_setfield(L, -2, "reused");
+  lua_pushinteger(L, pooled);
+  lua_setfield(L, -2, "pooled");
+
+  return 1;
+}
+
 static void JNICALL cb_breakpoint(jvmtiEnv *jvmti, JNIEnv *jni, jthread thread,
 								  jmethodID method_id, jlocation location)
 {
-  /* all following callbacks are a copy of this code, changed for the
-     callback ref and the callback arguments */
   int ref = lj_jvmti_callbacks.cb_breakpoint_ref;
+  event_thread et;
   lua_State *L;
+  lj_breakpoint *bp;
+  jint bp_id;
 
-  if (ref == LUA_NOREF)
+  /* don't enter Lua for breakpoints that are disabled, not ours, or
+     whose condition is false */
+  bp = lj_breakpoint_acquire(method_id, location);
+  if (!bp)
     return;
+  if (!lj_breakpoint_check(bp, jni, thread))
+  {
+    lj_breakpoint_release(bp);
+    return;
+  }
 
-  L = lua_newthread(lj_L);
+  /* tracepoints are recorded here and never stop the thread */
+  if (bp->kind == LJ_BREAKPOINT_TRACE)
+  {
+    lj_trace_record(bp, jni, thread, location);
+    lj_breakpoint_release(bp);
+    return;
+  }
 
-  lj_current_thread = (*jni)->NewGlobalRef(jni, thread);
-  assert(lj_current_thread);
+  /* actions run in this thread's worker state, without debug_lock,
+     and decide if the debugger is entered */
+  if (bp->action && !lj_worker_run_action(bp, jni, thread, method_id, location))
+  {
+    lj_breakpoint_release(bp);
+    return;
+  }
 
-  disable_events_before_callback_handling(lj_L);
+  if (ref == LUA_NOREF)
+  {
+    lj_breakpoint_release(bp);
+    return;
+  }
+  bp_id = bp->id;
+  lj_breakpoint_release(bp);
 
-  lua_pushcfunction(L, lua_print_traceback);
-  lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
-  new_jobject(L, thread);
+  L = begin_callback(&et, jni, thread, JVMTI_EVENT_BREAKPOINT, ref);
   new_jmethod_id(L, method_id);
   lua_pushinteger(L, location);
-  lua_pcall(L, 3, 0, -5);
-  lua_pop(lj_L, 1); /* the new lua_State, we're done with it */
-
-  enable_events_after_callback_handling(lj_L);
+  lua_pushinteger(L, bp_id);
+  end_callback(&et, 4);
 }
 
 static void JNICALL cb_method_entry(jvmtiEnv *jvmti, JNIEnv *jni, jthread thread, jmethodID method_id)
 {
   int ref = lj_jvmti_callbacks.cb_method_entry_ref;
+  event_thread et;
   lua_State *L;
 
   if (ref == LUA_NOREF)
     return;
 
-  L = lua_newthread(lj_L);
-
-  lj_current_thread = (*jni)->NewGlobalRef(jni, thread);
-  assert(lj_current_thread);
-
-  disable_events_before_callback_handling(lj_L);
-
-  lua_pushcfunction(L, lua_print_traceback);
-  lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
-  new_jobject(L, thread);
+  L = begin_callback(&et, jni, thread, JVMTI_EVENT_METHOD_ENTRY, ref);
   new_jmethod_id(L, method_id);
-  lua_pcall(L, 2, 1, -4);
-  lua_pop(lj_L, 1); /* the new lua_State, we're done with it */
-
-  enable_events_after_callback_handling(lj_L);
+  end_callback(&et, 2);
 }
 
 static void JNICALL cb_method_exit(jvmtiEnv *jvmti, JNIEnv *jni, jthread thread, jmethodID method_id,
 								   jboolean was_popped_by_exception, jvalue return_value)
 {
   int ref = lj_jvmti_callbacks.cb_method_exit_ref;
+  event_thread et;
   lua_State *L;
 
   if (ref == LUA_NOREF)
     return;
 
-  L = lua_newthread(lj_L);
-
-  lj_current_thread = (*jni)->NewGlobalRef(jni, thread);
-  assert(lj_current_thread);
-
-  disable_events_before_callback_handling(lj_L);
-
-  lua_pushcfunction(L, lua_print_traceback);
-  lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
-  new_jobject(L, thread);
+  L = begin_callback(&et, jni, thread, JVMTI_EVENT_METHOD_EXIT, ref);
   new_jmethod_id(L, method_id);
   lua_pushboolean(L, was_popped_by_exception);
   /* TODO return_value must be passed to Lua */
-  lua_pcall(L, 3, 1, -5);
-  lua_pop(lj_L, 1); /* the new lua_State, we're done with it */
-
-  enable_events_after_callback_handling(lj_L);
+  end_callback(&et, 3);
 }
 
 static void JNICALL cb_single_step(jvmtiEnv *jvmti, JNIEnv *jni, jthread thread, jmethodID method_id,
 									 jlocation location)
 {
   int ref = lj_jvmti_callbacks.cb_single_step_ref;
+  event_thread et;
   lua_State *L;
 
   if (ref == LUA_NOREF)
     return;
 
-  L = lua_newthread(lj_L);
-
-  lj_current_thread = (*jni)->NewGlobalRef(jni, thread);
-  assert(lj_current_thread);
-
-  disable_events_before_callback_handling(lj_L);
-
-  lua_pushcfunction(L, lua_print_traceback);
-  lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
-  new_jobject(L, thread);
+  L = begin_callback(&et, jni, thread, JVMTI_EVENT_SINGLE_STEP, ref);
   new_jmethod_id(L, method_id);
   lua_pushinteger(L, location);
-  lua_pcall(L, 3, 1, -5);
-  lua_pop(lj_L, 1); /* the new lua_State, we're done with it */
-
-  enable_events_after_callback_handling(lj_L);
+  end_callback(&et, 3);
 }
 
 static void JNICALL cb_exception_throw(jvmtiEnv *jvmti, JNIEnv *jni, jthread thread, jmethodID method_id,
@@ -183,30 +326,19 @@ static void JNICALL cb_exception_throw(jvmtiEnv *jvmti, JNIEnv *jni, jthread thr
 									   jmethodID catch_method, jlocation catch_location)
 {
   int ref = lj_jvmti_callbacks.cb_exception_throw_ref;
+  event_thread et;
   lua_State *L;
 
   if (ref == LUA_NOREF)
 	return;
 
-  L = lua_newthread(lj_L);
-
-  lj_current_thread = (*jni)->NewGlobalRef(jni, thread);
-  assert(lj_current_thread);
-
-  disable_events_before_callback_handling(lj_L);
-
-  lua_pushcfunction(L, lua_print_traceback);
-  lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
-  new_jobject(L, thread);
+  L = begin_callback(&et, jni, thread, JVMTI_EVENT_EXCEPTION, ref);
   new_jmethod_id(L, method_id);
   lua_pushinteger(L, location);
   new_jobject(L, exception);
   new_jmethod_id(L, catch_method);
   lua_pushinteger(L, catch_location);
-  lua_pcall(L, 6, 0, -8);
-  lua_pop(lj_L, 1); /* the new lua_State, we're done with it */
-  
-  enable_events_after_callback_handling(lj_L);
+  end_callback(&et, 6);
 }
 
 static void JNICALL cb_field_access(jvmtiEnv *jvmti,
@@ -219,31 +351,20 @@ static void JNICALL cb_field_access(jvmtiEnv *jvmti,
                                     jfieldID field_id)
 {
     int ref = lj_jvmti_callbacks.cb_field_access_ref;
+    event_thread et;
     lua_State *L;
 
     printf("***** cb_field_access_ref *****\n");
     if (ref == LUA_NOREF)
         return;
 
-    L = lua_newthread(lj_L);
-
-    lj_current_thread = (*jni)->NewGlobalRef(jni, thread);
-    assert(lj_current_thread);
-
-    disable_events_before_callback_handling(lj_L);
-
-    lua_pushcfunction(L, lua_print_traceback);
-    lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
-    new_jobject(L, thread);
+    L = begin_callback(&et, jni, thread, JVMTI_EVENT_FIELD_ACCESS, ref);
     new_jmethod_id(L, method_id);
     lua_pushinteger(L, location);
     new_jobject(L, field_klass);
     new_jobject(L, object);
     new_jfield_id(L, field_id, field_klass);
-    lua_pcall(L, 6, 0, -8);
-    lua_pop(lj_L, 1); /* the new lua_State, we're done with it */
-
-    enable_events_after_callback_handling(lj_L);
+    end_callback(&et, 6);
 }
 
 static void JNICALL cb_field_modification(jvmtiEnv *jvmti,
@@ -258,31 +379,20 @@ static void JNICALL cb_field_modification(jvmtiEnv *jvmti,
                                           jvalue new_value)
 {
     int ref = lj_jvmti_callbacks.cb_field_modification_ref;
+    event_thread et;
     lua_State *L;
 
     printf("***** cb_field_modification_ref *****\n");
     if (ref == LUA_NOREF)
         return;
 
-    L = lua_newthread(lj_L);
-
-    lj_current_thread = (*jni)->NewGlobalRef(jni, thread);
-    assert(lj_current_thread);
-
-    disable_events_before_callback_handling(lj_L);
-
-    lua_pushcfunction(L, lua_print_traceback);
-    lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
-    new_jobject(L, thread);
+    L = begin_callback(&et, jni, thread, JVMTI_EVENT_FIELD_MODIFICATION, ref);
     new_jmethod_id(L, method_id);
     lua_pushinteger(L, location);
     new_jobject(L, field_klass);
     new_jobject(L, object);
     new_jfield_id(L, field_id, field_klass);
-    lua_pcall(L, 6, 0, -8);
-    lua_pop(lj_L, 1); /* the new lua_State, we're done with it */
-
-    enable_events_after_callback_handling(lj_L);
+    end_callback(&et, 6);
 }
 
 static void get_jvmti_callback_pointers(const char *callback,
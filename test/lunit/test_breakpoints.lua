@@ -37,5 +37,161 @@ function test_breakpoint_on_main_thread()
    bc()
 end
 
+function test_breakpoint_hit_count_and_disable()
+   bp("java/lang/StringBuilder.append(Z)Ljava/lang/StringBuilder;")
+   local b = bl()[1]
+   b.handler = function () end -- resume immediately
+   java.lang.StringBuilder.new().append(true)
+   assert_equal(1, b.hit_count)
+   bd(1)
+   assert_false(b.enabled)
+   java.lang.StringBuilder.new().append(true)
+   assert_equal(1, b.hit_count)
+   bc()
+   -- a cleared breakpoint has no native state
+   assert_nil(b.hit_count)
+   assert_nil(b.enabled)
+   assert_match("cleared", tostring(b))
+end
+
+function test_breakpoint_condition()
+   local x = 0
+   bp("java/lang/StringBuilder.append(Z)Ljava/lang/StringBuilder;", 0,
+      'thread.name == "no such thread"')
+   local b = bl()[1]
+   b.handler = function ()
+      x = x + 1
+   end
+   java.lang.StringBuilder.new().append(true)
+   assert_equal(0, x)
+   assert_equal(0, b.hit_count)
+   bcond(1, 'thread.name == "' .. current_thread().name .. '"')
+   java.lang.StringBuilder.new().append(true)
+   assert_equal(1, x)
+   assert_equal(1, b.hit_count)
+   assert_error(function () bcond(1, "noSuchLocal > 1") end)
+   bc()
+end
+
+function test_breakpoint_condition_null_string()
+   local x = 0
+   bp("BasicTestClass.someStaticMethod(Ljava/lang/String;)Ljava/lang/String;", 0,
+      'smth ~= "abc"')
+   bl()[1].handler = function ()
+      x = x + 1
+   end
+   BasicTestClass.someStaticMethod(nil)
+   assert_equal(1, x)
+   bcond(1, 'smth == "abc"')
+   BasicTestClass.someStaticMethod(nil)
+   assert_equal(1, x)
+   bc()
+end
+
+function test_breakpoint_condition_constant_types()
+   local method = jmethod_id.find("java/lang/StringBuilder.append(Z)Ljava/lang/StringBuilder;")
+   local clause = {source="thread_name", sig="Ljava/lang/String;", op="==", value=1}
+   assert_error(function () lj_set_breakpoint(method.method_id_raw, 0, {clause}) end)
+   assert_nil(lj_find_breakpoint(method.method_id_raw, 0))
+end
+
+function test_tracepoint_does_not_stop()
+   local x = 0
+   tp("java/lang/StringBuilder.append(Z)Ljava/lang/StringBuilder;", 0, "thread.name")
+   local b = bl()[1]
+   b.handler = function ()
+      x = x + 1
+   end
+   lj_drain_trace_log() -- discard anything left by other tests
+   java.lang.StringBuilder.new().append(true)
+   java.lang.StringBuilder.new().append(false)
+   assert_equal(0, x)
+   assert_equal(2, b.hit_count)
+   local records = tracelog()
+   assert_equal(2, #records)
+   assert_equal(b.id, records[1].id)
+   assert_equal(1, records[1].values.n)
+   assert_equal(current_thread().name, records[1].values[1])
+   assert_equal(0, #tracelog())
+   bc()
+end
+
+function test_event_threads_are_reused()
+   bp("java/lang/StringBuilder.append(Z)Ljava/lang/StringBuilder;")
+   bl()[1].handler = function () end -- resume immediately
+   java.lang.StringBuilder.new().append(true)
+   local before = lj_get_event_thread_stats()
+   java.lang.StringBuilder.new().append(true)
+   java.lang.StringBuilder.new().append(true)
+   local after = lj_get_event_thread_stats()
+   assert_equal(before.created, after.created)
+   assert_equal(before.reused + 2, after.reused)
+   bc()
+end
+
+function test_breakpoint_action_runs_without_stopping()
+   local x = 0
+   shared.action_count = nil
+   bp("java/lang/StringBuilder.append(Z)Ljava/lang/StringBuilder;")
+   local b = bl()[1]
+   b.handler = function ()
+      x = x + 1
+   end
+   baction(1, "lj_store_add('shared.action_count', 1) return false")
+   java.lang.StringBuilder.new().append(true)
+   java.lang.StringBuilder.new().append(true)
+   assert_equal(0, x)
+   assert_equal(2, shared.action_count)
+   baction(1, "return true")
+   java.lang.StringBuilder.new().append(true)
+   assert_equal(1, x)
+   bc()
+end
+
+function test_current_thread_during_event()
+   local name
+   bp("java/lang/StringBuilder.append(Z)Ljava/lang/StringBuilder;")
+   bl()[1].handler = function (bp, thread)
+      name = jthread.create(lj_get_current_thread()).name
+   end
+   java.lang.StringBuilder.new().append(true)
+   assert_equal(current_thread().name, name)
+   bc()
+end
+
+function test_frame_locals()
+   local locals
+   bp("BasicTestClass.someStaticMethod(Ljava/lang/String;)Ljava/lang/String;")
+   bl()[1].handler = function (bp, thread)
+      locals = thread.frames[1]:locals()
+   end
+   BasicTestClass.someStaticMethod("abc")
+   assert_equal("abc", tostring(locals.smth))
+   local names = {}
+   for name in pairs(locals) do
+      table.insert(names, name)
+   end
+   assert_equal(1, #names)
+   bc()
+end
+
+function test_stack_trace()
+   local count, top, same_frame
+   bp("BasicTestClass.someStaticMethod(Ljava/lang/String;)Ljava/lang/String;")
+   bl()[1].handler = function (bp, thread)
+      count = #thread.frames
+      top = lj_get_stack_trace(thread.object_raw, 1, 1)
+      -- frames are cached while the thread is stopped
+      same_frame = rawequal(thread.frames[1], thread.frames[1])
+   end
+   BasicTestClass.someStaticMethod("abc")
+   assert_true(count > 1)
+   assert_equal(1, #top)
+   assert_equal(1, top[1].depth)
+   assert_equal("someStaticMethod", jmethod_id.from_raw_method_id(top[1].method_id_raw).name)
+   assert_true(same_frame)
+   bc()
+end
+
 function test_breakpoint_setting_by_method_id()
 end
@@ -191,3 +191,344 @@ function test_array_access()
    assert_true(math.abs(40.12345 - tt.darray[3]) < 0.0001)
    assert_equal(40.12345, tt.darray[3])
 end
+
+function test_known_classes()
+   assert_equal("java.lang.Thread", lj_call_method(lj_known.Thread, lj_known.Class_getName, false, "STR", 0))
+   assert_equal(java.lang.Integer, jclass.create(lj_known.Integer))
+   local class_raw, class_name = lj_get_object_class(java.lang.String.new("x").object_raw)
+   assert_equal("java.lang.String", class_name)
+   assert_equal(java.lang.String, jclass.create(class_raw, class_name))
+   local boxed = lj_call_method(lj_known.Integer, lj_known.Integer_valueOf, true, "L", 1, "I", 42)
+   assert_true(lj_is_instance_of(boxed, lj_known.Integer))
+   assert_equal(42, lj_call_method(boxed, lj_known.Integer_intValue, false, "I", 0))
+   -- the given types must agree with the method's parameters
+   assert_false(pcall(lj_call_method, lj_known.Integer, lj_known.Integer_valueOf, true, "L", 1, "STR", "42"))
+   assert_false(pcall(lj_call_method, lj_known.Integer, lj_known.Integer_valueOf, true, "L", 1, "J", 42))
+end
+
+function test_method_info_is_cached()
+   local method = java.lang.String.methods["length()I"]
+   local info = lj_get_method_info(method.method_id_raw)
+   assert_equal("length", info.name)
+   assert_equal("", info.args)
+   assert_equal("I", info.ret)
+   assert_true(info.modifiers.public)
+   -- the same table is shared until the cache is cleared
+   assert_true(rawequal(info, lj_get_method_info(method.method_id_raw)))
+   assert_true(rawequal(info.line_number_table, method.line_number_table))
+   assert_false(pcall(function () info.extra = 1 end))
+   assert_false(pcall(function () info.name = "x" end))
+   assert_false(pcall(function () info.modifiers.public = false end))
+   assert_true(info.modifiers.public)
+   lj_clear_method_cache()
+   local info2 = lj_get_method_info(method.method_id_raw)
+   assert_false(rawequal(info, info2))
+   assert_equal(info.sig, info2.sig)
+end
+
+function test_classes_are_interned()
+   local s1 = java.lang.String.new("a")
+   local s2 = java.lang.String.new("b")
+   assert_true(rawequal(s1.class, s2.class))
+   assert_true(rawequal(java.lang.String, jclass.create(lj_known.String)))
+   -- members are loaded on first access
+   local class = jclass.find("java/util/concurrent/atomic/AtomicLongArray")
+   assert_nil(rawget(class, "methods"))
+   assert_not_nil(class.methods["length()I"])
+   assert_not_nil(rawget(class, "methods"))
+end
+
+function test_member_index()
+   local list_class = java.util.ArrayList
+   -- declared, inherited from a superclass and from an interface
+   assert_equal(1, #list_class:find_methods("size"))
+   assert_true(#list_class:find_methods("hashCode") >= 1)
+   assert_true(#list_class:find_methods("stream") >= 1)
+   assert_true(rawequal(list_class:find_methods("add"), list_class:find_methods("add")))
+   assert_equal(0, #list_class:find_methods("no_such_method"))
+   -- only the class' own constructors
+   for idx, m in ipairs(list_class:find_methods("new")) do
+      assert_equal(list_class, m.class)
+   end
+   assert_not_nil(list_class:find_field("modCount"))
+   assert_equal("java.util.AbstractList", list_class:find_field("modCount").class.name)
+end
+
+function test_overload_resolution()
+   local s = java.lang.String.new("abcb")
+   -- indexOf(II) is tried first and must not leave arguments behind
+   assert_equal(1, s.indexOf("b", 0))
+   assert_equal(3, s.indexOf("b", 2))
+   local list = java.util.ArrayList.new()
+   for i = 1, 10 do
+      list.add(java.lang.String.new("e" .. i))
+   end
+   list.add(0, java.lang.String.new("first"))
+   assert_equal(11, list.size())
+   assert_equal("first", list.get(0).toString())
+   for i = 1, 10 do
+      assert_equal("e" .. i, list.get(i).toString())
+   end
+end
+
+function test_call_method_plan()
+   local s = java.lang.String.new("abc")
+   local indexOf = java.lang.String.methods["indexOf(Ljava/lang/String;)I"]
+   -- string arguments are released after each call
+   for i = 1, 1000 do
+      assert_equal(2, lj_call_method(s.object_raw, indexOf.method_id_raw, false, "I", 1, "STR", "c"))
+   end
+   -- the argument count is checked against the descriptor
+   assert_false(pcall(lj_call_method, s.object_raw, indexOf.method_id_raw, false, "I", 0))
+   -- objects can be returned as strings
+   assert_equal("abc", lj_call_method(s.object_raw, lj_known.Object_toString, false, "STR", 0))
+end
+
+function test_field_info()
+   local field = java.lang.String.fields.CASE_INSENSITIVE_ORDER
+   local info = lj_get_field_info(field.field_id_raw)
+   assert_equal("CASE_INSENSITIVE_ORDER", info.name)
+   assert_equal("Ljava/util/Comparator;", info.sig)
+   assert_true(info.modifiers.static)
+   -- static-ness comes from the field, not the caller
+   assert_not_nil(lj_get_field(java.lang.String.object_raw, field.field_id_raw, false))
+end
+
+function test_snapshot_object()
+   local list = java.util.ArrayList.new()
+   list.add(java.lang.String.new("one"))
+   list.add(java.lang.String.new("two"))
+   local snap = lj_snapshot_object(list.object_raw, 1)
+   assert_equal("java.util.ArrayList", snap.class)
+   local fields = {}
+   for idx, field in ipairs(snap.fields) do
+      fields[field.name] = field.value
+   end
+   -- inherited from AbstractList
+   assert_equal(2, fields.modCount)
+   assert_equal(2, fields.size)
+   assert_equal("[Ljava.lang.Object;", fields.elementData.class)
+   assert_equal("one", fields.elementData.elements[1])
+   assert_equal("two", fields.elementData.elements[2])
+   -- references aren't followed past the depth
+   snap = lj_snapshot_object(list.object_raw, 0, {max_fields = 1})
+   assert_nil(snap.fields[1].value.elements)
+   assert_equal(1, #snap.fields)
+   assert_true(snap.more_fields > 0)
+   assert_error(function () lj_snapshot_object(list.object_raw, 0, {max_string = -1}) end)
+   assert_error(function () lj_snapshot_object(list.object_raw, 1, {max_elements = -1}) end)
+end
+
+function test_thread_dump()
+   local dump = lj_thread_dump()
+   assert_not_nil(dump:find('"main"', 1, true))
+   assert_not_nil(dump:find("at BasicTestClass.main(BasicTestClass.java", 1, true))
+   -- grouping doesn't lose any threads
+   local grouped = lj_thread_dump(nil, true)
+   assert_not_nil(grouped:find('"main"', 1, true))
+   -- only the top frame of each thread
+   assert_nil(lj_thread_dump(1):find("\tat [^\n]*\n\tat "))
+end
+
+function test_array_region_and_view()
+   local tt = TestTypes.new()
+   tt.assign()
+   local ints = tt.iarray:region(2, 2)
+   assert_equal(2, ints.n)
+   assert_equal(850, ints[2])
+   local objects = tt.oarray:region()
+   assert_equal(5, objects.n)
+   assert_nil(objects[2])
+   assert_equal("number2", objects[3].toString())
+
+   local view = tt.jarray:view()
+   assert_equal(tt.jarray.length, #view)
+   assert_equal("J", view.type)
+   assert_equal(8500, view[4])
+   assert_nil(view[#view + 1])
+   -- slices share the elements of the view
+   local slice = view:slice(3, 2)
+   assert_equal(2, #slice)
+   assert_equal(8500, slice[2])
+   assert_equal(8500, slice:totable()[2])
+end
+
+function test_array_scan()
+   local tt = TestTypes.new()
+   tt.assign()
+   local indexes, count = tt.iarray:find(850)
+   assert_equal(1, count)
+   assert_equal(3, indexes[1])
+   assert_equal(tt.iarray.length - 1, tt.iarray:count(0, 0) + tt.iarray:count(1, 849))
+   local stats = tt.jarray:stats()
+   assert_equal(tt.jarray.length, stats.count)
+   assert_equal(8500, stats.max)
+   local histogram = tt.iarray:histogram(0, 1000, 2)
+   assert_equal(tt.iarray.length, histogram[1] + histogram[2] + histogram.below + histogram.above)
+
+   local bytes = java.lang.String.new("abcabcab").getBytes()
+   indexes, count = bytes:find_bytes("ab", 2)
+   assert_equal(3, count)
+   assert_equal(2, #indexes)
+   assert_equal(4, indexes[2])
+   -- views are scanned without reading the array again
+   assert_equal(2, lj_array_count(bytes:view(2), string.byte("a")))
+end
+
+function test_instance_cursor()
+   local class = BasicTestClass
+   local a = class.new("a")
+   local b = class.new("b")
+   local count = class:count_instances()
+   assert_true(count >= 2)
+   local cursor = class:instances(1)
+   assert_equal(count, #cursor)
+   local found = {}
+   for idx, obj in cursor:iterate() do
+      found[obj.getMyVal().toString()] = true
+   end
+   assert_true(found.a)
+   assert_true(found.b)
+   local first = cursor[1]
+   cursor:close()
+   assert_equal(0, #cursor)
+   -- objects taken from the cursor outlive it
+   assert_not_nil(first.toString())
+   -- the tags of the cursor are released
+   assert_equal(count, #class:find_instances())
+end
+
+function test_heap_histogram()
+   local histo = lj_heap_histogram(0)
+   assert_equal(histo.class_count, #histo)
+   local total = 0
+   local string_count
+   for idx, class in ipairs(histo) do
+      total = total + class.bytes
+      if idx > 1 then
+         assert_true(histo[idx - 1].bytes >= class.bytes)
+      end
+      if class.name == "java.lang.String" then
+         string_count = class.count
+      end
+   end
+   assert_true(string_count > 0)
+   assert_true(total <= histo.total_bytes)
+   assert_equal(5, #lj_heap_histogram(5))
+end
+
+function test_heap_diff()
+   lj_heap_snapshot("test_before")
+   local keep = {}
+   for i = 1, 50 do
+      table.insert(keep, java.lang.StringBuffer.new())
+   end
+   lj_heap_snapshot("test_after")
+
+   local diff = lj_heap_diff("test_before", "test_after", 0)
+   local grown
+   for idx, class in ipairs(diff) do
+      if idx > 1 then
+         assert_true(diff[idx - 1].bytes_delta >= class.bytes_delta)
+      end
+      if class.name == "java.lang.StringBuffer" then
+         grown = class
+      end
+   end
+   assert_true(grown.count_delta >= 50)
+   assert_true(grown.bytes_delta > 0)
+   assert_equal(0, #lj_heap_diff("test_after", "test_after"))
+
+   local names = {}
+   for _, snap in ipairs(lj_heap_snapshots()) do
+      names[snap.name] = true
+   end
+   assert_true(names.test_before and names.test_after)
+   assert_true(lj_heap_drop_snapshot("test_before"))
+   assert_false(lj_heap_drop_snapshot("test_before"))
+   assert_error(function() lj_heap_diff("test_before") end)
+   lj_heap_drop_snapshot("test_after")
+end
+
+function test_why_alive()
+   local out = java.lang.System.out
+   local path = lj_why_alive(out.object_raw)
+   assert_not_nil(path)
+   assert_not_nil(path.root.kind)
+   local last = path[#path]
+   assert_equal("java.io.PrintStream", last.class)
+   assert_equal(lj_toString(out.object_raw), lj_toString(last.object))
+   for idx = 2, #path do
+      assert_not_nil(path[idx].kind)
+   end
+   -- the classes aren't roots of the debugger's own thread
+   assert_not_equal("jni_local", path.root.kind)
+   -- a tiny budget can't reach anything but the roots
+   local path, reason = lj_why_alive(out.object_raw, 1)
+   if path then
+      assert_equal("max_objects", path.truncated)
+   else
+      assert_match("incomplete %(max_objects%)", reason)
+   end
+   -- and so can a tiny edge budget
+   path, reason = lj_why_alive(out.object_raw, nil, nil, false, 1)
+   if path then
+      assert_equal("max_edges", path.truncated)
+   else
+      assert_match("incomplete %(max_edges%)", reason)
+   end
+end
+
+function test_retained_size()
+   local sizes = lj_retained_sizes(0)
+   assert_true(#sizes > 0)
+   for idx, class in ipairs(sizes) do
+      assert_true(class.retained >= class.shallow)
+      assert_true(class.retained <= sizes.total_bytes)
+      if idx > 1 then
+         assert_true(sizes[idx - 1].retained >= class.retained)
+      end
+   end
+   assert_equal(5, #lj_retained_sizes(5))
+
+   -- System.out dominates at least itself
+   local out = java.lang.System.out
+   local retained, shallow = lj_retained_size(out.object_raw)
+   assert_true(shallow > 0)
+   assert_true(retained >= shallow)
+   local retained_both = lj_retained_size({out.object_raw, java.lang.System.err.object_raw})
+   assert_true(retained_both >= retained)
+end
+
+function test_object_ids()
+   local out = java.lang.System.out
+   local id = out:object_id()
+   assert_equal(id, lj_object_id(lj_new_global_ref(out.object_raw)))
+   assert_true(lj_is_same_object(out.object_raw, lj_object_by_id(id)))
+   assert_true(out == java.lang.System.out)
+   assert_false(out == java.lang.System.err)
+
+   -- searches that tag the same objects leave the ID alone
+   local class = lj_get_object_class(out.object_raw)
+   local found = false
+   for _, obj in ipairs(lj_get_class_instances(class)) do
+      found = found or lj_is_same_object(obj, out.object_raw)
+   end
+   assert_true(found)
+   local cursor = lj_open_instance_cursor(class)
+   local page = cursor:fetch(1, #cursor)
+   found = false
+   for idx = 1, page.n do
+      found = found or (page[idx] and lj_is_same_object(page[idx], out.object_raw))
+   end
+   cursor:close()
+   assert_true(found)
+   lj_heap_histogram(5)
+   lj_tag_sweep()
+   assert_equal(id, lj_object_id(out.object_raw))
+
+   assert_equal("object_ids", lj_tag_ranges()[1].owner)
+   lj_dispose_object_id(id)
+   assert_nil(lj_object_by_id(id))
+   assert_not_equal(id, lj_object_id(out.object_raw))
+end